@@ -0,0 +1,186 @@
+#!/bin/sh
+# Runs xdpw against xdpw-mock-compositor on a private D-Bus and PipeWire
+# instance and reports the startup time, or the frame rate, latency and CPU
+# time per frame of a screencast consumed by xdpw-latency-probe.
+#
+# Usage: xdpw-benchmark.sh <scenario> <xdpw> <mock compositor> <latency probe>
+#
+# Scenarios: startup, 1080p, 4k, 4k-strip, 4k-y-invert, and 4k-ext and
+# 4k-ext-strip, which capture over ext-image-copy-capture instead of
+# wlr-screencopy. XDPW_BENCH_DURATION sets the seconds a stream is consumed
+# (default 10). Exits with 77, which meson reports as skipped, if a required
+# daemon isn't installed.
+set -eu
+
+if [ $# -ne 4 ]; then
+	echo "usage: $0 <scenario> <xdpw> <mock compositor> <latency probe>" >&2
+	exit 1
+fi
+scenario=$1
+xdpw=$2
+mock=$3
+probe=$4
+duration=${XDPW_BENCH_DURATION:-10}
+
+skip() {
+	echo "skipped: $*"
+	exit 77
+}
+
+fail() {
+	echo "failed: $*" >&2
+	for log in "$dir"/*.log; do
+		echo "--- $log" >&2
+		tail -n 20 "$log" >&2
+	done
+	exit 1
+}
+
+size=1920x1080
+mock_args=
+case $scenario in
+startup|1080p)
+	;;
+4k)
+	size=3840x2160
+	;;
+4k-strip)
+	size=3840x2160
+	mock_args=--damage=strip
+	;;
+4k-y-invert)
+	size=3840x2160
+	mock_args=--y-invert
+	;;
+4k-ext)
+	size=3840x2160
+	mock_args=--protocol=ext
+	;;
+4k-ext-strip)
+	size=3840x2160
+	mock_args="--protocol=ext --damage=strip"
+	;;
+*)
+	echo "unknown scenario: $scenario" >&2
+	exit 1
+	;;
+esac
+
+for cmd in dbus-daemon busctl; do
+	command -v $cmd >/dev/null || skip "$cmd not found"
+done
+if [ "$scenario" != startup ]; then
+	for cmd in pipewire wireplumber; do
+		command -v $cmd >/dev/null || skip "$cmd not found"
+	done
+fi
+
+dir=$(mktemp -d)
+pids=
+cleanup() {
+	for pid in $pids; do
+		kill "$pid" 2>/dev/null || true
+	done
+	wait 2>/dev/null || true
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+wait_for() {
+	tries=100
+	while ! eval "$1"; do
+		tries=$((tries - 1))
+		[ $tries -gt 0 ] || fail "timed out waiting for $2"
+		sleep 0.1
+	done
+}
+
+export XDG_RUNTIME_DIR="$dir"
+export WAYLAND_DISPLAY=wayland-xdpw-bench
+export DBUS_SESSION_BUS_ADDRESS="unix:path=$dir/bus"
+
+dbus-daemon --session --nofork --address="$DBUS_SESSION_BUS_ADDRESS" >"$dir/dbus.log" 2>&1 &
+pids="$pids $!"
+wait_for "[ -S '$dir/bus' ]" "dbus-daemon"
+
+"$mock" --socket="$WAYLAND_DISPLAY" --size="$size" $mock_args >"$dir/mock.log" 2>&1 &
+pids="$pids $!"
+wait_for "[ -S '$dir/$WAYLAND_DISPLAY' ]" "the mock compositor"
+
+if [ "$scenario" != startup ]; then
+	pipewire >"$dir/pipewire.log" 2>&1 &
+	pids="$pids $!"
+	wait_for "[ -S '$dir/pipewire-0' ]" "pipewire"
+	wireplumber >"$dir/wireplumber.log" 2>&1 &
+	pids="$pids $!"
+fi
+
+cat >"$dir/config" <<EOF
+[screencast]
+chooser_type=none
+EOF
+
+loglevel=INFO
+if [ "$scenario" = startup ]; then
+	loglevel=DEBUG
+fi
+"$xdpw" --replace --loglevel=$loglevel --config="$dir/config" >"$dir/xdpw.log" 2>&1 &
+xdpw_pid=$!
+pids="$pids $xdpw_pid"
+wait_for "grep -q 'service name acquired' '$dir/xdpw.log'" "xdpw"
+
+portal() {
+	busctl --user call org.freedesktop.impl.portal.desktop.wlr \
+		/org/freedesktop/portal/desktop org.freedesktop.impl.portal.ScreenCast "$@"
+}
+request=/org/freedesktop/portal/desktop/request/1_0/xdpw_bench
+session=/org/freedesktop/portal/desktop/session/1_0/xdpw_bench
+
+reply=$(portal CreateSession 'oosa{sv}' $request $session xdpw-bench 0) ||
+	fail "CreateSession failed"
+case $reply in
+"ua{sv} 0 "*) ;;
+*) fail "CreateSession returned $reply" ;;
+esac
+
+if [ "$scenario" = startup ]; then
+	wait_for "grep -q 'backends initialized' '$dir/xdpw.log'" "the screencast backends"
+	name_ms=$(sed -n 's/.*service name acquired \([0-9]*\) ms after startup.*/\1/p' "$dir/xdpw.log")
+	backends_us=$(sed -n 's/.*backends initialized in \([0-9]*\) us.*/\1/p' "$dir/xdpw.log")
+	echo "startup: service name acquired after $name_ms ms," \
+		"backends initialized on the first session in $backends_us us"
+	exit 0
+fi
+
+reply=$(portal SelectSources 'oosa{sv}' $request $session xdpw-bench 0) ||
+	fail "SelectSources failed"
+reply=$(portal Start 'oossa{sv}' $request $session xdpw-bench "" 0) ||
+	fail "Start failed"
+node=$(echo "$reply" | sed -n 's/^ua{sv} 0 .*"streams" v a(ua{sv}) [0-9]* \([0-9]*\) .*/\1/p')
+[ -n "$node" ] || fail "Start returned $reply"
+
+cpu_ticks() {
+	# utime and stime, the fields after the command name
+	sed 's/^.*) //' "/proc/$xdpw_pid/stat" | awk '{ print $12 + $13 }'
+}
+
+ticks_before=$(cpu_ticks)
+timeout -s INT "$duration" "$probe" --interval=0 "$node" >"$dir/probe.log" 2>&1 || true
+ticks_after=$(cpu_ticks)
+
+frames=$(sed -n 's/^frames \([0-9]*\),.*/\1/p' "$dir/probe.log")
+[ -n "$frames" ] && [ "$frames" -gt 0 ] || fail "no frames received"
+
+metrics=$(busctl --user get-property org.freedesktop.impl.portal.desktop.wlr $session \
+	org.freedesktop.impl.portal.desktop.wlr.ScreenCastSession StreamMetrics)
+capture_us=$(echo "$metrics" | sed -n 's/.*"capture_latency_us" v t \([0-9]*\).*/\1/p')
+
+echo "$scenario: $size, ${duration}s"
+awk -v frames="$frames" -v duration="$duration" -v ticks=$((ticks_after - ticks_before)) \
+	-v hz="$(getconf CLK_TCK)" 'BEGIN {
+		printf "fps %.2f, xdpw cpu %.3f ms per frame\n",
+			frames / duration, 1000 * ticks / hz / frames
+	}'
+echo "capture latency ${capture_us:-?} us (moving average)"
+grep '^latency ms:' "$dir/probe.log" || true
@@ -0,0 +1,902 @@
+/*
+ * Headless Wayland compositor for benchmarking xdpw. It has a single
+ * output and serves either wlr-screencopy or ext-image-copy-capture frames
+ * over wl_shm: every frame is painted by the CPU, reported with a
+ * configurable damage pattern and completed on the next refresh of the
+ * output plus an artificial copy latency. Only the globals of one protocol
+ * are advertised, since xdpw prefers ext-image-copy-capture whenever it is
+ * available. linux-dmabuf is advertised without any format, xdpw requires
+ * the global to use wlr-screencopy, so frames are always shared over shm.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include "ext-image-capture-source-v1-server-protocol.h"
+#include "ext-image-copy-capture-v1-server-protocol.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+#include "wlr-screencopy-unstable-v1-server-protocol.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+enum damage_pattern {
+	DAMAGE_FULL,
+	DAMAGE_STRIP,
+};
+
+enum capture_protocol {
+	PROTOCOL_WLR,
+	PROTOCOL_EXT,
+};
+
+struct mock_rect {
+	int32_t x, y, width, height;
+};
+
+struct mock_state {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+
+	int32_t width, height;
+	int32_t refresh_mhz;
+	int64_t copy_latency_ns;
+	enum capture_protocol protocol;
+	enum damage_pattern damage;
+	bool y_invert;
+
+	int64_t start_ns;
+	uint64_t frames;
+	uint64_t failed;
+};
+
+struct mock_session {
+	struct mock_state *state;
+	struct wl_resource *resource;
+	struct mock_frame *frame;
+	uint64_t frames;
+};
+
+struct mock_frame {
+	struct mock_state *state;
+	struct wl_resource *resource;
+	struct mock_rect region;
+	// Only set for ext-image-copy-capture frames, cleared if the session
+	// is destroyed first
+	struct mock_session *session;
+	bool ext;
+
+	struct wl_resource *buffer;
+	struct wl_listener buffer_destroy;
+	struct wl_event_source *timer_source;
+	int timer_fd;
+	bool copied;
+	bool with_damage;
+	bool full_damage;
+};
+
+static int64_t now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+static int64_t refresh_period_ns(struct mock_state *state) {
+	return 1000 * NSEC_PER_SEC / state->refresh_mhz;
+}
+
+// Number of the refresh cycle at the given time
+static uint64_t refresh_seq(struct mock_state *state, int64_t time_ns) {
+	if (time_ns < state->start_ns) {
+		return 0;
+	}
+	return (time_ns - state->start_ns) / refresh_period_ns(state);
+}
+
+static bool rect_intersect(struct mock_rect *a, struct mock_rect *b,
+		struct mock_rect *out) {
+	int32_t x1 = a->x > b->x ? a->x : b->x;
+	int32_t y1 = a->y > b->y ? a->y : b->y;
+	int32_t x2 = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+	int32_t y2 = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+	if (x2 <= x1 || y2 <= y1) {
+		return false;
+	}
+	*out = (struct mock_rect){ x1, y1, x2 - x1, y2 - y1 };
+	return true;
+}
+
+// The strip covers 1/16 of the output and moves down by its height on
+// every refresh
+static struct mock_rect strip_rect(struct mock_state *state, uint64_t seq) {
+	int32_t height = state->height / 16 > 0 ? state->height / 16 : 1;
+	int32_t steps = state->height / height;
+	return (struct mock_rect){
+		.x = 0,
+		.y = (int32_t)(seq % steps) * height,
+		.width = state->width,
+		.height = height,
+	};
+}
+
+static void fill_rect(uint8_t *data, int32_t stride, struct mock_rect *rect,
+		uint32_t color) {
+	for (int32_t y = rect->y; y < rect->y + rect->height; y++) {
+		uint32_t *row = (uint32_t *)(data + (size_t)y * stride);
+		for (int32_t x = rect->x; x < rect->x + rect->width; x++) {
+			row[x] = color;
+		}
+	}
+}
+
+// Paints the region of the output as it looks at the refresh cycle seq,
+// the whole buffer is written like a compositor copying its output would
+static void frame_paint(struct mock_frame *frame, struct wl_shm_buffer *shm,
+		uint64_t seq) {
+	struct mock_state *state = frame->state;
+	int32_t stride = wl_shm_buffer_get_stride(shm);
+	struct mock_rect all = { 0, 0, frame->region.width, frame->region.height };
+
+	wl_shm_buffer_begin_access(shm);
+	uint8_t *data = wl_shm_buffer_get_data(shm);
+	switch (state->damage) {
+	case DAMAGE_FULL:
+		fill_rect(data, stride, &all, 0xff000000 | ((uint32_t)seq * 0x010307 & 0xffffff));
+		break;
+	case DAMAGE_STRIP:;
+		fill_rect(data, stride, &all, 0xff303030);
+		struct mock_rect strip = strip_rect(state, seq), painted;
+		if (rect_intersect(&strip, &frame->region, &painted)) {
+			painted.x -= frame->region.x;
+			painted.y -= frame->region.y;
+			fill_rect(data, stride, &painted, 0xffe0e0e0);
+		}
+		break;
+	}
+	wl_shm_buffer_end_access(shm);
+}
+
+static void frame_send_damage(struct mock_frame *frame, uint64_t seq) {
+	struct mock_state *state = frame->state;
+	struct mock_rect damaged[2];
+	int count = 0;
+
+	switch (frame->full_damage ? DAMAGE_FULL : state->damage) {
+	case DAMAGE_FULL:
+		damaged[count++] = frame->region;
+		break;
+	case DAMAGE_STRIP:
+		damaged[count++] = strip_rect(state, seq);
+		if (seq > 0) {
+			damaged[count++] = strip_rect(state, seq - 1);
+		}
+		break;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct mock_rect box;
+		if (!rect_intersect(&damaged[i], &frame->region, &box)) {
+			continue;
+		}
+		if (frame->ext) {
+			ext_image_copy_capture_frame_v1_send_damage(frame->resource,
+				box.x - frame->region.x, box.y - frame->region.y,
+				box.width, box.height);
+		} else {
+			zwlr_screencopy_frame_v1_send_damage(frame->resource,
+				box.x - frame->region.x, box.y - frame->region.y,
+				box.width, box.height);
+		}
+	}
+}
+
+static void frame_stop_timer(struct mock_frame *frame) {
+	if (frame->timer_source) {
+		wl_event_source_remove(frame->timer_source);
+		frame->timer_source = NULL;
+	}
+	if (frame->timer_fd >= 0) {
+		close(frame->timer_fd);
+		frame->timer_fd = -1;
+	}
+}
+
+static int frame_handle_timer(int fd, uint32_t mask, void *data) {
+	struct mock_frame *frame = data;
+	struct mock_state *state = frame->state;
+	frame_stop_timer(frame);
+
+	struct wl_shm_buffer *shm = frame->buffer ? wl_shm_buffer_get(frame->buffer) : NULL;
+	if (!shm || (frame->ext && !frame->session)) {
+		state->failed++;
+		if (!frame->ext) {
+			zwlr_screencopy_frame_v1_send_failed(frame->resource);
+		} else if (!frame->session) {
+			ext_image_copy_capture_frame_v1_send_failed(frame->resource,
+				EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+		} else {
+			ext_image_copy_capture_frame_v1_send_failed(frame->resource,
+				EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+		}
+		return 0;
+	}
+
+	int64_t now = now_ns();
+	uint64_t seq = refresh_seq(state, now - state->copy_latency_ns);
+	frame_paint(frame, shm, seq);
+
+	// ext-image-copy-capture has no flags, y-inverted frames are flipped
+	if (frame->ext) {
+		ext_image_copy_capture_frame_v1_send_transform(frame->resource,
+			state->y_invert ? WL_OUTPUT_TRANSFORM_FLIPPED_180 : WL_OUTPUT_TRANSFORM_NORMAL);
+	} else if (state->y_invert) {
+		zwlr_screencopy_frame_v1_send_flags(frame->resource,
+			ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT);
+	} else {
+		zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+	}
+	if (frame->with_damage) {
+		frame_send_damage(frame, seq);
+	}
+
+	// The timestamp is the refresh the frame was taken from
+	int64_t presented = state->start_ns + seq * refresh_period_ns(state);
+	uint64_t tv_sec = presented / NSEC_PER_SEC;
+	if (frame->ext) {
+		ext_image_copy_capture_frame_v1_send_presentation_time(frame->resource,
+			tv_sec >> 32, tv_sec & 0xffffffff, presented % NSEC_PER_SEC);
+		ext_image_copy_capture_frame_v1_send_ready(frame->resource);
+	} else {
+		zwlr_screencopy_frame_v1_send_ready(frame->resource,
+			tv_sec >> 32, tv_sec & 0xffffffff, presented % NSEC_PER_SEC);
+	}
+	state->frames++;
+	return 0;
+}
+
+static void frame_handle_buffer_destroy(struct wl_listener *listener, void *data) {
+	struct mock_frame *frame = wl_container_of(listener, frame, buffer_destroy);
+	wl_list_remove(&frame->buffer_destroy.link);
+	wl_list_init(&frame->buffer_destroy.link);
+	frame->buffer = NULL;
+}
+
+static void frame_set_buffer(struct mock_frame *frame, struct wl_resource *buffer) {
+	wl_list_remove(&frame->buffer_destroy.link);
+	wl_list_init(&frame->buffer_destroy.link);
+	frame->buffer = buffer;
+	if (buffer) {
+		frame->buffer_destroy.notify = frame_handle_buffer_destroy;
+		wl_resource_add_destroy_listener(buffer, &frame->buffer_destroy);
+	}
+}
+
+// Both protocols only accept XRGB8888 shm buffers of the size of the region
+static bool frame_buffer_valid(struct mock_frame *frame, struct wl_resource *buffer) {
+	struct wl_shm_buffer *shm = wl_shm_buffer_get(buffer);
+	return shm && wl_shm_buffer_get_format(shm) == WL_SHM_FORMAT_XRGB8888 &&
+		wl_shm_buffer_get_width(shm) == frame->region.width &&
+		wl_shm_buffer_get_height(shm) == frame->region.height &&
+		wl_shm_buffer_get_stride(shm) >= 4 * frame->region.width;
+}
+
+static void frame_schedule(struct mock_frame *frame) {
+	struct mock_state *state = frame->state;
+
+	// Complete the frame on the next refresh, after the copy latency
+	int64_t period = refresh_period_ns(state);
+	int64_t ready = state->start_ns + (refresh_seq(state, now_ns()) + 1) * period +
+		state->copy_latency_ns;
+
+	frame->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (frame->timer_fd < 0) {
+		wl_client_post_no_memory(wl_resource_get_client(frame->resource));
+		return;
+	}
+	struct itimerspec spec = {
+		.it_value = {
+			.tv_sec = ready / NSEC_PER_SEC,
+			.tv_nsec = ready % NSEC_PER_SEC,
+		},
+	};
+	timerfd_settime(frame->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	frame->timer_source = wl_event_loop_add_fd(state->loop, frame->timer_fd,
+		WL_EVENT_READABLE, frame_handle_timer, frame);
+}
+
+static void frame_copy(struct mock_frame *frame, struct wl_resource *buffer,
+		bool with_damage) {
+	if (frame->copied) {
+		wl_resource_post_error(frame->resource,
+			ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+			"frame already used");
+		return;
+	}
+	if (!frame_buffer_valid(frame, buffer)) {
+		wl_resource_post_error(frame->resource,
+			ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
+			"invalid buffer");
+		return;
+	}
+
+	frame->copied = true;
+	frame->with_damage = with_damage;
+	frame_set_buffer(frame, buffer);
+	frame_schedule(frame);
+}
+
+static void frame_handle_copy(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer) {
+	frame_copy(wl_resource_get_user_data(resource), buffer, false);
+}
+
+static void frame_handle_copy_with_damage(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer) {
+	frame_copy(wl_resource_get_user_data(resource), buffer, true);
+}
+
+static void frame_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_screencopy_frame_v1_interface frame_impl = {
+	.copy = frame_handle_copy,
+	.destroy = frame_handle_destroy,
+	.copy_with_damage = frame_handle_copy_with_damage,
+};
+
+static void frame_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_frame *frame = wl_resource_get_user_data(resource);
+	frame_stop_timer(frame);
+	wl_list_remove(&frame->buffer_destroy.link);
+	free(frame);
+}
+
+static void capture_output(struct wl_client *client,
+		struct wl_resource *manager_resource, uint32_t id,
+		struct mock_rect *region) {
+	struct mock_state *state = wl_resource_get_user_data(manager_resource);
+
+	struct mock_frame *frame = calloc(1, sizeof(*frame));
+	if (!frame) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	frame->state = state;
+	frame->region = *region;
+	frame->timer_fd = -1;
+	wl_list_init(&frame->buffer_destroy.link);
+
+	frame->resource = wl_resource_create(client, &zwlr_screencopy_frame_v1_interface,
+		wl_resource_get_version(manager_resource), id);
+	if (!frame->resource) {
+		free(frame);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(frame->resource, &frame_impl, frame,
+		frame_handle_resource_destroy);
+
+	zwlr_screencopy_frame_v1_send_buffer(frame->resource, WL_SHM_FORMAT_XRGB8888,
+		region->width, region->height, 4 * region->width);
+	if (wl_resource_get_version(frame->resource) >=
+			ZWLR_SCREENCOPY_FRAME_V1_BUFFER_DONE_SINCE_VERSION) {
+		zwlr_screencopy_frame_v1_send_buffer_done(frame->resource);
+	}
+}
+
+static void manager_handle_capture_output(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, int32_t overlay_cursor,
+		struct wl_resource *output) {
+	struct mock_state *state = wl_resource_get_user_data(resource);
+	struct mock_rect region = { 0, 0, state->width, state->height };
+	capture_output(client, resource, id, &region);
+}
+
+static void manager_handle_capture_output_region(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, int32_t overlay_cursor,
+		struct wl_resource *output, int32_t x, int32_t y,
+		int32_t width, int32_t height) {
+	struct mock_state *state = wl_resource_get_user_data(resource);
+	struct mock_rect all = { 0, 0, state->width, state->height };
+	struct mock_rect requested = { x, y, width, height };
+	struct mock_rect region;
+	if (!rect_intersect(&requested, &all, &region)) {
+		region = (struct mock_rect){ 0, 0, 1, 1 };
+	}
+	capture_output(client, resource, id, &region);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface manager_impl = {
+	.capture_output = manager_handle_capture_output,
+	.capture_output_region = manager_handle_capture_output_region,
+	.destroy = manager_handle_destroy,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwlr_screencopy_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, data, NULL);
+}
+
+static void dmabuf_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void dmabuf_handle_create_params(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	wl_resource_post_error(resource, 0, "the mock compositor has no dmabuf formats");
+}
+
+static const struct zwp_linux_dmabuf_v1_interface dmabuf_impl = {
+	.destroy = dmabuf_handle_destroy,
+	.create_params = dmabuf_handle_create_params,
+};
+
+static void dmabuf_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&zwp_linux_dmabuf_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &dmabuf_impl, data, NULL);
+}
+
+static void ext_frame_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static void ext_frame_handle_attach_buffer(struct wl_client *client,
+		struct wl_resource *resource, struct wl_resource *buffer) {
+	struct mock_frame *frame = wl_resource_get_user_data(resource);
+	if (frame->copied) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED,
+			"frame already captured");
+		return;
+	}
+	frame_set_buffer(frame, buffer);
+}
+
+// The whole buffer is painted on every frame, so the damage of the buffer
+// is only validated
+static void ext_frame_handle_damage_buffer(struct wl_client *client,
+		struct wl_resource *resource, int32_t x, int32_t y,
+		int32_t width, int32_t height) {
+	struct mock_frame *frame = wl_resource_get_user_data(resource);
+	if (frame->copied) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED,
+			"frame already captured");
+		return;
+	}
+	if (x < 0 || y < 0 || width <= 0 || height <= 0) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_INVALID_BUFFER_DAMAGE,
+			"invalid buffer damage");
+	}
+}
+
+static void ext_frame_handle_capture(struct wl_client *client,
+		struct wl_resource *resource) {
+	struct mock_frame *frame = wl_resource_get_user_data(resource);
+	if (frame->copied) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED,
+			"frame already captured");
+		return;
+	}
+	if (!frame->buffer) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_NO_BUFFER,
+			"no buffer attached");
+		return;
+	}
+	frame->copied = true;
+
+	if (!frame->session) {
+		ext_image_copy_capture_frame_v1_send_failed(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+		return;
+	}
+	if (!frame_buffer_valid(frame, frame->buffer)) {
+		frame->state->failed++;
+		ext_image_copy_capture_frame_v1_send_failed(resource,
+			EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+		return;
+	}
+
+	// Damage is always reported, the first frame of a session as a whole
+	frame->with_damage = true;
+	frame->full_damage = frame->session->frames++ == 0;
+	frame_schedule(frame);
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface ext_frame_impl = {
+	.destroy = ext_frame_handle_destroy,
+	.attach_buffer = ext_frame_handle_attach_buffer,
+	.damage_buffer = ext_frame_handle_damage_buffer,
+	.capture = ext_frame_handle_capture,
+};
+
+static void ext_frame_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_frame *frame = wl_resource_get_user_data(resource);
+	if (frame->session) {
+		frame->session->frame = NULL;
+	}
+	frame_handle_resource_destroy(resource);
+}
+
+static void ext_session_handle_create_frame(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id) {
+	struct mock_session *session = wl_resource_get_user_data(resource);
+	if (session->frame) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_SESSION_V1_ERROR_DUPLICATE_FRAME,
+			"session already has a frame");
+		return;
+	}
+
+	struct mock_frame *frame = calloc(1, sizeof(*frame));
+	if (!frame) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	frame->state = session->state;
+	frame->region = (struct mock_rect){ 0, 0, session->state->width, session->state->height };
+	frame->session = session;
+	frame->ext = true;
+	frame->timer_fd = -1;
+	wl_list_init(&frame->buffer_destroy.link);
+
+	frame->resource = wl_resource_create(client, &ext_image_copy_capture_frame_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (!frame->resource) {
+		free(frame);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(frame->resource, &ext_frame_impl, frame,
+		ext_frame_handle_resource_destroy);
+	session->frame = frame;
+}
+
+static void ext_session_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_image_copy_capture_session_v1_interface ext_session_impl = {
+	.create_frame = ext_session_handle_create_frame,
+	.destroy = ext_session_handle_destroy,
+};
+
+static void ext_session_handle_resource_destroy(struct wl_resource *resource) {
+	struct mock_session *session = wl_resource_get_user_data(resource);
+	if (session->frame) {
+		session->frame->session = NULL;
+	}
+	free(session);
+}
+
+static void ext_manager_handle_create_session(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, struct wl_resource *source,
+		uint32_t options) {
+	struct mock_state *state = wl_resource_get_user_data(resource);
+	if (options & ~EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS) {
+		wl_resource_post_error(resource,
+			EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_ERROR_INVALID_OPTION,
+			"invalid options");
+		return;
+	}
+
+	struct mock_session *session = calloc(1, sizeof(*session));
+	if (!session) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	session->state = state;
+	session->resource = wl_resource_create(client, &ext_image_copy_capture_session_v1_interface,
+		wl_resource_get_version(resource), id);
+	if (!session->resource) {
+		free(session);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(session->resource, &ext_session_impl, session,
+		ext_session_handle_resource_destroy);
+
+	ext_image_copy_capture_session_v1_send_buffer_size(session->resource,
+		state->width, state->height);
+	ext_image_copy_capture_session_v1_send_shm_format(session->resource,
+		WL_SHM_FORMAT_XRGB8888);
+	ext_image_copy_capture_session_v1_send_done(session->resource);
+}
+
+static void ext_manager_handle_create_pointer_cursor_session(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, struct wl_resource *source,
+		struct wl_resource *pointer) {
+	wl_resource_post_error(resource, 0, "the mock compositor has no cursor sessions");
+}
+
+static void ext_manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_image_copy_capture_manager_v1_interface ext_manager_impl = {
+	.create_session = ext_manager_handle_create_session,
+	.create_pointer_cursor_session = ext_manager_handle_create_pointer_cursor_session,
+	.destroy = ext_manager_handle_destroy,
+};
+
+static void ext_manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&ext_image_copy_capture_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &ext_manager_impl, data, NULL);
+}
+
+static void ext_source_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_image_capture_source_v1_interface ext_source_impl = {
+	.destroy = ext_source_handle_destroy,
+};
+
+// There is a single output, so sources carry no state
+static void ext_source_manager_handle_create_source(struct wl_client *client,
+		struct wl_resource *resource, uint32_t id, struct wl_resource *output) {
+	struct wl_resource *source = wl_resource_create(client,
+		&ext_image_capture_source_v1_interface, 1, id);
+	if (!source) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(source, &ext_source_impl, NULL, NULL);
+}
+
+static void ext_source_manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct ext_output_image_capture_source_manager_v1_interface ext_source_manager_impl = {
+	.create_source = ext_source_manager_handle_create_source,
+	.destroy = ext_source_manager_handle_destroy,
+};
+
+static void ext_source_manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct wl_resource *resource = wl_resource_create(client,
+		&ext_output_image_capture_source_manager_v1_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &ext_source_manager_impl, data, NULL);
+}
+
+static void output_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = output_handle_release,
+};
+
+static void output_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct mock_state *state = data;
+	struct wl_resource *resource = wl_resource_create(client,
+		&wl_output_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, state, NULL);
+
+	wl_output_send_geometry(resource, 0, 0, 0, 0, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+		"xdpw", "mock", WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+		state->width, state->height, state->refresh_mhz);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, 1);
+	}
+	if (version >= WL_OUTPUT_NAME_SINCE_VERSION) {
+		wl_output_send_name(resource, "MOCK-1");
+		wl_output_send_description(resource, "xdpw mock output");
+	}
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static int handle_signal(int signal_number, void *data) {
+	struct mock_state *state = data;
+	wl_display_terminate(state->display);
+	return 0;
+}
+
+static int usage(FILE *stream, int rc) {
+	fprintf(stream,
+		"Usage: xdpw-mock-compositor [options]\n"
+		"\n"
+		"    -s, --socket=<name>              Wayland socket name (default wayland-xdpw-bench).\n"
+		"    -g, --size=<width>x<height>      Size of the output (default 1920x1080).\n"
+		"    -r, --refresh=<hz>               Refresh rate of the output (default 60).\n"
+		"    -l, --latency=<ms>               Copy latency added to every frame (default 0).\n"
+		"    -p, --protocol=wlr|ext           Capture protocol to advertise (default wlr).\n"
+		"    -d, --damage=full|strip          Damage of every refresh (default full).\n"
+		"    -y, --y-invert                   Report frames as y-inverted.\n"
+		"    -h, --help                       Get help (this text).\n"
+		"\n"
+		"The number of frames served is printed on exit.\n");
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+	struct mock_state state = {
+		.width = 1920,
+		.height = 1080,
+		.refresh_mhz = 60000,
+		.protocol = PROTOCOL_WLR,
+		.damage = DAMAGE_FULL,
+	};
+	const char *socket = "wayland-xdpw-bench";
+
+	static const struct option longopts[] = {
+		{ "socket", required_argument, NULL, 's' },
+		{ "size", required_argument, NULL, 'g' },
+		{ "refresh", required_argument, NULL, 'r' },
+		{ "latency", required_argument, NULL, 'l' },
+		{ "protocol", required_argument, NULL, 'p' },
+		{ "damage", required_argument, NULL, 'd' },
+		{ "y-invert", no_argument, NULL, 'y' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, "s:g:r:l:p:d:yh", longopts, NULL);
+		if (c < 0) {
+			break;
+		}
+
+		switch (c) {
+		case 's':
+			socket = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%"SCNd32"x%"SCNd32, &state.width, &state.height) != 2 ||
+					state.width <= 0 || state.height <= 0) {
+				fprintf(stderr, "invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			state.refresh_mhz = (int32_t)(strtod(optarg, NULL) * 1000);
+			if (state.refresh_mhz <= 0) {
+				fprintf(stderr, "invalid refresh rate: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			state.copy_latency_ns = (int64_t)(strtod(optarg, NULL) * 1000000);
+			break;
+		case 'p':
+			if (strcmp(optarg, "wlr") == 0) {
+				state.protocol = PROTOCOL_WLR;
+			} else if (strcmp(optarg, "ext") == 0) {
+				state.protocol = PROTOCOL_EXT;
+			} else {
+				fprintf(stderr, "invalid protocol: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'd':
+			if (strcmp(optarg, "full") == 0) {
+				state.damage = DAMAGE_FULL;
+			} else if (strcmp(optarg, "strip") == 0) {
+				state.damage = DAMAGE_STRIP;
+			} else {
+				fprintf(stderr, "invalid damage pattern: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'y':
+			state.y_invert = true;
+			break;
+		case 'h':
+			return usage(stdout, EXIT_SUCCESS);
+		default:
+			return usage(stderr, EXIT_FAILURE);
+		}
+	}
+
+	state.display = wl_display_create();
+	if (!state.display) {
+		fprintf(stderr, "failed to create the display\n");
+		return EXIT_FAILURE;
+	}
+	state.loop = wl_display_get_event_loop(state.display);
+	state.start_ns = now_ns();
+
+	bool globals = false;
+	switch (state.protocol) {
+	case PROTOCOL_WLR:
+		globals = wl_global_create(state.display, &zwlr_screencopy_manager_v1_interface, 3,
+				&state, manager_bind) &&
+			wl_global_create(state.display, &zwp_linux_dmabuf_v1_interface, 3,
+				&state, dmabuf_bind);
+		break;
+	case PROTOCOL_EXT:
+		globals = wl_global_create(state.display,
+				&ext_output_image_capture_source_manager_v1_interface, 1,
+				&state, ext_source_manager_bind) &&
+			wl_global_create(state.display, &ext_image_copy_capture_manager_v1_interface, 1,
+				&state, ext_manager_bind);
+		break;
+	}
+	if (wl_display_init_shm(state.display) != 0 ||
+			!wl_global_create(state.display, &wl_output_interface, 4, &state, output_bind) ||
+			!globals) {
+		fprintf(stderr, "failed to create the globals\n");
+		return EXIT_FAILURE;
+	}
+
+	if (wl_display_add_socket(state.display, socket) != 0) {
+		fprintf(stderr, "failed to add socket %s: %s\n", socket, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	struct wl_event_source *sigint = wl_event_loop_add_signal(state.loop, SIGINT,
+		handle_signal, &state);
+	struct wl_event_source *sigterm = wl_event_loop_add_signal(state.loop, SIGTERM,
+		handle_signal, &state);
+
+	wl_display_run(state.display);
+
+	printf("frames %"PRIu64", failed %"PRIu64"\n", state.frames, state.failed);
+	fflush(stdout);
+
+	wl_event_source_remove(sigint);
+	wl_event_source_remove(sigterm);
+	wl_display_destroy_clients(state.display);
+	wl_display_destroy(state.display);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/*
+ * Consumes a screencast stream and reports how old frames are when they
+ * arrive, compared to the presentation timestamp xdpw puts into the
+ * header meta of each buffer.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pipewire/pipewire.h>
+#include <spa/buffer/meta.h>
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+#include <spa/utils/result.h>
+
+#define MAX_SAMPLES 65536
+
+struct probe_stats {
+	int64_t latency_ns[MAX_SAMPLES];
+	uint32_t samples;
+	uint64_t frames;
+	uint64_t corrupt;
+	uint64_t missing_header;
+	uint64_t seq_gaps;
+	uint64_t seq_lost;
+	uint64_t last_seq;
+	bool have_seq;
+};
+
+struct probe {
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_core *core;
+	struct pw_stream *stream;
+	struct spa_hook stream_listener;
+	struct spa_source *report_timer;
+
+	uint32_t node_id;
+	bool connected;
+	struct probe_stats stats;
+};
+
+static int64_t now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * SPA_NSEC_PER_SEC + now.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b) {
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(const int64_t *sorted, uint32_t n, double p) {
+	uint32_t i = (uint32_t)(p * (n - 1) + 0.5);
+	return sorted[i] / 1e6;
+}
+
+static void report(struct probe_stats *stats) {
+	if (stats->frames == 0) {
+		printf("no frames received\n");
+		return;
+	}
+
+	printf("frames %"PRIu64", corrupt %"PRIu64" (%.2f%%), sequence gaps %"PRIu64
+		" (%"PRIu64" frames lost)",
+		stats->frames, stats->corrupt, 100.0 * stats->corrupt / stats->frames,
+		stats->seq_gaps, stats->seq_lost);
+	if (stats->missing_header > 0) {
+		printf(", %"PRIu64" without header meta", stats->missing_header);
+	}
+	printf("\n");
+
+	if (stats->samples > 0) {
+		int64_t *sorted = malloc(stats->samples * sizeof(*sorted));
+		if (!sorted) {
+			return;
+		}
+		memcpy(sorted, stats->latency_ns, stats->samples * sizeof(*sorted));
+		qsort(sorted, stats->samples, sizeof(*sorted), compare_int64);
+		printf("latency ms: min %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f (%u samples)\n",
+			sorted[0] / 1e6,
+			percentile_ms(sorted, stats->samples, 0.50),
+			percentile_ms(sorted, stats->samples, 0.90),
+			percentile_ms(sorted, stats->samples, 0.99),
+			sorted[stats->samples - 1] / 1e6,
+			stats->samples);
+		free(sorted);
+	}
+	fflush(stdout);
+
+	memset(stats, 0, offsetof(struct probe_stats, last_seq));
+}
+
+static void on_process(void *data) {
+	struct probe *probe = data;
+	struct probe_stats *stats = &probe->stats;
+
+	struct pw_buffer *b = pw_stream_dequeue_buffer(probe->stream);
+	if (!b) {
+		return;
+	}
+	int64_t received = now_ns();
+	struct spa_buffer *buf = b->buffer;
+
+	stats->frames++;
+	bool corrupt = buf->n_datas > 0 &&
+		(buf->datas[0].chunk->flags & SPA_CHUNK_FLAG_CORRUPTED);
+
+	struct spa_meta_header *h = spa_buffer_find_meta_data(buf, SPA_META_Header, sizeof(*h));
+	if (!h) {
+		stats->missing_header++;
+	} else {
+		corrupt |= (h->flags & SPA_META_HEADER_FLAG_CORRUPTED) != 0;
+
+		if (stats->have_seq && h->seq > stats->last_seq + 1) {
+			stats->seq_gaps++;
+			stats->seq_lost += h->seq - stats->last_seq - 1;
+		}
+		stats->last_seq = h->seq;
+		stats->have_seq = true;
+
+		if (!corrupt && h->pts > 0 && stats->samples < MAX_SAMPLES) {
+			stats->latency_ns[stats->samples++] = received - h->pts;
+		}
+	}
+	if (corrupt) {
+		stats->corrupt++;
+	}
+
+	pw_stream_queue_buffer(probe->stream, b);
+}
+
+static void on_param_changed(void *data, uint32_t id, const struct spa_pod *param) {
+	struct probe *probe = data;
+	if (!param || id != SPA_PARAM_Format) {
+		return;
+	}
+
+	struct spa_video_info_raw info;
+	if (spa_format_video_raw_parse(param, &info) < 0) {
+		return;
+	}
+	fprintf(stderr, "negotiated format %u, %ux%u\n",
+		info.format, info.size.width, info.size.height);
+
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[2];
+	params[0] = spa_pod_builder_add_object(&b,
+		SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+		SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(
+			(1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr) | (1 << SPA_DATA_DmaBuf)));
+	params[1] = spa_pod_builder_add_object(&b,
+		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+		SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
+		SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
+	pw_stream_update_params(probe->stream, params, 2);
+}
+
+static void on_state_changed(void *data, enum pw_stream_state old,
+		enum pw_stream_state state, const char *error) {
+	struct probe *probe = data;
+	fprintf(stderr, "stream state: %s%s%s\n", pw_stream_state_as_string(state),
+		error ? ": " : "", error ? error : "");
+
+	switch (state) {
+	case PW_STREAM_STATE_STREAMING:
+		probe->connected = true;
+		break;
+	case PW_STREAM_STATE_ERROR:
+	case PW_STREAM_STATE_UNCONNECTED:
+		if (probe->connected || state == PW_STREAM_STATE_ERROR) {
+			pw_main_loop_quit(probe->loop);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_stream_events stream_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = on_state_changed,
+	.param_changed = on_param_changed,
+	.process = on_process,
+};
+
+static void on_report_timer(void *data, uint64_t expirations) {
+	struct probe *probe = data;
+	report(&probe->stats);
+}
+
+static void on_quit(void *data, int signal_number) {
+	struct probe *probe = data;
+	pw_main_loop_quit(probe->loop);
+}
+
+static int usage(FILE *stream, int rc) {
+	fprintf(stream,
+		"Usage: xdpw-latency-probe [options] <node id>\n"
+		"\n"
+		"    -i, --interval=<seconds>         Report interval (default 5, 0 reports on exit only).\n"
+		"    -h, --help                       Get help (this text).\n"
+		"\n"
+		"Latency is measured from the presentation timestamp of a frame to the\n"
+		"time it is received, both on CLOCK_MONOTONIC.\n");
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+	static struct probe probe = {0};
+	long interval = 5;
+
+	static const struct option longopts[] = {
+		{ "interval", required_argument, NULL, 'i' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while (1) {
+		int c = getopt_long(argc, argv, "i:h", longopts, NULL);
+		if (c < 0) {
+			break;
+		}
+
+		switch (c) {
+		case 'i':
+			interval = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+			return usage(stdout, EXIT_SUCCESS);
+		default:
+			return usage(stderr, EXIT_FAILURE);
+		}
+	}
+	if (optind + 1 != argc) {
+		return usage(stderr, EXIT_FAILURE);
+	}
+	char *end;
+	errno = 0;
+	unsigned long node_id = strtoul(argv[optind], &end, 10);
+	if (errno != 0 || *end != '\0' || node_id >= SPA_ID_INVALID) {
+		fprintf(stderr, "invalid node id: %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	probe.node_id = node_id;
+
+	pw_init(&argc, &argv);
+
+	probe.loop = pw_main_loop_new(NULL);
+	struct pw_loop *loop = pw_main_loop_get_loop(probe.loop);
+	pw_loop_add_signal(loop, SIGINT, on_quit, &probe);
+	pw_loop_add_signal(loop, SIGTERM, on_quit, &probe);
+
+	probe.context = pw_context_new(loop, NULL, 0);
+	probe.core = pw_context_connect(probe.context, NULL, 0);
+	if (!probe.core) {
+		fprintf(stderr, "failed to connect to pipewire: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	probe.stream = pw_stream_new(probe.core, "xdpw-latency-probe",
+		pw_properties_new(
+			PW_KEY_MEDIA_TYPE, "Video",
+			PW_KEY_MEDIA_CATEGORY, "Capture",
+			PW_KEY_MEDIA_ROLE, "Screen",
+			NULL));
+	pw_stream_add_listener(probe.stream, &probe.stream_listener, &stream_events, &probe);
+
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+	params[0] = spa_pod_builder_add_object(&b,
+		SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+		SPA_FORMAT_mediaType, SPA_POD_Id(SPA_MEDIA_TYPE_video),
+		SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+		SPA_FORMAT_VIDEO_format, SPA_POD_CHOICE_ENUM_Id(7,
+			SPA_VIDEO_FORMAT_BGRx,
+			SPA_VIDEO_FORMAT_BGRx, SPA_VIDEO_FORMAT_BGRA,
+			SPA_VIDEO_FORMAT_RGBx, SPA_VIDEO_FORMAT_RGBA,
+			SPA_VIDEO_FORMAT_xBGR, SPA_VIDEO_FORMAT_xRGB),
+		SPA_FORMAT_VIDEO_size, SPA_POD_CHOICE_RANGE_Rectangle(
+			&SPA_RECTANGLE(1920, 1080),
+			&SPA_RECTANGLE(1, 1),
+			&SPA_RECTANGLE(16384, 16384)),
+		SPA_FORMAT_VIDEO_framerate, SPA_POD_CHOICE_RANGE_Fraction(
+			&SPA_FRACTION(0, 1),
+			&SPA_FRACTION(0, 1),
+			&SPA_FRACTION(1000, 1)));
+
+	int ret = pw_stream_connect(probe.stream, PW_DIRECTION_INPUT, probe.node_id,
+		PW_STREAM_FLAG_AUTOCONNECT, params, 1);
+	if (ret < 0) {
+		fprintf(stderr, "failed to connect to node %u: %s\n", probe.node_id, spa_strerror(ret));
+		return EXIT_FAILURE;
+	}
+
+	if (interval > 0) {
+		probe.report_timer = pw_loop_add_timer(loop, on_report_timer, &probe);
+		struct timespec value = { .tv_sec = interval };
+		pw_loop_update_timer(loop, probe.report_timer, &value, &value, false);
+	}
+
+	pw_main_loop_run(probe.loop);
+
+	report(&probe.stats);
+
+	pw_stream_destroy(probe.stream);
+	pw_core_disconnect(probe.core);
+	pw_context_destroy(probe.context);
+	pw_main_loop_destroy(probe.loop);
+	pw_deinit();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+#ifndef CAPTURE_SCHEDULER_H
+#define CAPTURE_SCHEDULER_H
+
+#include <stdint.h>
+
+#include "screencast_common.h"
+
+// Schedules the captures of every instance sharing an output: captures are
+// spread over the refresh interval of the output and the copy bandwidth of
+// the output, if limited, is shared max-min fairly between the instances.
+
+// Returns the delay before the next capture of the instance may start, at
+// least min_delay_ns, and reserves the slot for it
+uint64_t xdpw_capture_scheduler_delay(struct xdpw_screencast_instance *cast,
+	uint64_t min_delay_ns);
+// Called once the instance doesn't capture its output anymore
+void xdpw_capture_scheduler_leave(struct xdpw_screencast_instance *cast);
+// Called before the output is destroyed
+void xdpw_capture_scheduler_output_removed(struct xdpw_wlr_output *output);
+
+#endif /* CAPTURE_SCHEDULER_H */
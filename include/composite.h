@@ -0,0 +1,79 @@
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+#include "screencast_common.h"
+
+// An output of a composite, captured by an instance of its own which
+// has no stream and isn't part of the instance list
+struct xdpw_composite_output {
+	struct wl_list link; // xdpw_composite::outputs
+	struct xdpw_composite *composite;
+	struct xdpw_screencast_instance *cast;
+
+	// the compositor copies into this buffer, it keeps the last frame
+	struct xdpw_buffer *buffer;
+	// position and logical size of the output in the composed frame
+	struct xdpw_pixel_rect rect;
+
+	// frames are converted into the composite format
+	bool converting;
+	struct xdpw_pixel_convert convert;
+	// frames are scaled to the logical size of the output
+	bool scaling;
+	struct xdpw_pixel_scale scale;
+	// frames are rotated or flipped into the layout, the transform of
+	// the output they were set up for
+	uint32_t transform;
+	// scaled frames, only if they're converted or transformed too
+	uint8_t *scaled;
+
+	// the output can be composed
+	bool supported;
+	// a frame is being captured
+	bool capturing;
+	// the buffer holds a complete frame
+	bool has_frame;
+	// the whole frame is drawn next time, not only its damage
+	bool draw_full;
+	// the buffer or the scaling have to be set up again
+	bool dirty;
+	// the output disappeared while its capture session was set up
+	bool removed;
+};
+
+// Composes every output into one frame at their logical positions
+struct xdpw_composite {
+	struct xdpw_screencast_instance *cast;
+	struct wl_list outputs; // xdpw_composite_output::link
+
+	// logical position and size of the composed frame
+	int32_t x, y;
+	uint32_t width, height;
+
+	// the staging buffer has to be drawn from scratch
+	bool redraw;
+	// the composed frame changed since it was queued last
+	bool damaged;
+	// a frame was requested by the stream
+	bool waiting;
+
+	struct xdpw_timer *update_timer;
+};
+
+int xdpw_composite_session_init(struct xdpw_screencast_instance *cast);
+void xdpw_composite_session_close(struct xdpw_screencast_instance *cast);
+void xdpw_composite_destroy(struct xdpw_screencast_instance *cast);
+void xdpw_composite_frame_capture(struct xdpw_screencast_instance *cast);
+uint64_t xdpw_composite_release_memory(struct xdpw_screencast_instance *cast);
+
+// Called for the instances capturing the outputs of a composite
+void xdpw_composite_output_frame_done(struct xdpw_screencast_instance *cast);
+void xdpw_composite_output_constraints_changed(struct xdpw_screencast_instance *cast);
+void xdpw_composite_output_failed(struct xdpw_screencast_instance *cast);
+
+// Output hotplug
+void xdpw_composite_outputs_changed(struct xdpw_screencast_context *ctx);
+void xdpw_composite_output_removed(struct xdpw_screencast_context *ctx,
+	struct xdpw_wlr_output *output);
+
+#endif /* COMPOSITE_H */
@@ -12,6 +12,20 @@ struct config_screencast {
 	char *chooser_cmd;
 	enum xdpw_chooser_types chooser_type;
 	bool force_mod_linear;
+	bool shm_conversion;
+	bool shm_yuv_conversion;
+	enum xdpw_yuv_matrix yuv_matrix;
+	enum xdpw_yuv_range yuv_range;
+	bool shm_scaling;
+	bool shm_damage_detection;
+	int capture_retries;
+	int max_capture_bandwidth;
+	int max_buffer_memory;
+	bool adaptive_buffers;
+	int output_reconnect_timeout;
+	int paused_release_timeout;
+	int idle_timeout;
+	int exec_timeout;
 };
 
 struct xdpw_config {
@@ -0,0 +1,22 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <wayland-util.h>
+
+struct xdpw_state;
+
+struct xdpw_child {
+	struct wl_list link; // xdpw_state::children
+	struct xdpw_state *state;
+	pid_t pid;
+	char *command;
+	struct xdpw_timer *timeout_timer;
+};
+
+int xdpw_exec_shell(struct xdpw_state *state, const char *command);
+void xdpw_exec_reap(struct xdpw_state *state);
+void xdpw_exec_finish(struct xdpw_state *state);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef FRAME_DIFF_H
+#define FRAME_DIFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pixel_scale.h"
+
+#define XDPW_FRAME_DIFF_TILE_SIZE 64
+
+// Finds the regions of shm frames which changed since the previous frame
+// by comparing hashes of tiles, without keeping a copy of the frame
+struct xdpw_frame_diff {
+	uint32_t width, height;
+	uint32_t bpp;
+	uint32_t tiles_x, tiles_y;
+	// hashes of the tiles of the previous frame
+	uint64_t *hashes;
+	// state of every tile during and after the last update
+	uint8_t *tiles;
+	// the hashes describe the previous frame
+	bool valid;
+};
+
+// Releases the hashes, the next update reports the whole frame as changed
+void xdpw_frame_diff_finish(struct xdpw_frame_diff *diff);
+// The next update reports the whole frame as changed
+void xdpw_frame_diff_reset(struct xdpw_frame_diff *diff);
+// Compares the tiles of a frame which intersect the given rectangles with
+// the previous frame, the other tiles are known to be unchanged. All tiles
+// are compared if rect_count is 0. Returns false if the frame can't be
+// compared.
+bool xdpw_frame_diff_update(struct xdpw_frame_diff *diff, const uint8_t *data,
+	uint32_t width, uint32_t height, uint32_t stride, uint32_t bpp,
+	const struct xdpw_pixel_rect *rects, uint32_t rect_count);
+// Merges the tiles which changed in the last update into rectangles.
+// Returns the number of rectangles, the last one covers the remaining
+// tiles if there are more than max_rects.
+uint32_t xdpw_frame_diff_damage(const struct xdpw_frame_diff *diff,
+	struct xdpw_pixel_rect *rects, uint32_t max_rects);
+
+#endif /* FRAME_DIFF_H */
@@ -0,0 +1,21 @@
+#ifndef HASH_TABLE_H
+#define HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A string keyed hash table. Keys aren't copied, they have to stay valid
+// as long as the entry exists (usually they're owned by the value).
+struct xdpw_hash_table {
+	struct xdpw_hash_entry **buckets;
+	size_t bucket_count;
+	size_t count;
+};
+
+void xdpw_hash_table_init(struct xdpw_hash_table *table);
+void xdpw_hash_table_finish(struct xdpw_hash_table *table);
+bool xdpw_hash_table_insert(struct xdpw_hash_table *table, const char *key, void *value);
+void *xdpw_hash_table_lookup(struct xdpw_hash_table *table, const char *key);
+void *xdpw_hash_table_remove(struct xdpw_hash_table *table, const char *key);
+
+#endif
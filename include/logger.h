@@ -7,13 +7,30 @@
 
 enum LOGLEVEL { QUIET, ERROR, WARN, INFO, DEBUG, TRACE };
 
+#ifdef XDPW_DISABLE_TRACE_LOG
+#define LOGGER_MAX_LEVEL DEBUG
+#else
+#define LOGGER_MAX_LEVEL TRACE
+#endif
+
 struct logger_properties {
 	enum LOGLEVEL level;
 	FILE *dst;
 };
 
+extern struct logger_properties logprops;
+
 void init_logger(FILE *dst, enum LOGLEVEL level);
 enum LOGLEVEL get_loglevel(const char *level);
-void logprint(enum LOGLEVEL level, char *msg, ...);
+void logger_flush(void);
+void logger_print(enum LOGLEVEL level, char *msg, ...);
+
+// Check the level before evaluating the arguments; messages above
+// LOGGER_MAX_LEVEL are compiled out
+#define logprint(lvl, ...) do { \
+		if ((lvl) <= LOGGER_MAX_LEVEL && (lvl) <= logprops.level) { \
+			logger_print(lvl, __VA_ARGS__); \
+		} \
+	} while (0)
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define XDPW_PIXEL_CONVERT_MAX_PLANES 3
+
+enum xdpw_yuv_matrix {
+	XDPW_YUV_MATRIX_BT601,
+	XDPW_YUV_MATRIX_BT709,
+};
+
+enum xdpw_yuv_range {
+	XDPW_YUV_RANGE_LIMITED,
+	XDPW_YUV_RANGE_FULL,
+};
+
+struct xdpw_pixel_convert;
+
+typedef void (*xdpw_pixel_convert_row_func)(const struct xdpw_pixel_convert *conv,
+	uint8_t *dst, const uint8_t *src, uint32_t width);
+// Converts two rows into luma and one row of subsampled chroma. y1 is
+// NULL for the last row of a frame with an odd height, v is NULL if
+// chroma is interleaved.
+typedef void (*xdpw_pixel_convert_yuv_func)(const struct xdpw_pixel_convert *conv,
+	uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+	const uint8_t *src0, const uint8_t *src1, uint32_t width);
+
+// Converts shm frames from a format offered by the compositor into an
+// opaque 8 bit per channel RGB or a 4:2:0 YUV format requested by the
+// consumer
+struct xdpw_pixel_convert {
+	uint32_t dst_format;
+	uint32_t src_format;
+	// bytes per pixel of the first destination plane
+	uint32_t dst_bpp;
+	uint32_t src_bpp;
+	uint32_t dst_planes;
+	bool yuv;
+	xdpw_pixel_convert_row_func convert_row;
+	xdpw_pixel_convert_yuv_func convert_yuv;
+
+	// source byte of every destination byte for 4 pixels, 0x80 clears it
+	uint8_t shuffle[16];
+	// right shifts which move the 8 most significant bits of red, green
+	// and blue to the lowest byte
+	uint32_t src_shift[3];
+	// bit offsets of red, green and blue in the destination
+	uint32_t dst_shift[3];
+	// or'ed into every destination pixel to make it opaque
+	uint32_t fill;
+
+	// fixed point RGB to YUV coefficients, luma is scaled by 1 << 14 and
+	// chroma of 4 summed pixels by 1 << 16, offsets include rounding
+	int16_t y_coef[3];
+	int16_t u_coef[3];
+	int16_t v_coef[3];
+	int32_t y_offset;
+	int32_t uv_offset;
+};
+
+bool xdpw_pixel_convert_init(struct xdpw_pixel_convert *conv,
+	uint32_t dst_format, uint32_t src_format,
+	enum xdpw_yuv_matrix matrix, enum xdpw_yuv_range range);
+uint32_t xdpw_pixel_convert_layout(const struct xdpw_pixel_convert *conv,
+	uint32_t width, uint32_t height, uint32_t stride[], uint32_t offset[], uint32_t size[]);
+void xdpw_pixel_convert_rect(const struct xdpw_pixel_convert *conv,
+	uint8_t *const dst[], const uint32_t dst_stride[],
+	const uint8_t *src, uint32_t src_stride,
+	uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+	uint32_t frame_width, uint32_t frame_height, bool flip_y);
+
+bool xdpw_pixel_convert_is_yuv(uint32_t format);
+const uint32_t *xdpw_pixel_convert_targets(size_t *count);
+const uint32_t *xdpw_pixel_convert_yuv_targets(size_t *count);
+const char *xdpw_pixel_convert_isa(void);
+
+#endif /* PIXEL_CONVERT_H */
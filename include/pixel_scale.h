@@ -0,0 +1,37 @@
+#ifndef PIXEL_SCALE_H
+#define PIXEL_SCALE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct xdpw_pixel_rect {
+	uint32_t x, y;
+	uint32_t width, height;
+};
+
+// Downscales shm frames with 4 bytes per pixel and 8 bits per channel.
+// The channel order doesn't matter, every byte is filtered on its own.
+struct xdpw_pixel_scale {
+	uint32_t src_width, src_height;
+	uint32_t dst_width, dst_height;
+	// box filter when shrinking by 2 or more, bilinear otherwise
+	bool box;
+	// source pixels averaged by the box filter
+	uint32_t box_width, box_height;
+	// 1 << 16 divided by the number of pixels in a box
+	uint32_t box_scale;
+};
+
+bool xdpw_pixel_scale_supported(uint32_t format);
+bool xdpw_pixel_scale_init(struct xdpw_pixel_scale *scale,
+	uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height);
+// Returns the destination pixels which depend on a source rectangle
+void xdpw_pixel_scale_map_rect(const struct xdpw_pixel_scale *scale,
+	const struct xdpw_pixel_rect *src, struct xdpw_pixel_rect *dst);
+// Scales a destination rectangle. The rows are stored upside down if
+// flip_y is set.
+void xdpw_pixel_scale_rect(const struct xdpw_pixel_scale *scale,
+	uint8_t *dst, uint32_t dst_stride, const uint8_t *src, uint32_t src_stride,
+	const struct xdpw_pixel_rect *rect, bool flip_y);
+
+#endif /* PIXEL_SCALE_H */
@@ -5,5 +5,7 @@
 
 void xdpw_screencast_instance_destroy(struct xdpw_screencast_instance *cast);
 void xdpw_screencast_instance_teardown(struct xdpw_screencast_instance *cast);
+void xdpw_screencast_instance_streams_changed(struct xdpw_screencast_instance *cast);
+void xdpw_screencast_source_destroy(struct xdpw_screencast_source *source);
 
 #endif
@@ -8,6 +8,10 @@
 #include <xf86drm.h>
 
 #include "fps_limit.h"
+#include "frame_diff.h"
+#include "hash_table.h"
+#include "pixel_convert.h"
+#include "pixel_scale.h"
 
 // this seems to be right based on
 // https://github.com/flatpak/xdg-desktop-portal/blob/309a1fc0cf2fb32cceb91dbc666d20cf0a3202c2/src/screen-cast.c#L955
@@ -23,6 +27,7 @@ enum cursor_modes {
 enum source_types {
   MONITOR = 1,
   WINDOW = 2,
+  VIRTUAL = 4,
 };
 
 enum persist_modes {
@@ -84,6 +89,18 @@ struct xdpw_buffer {
 	struct wl_array damage;
 
 	struct wl_buffer *buffer;
+
+	// only for WL_SHM, mapping of fd[0]
+	void *data;
+
+	// only for WL_SHM, the compositor copies into the staging buffer of
+	// the instance and frames are converted or scaled into this buffer
+	bool converted;
+	// regions which changed since the last conversion into this buffer
+	struct wl_array convert_damage;
+	bool convert_full;
+
+	struct timespec queued_time;
 };
 
 
@@ -94,21 +111,34 @@ struct xdpw_dmabuf_feedback_data {
 };
 
 
+struct xdpw_toplevel_app {
+	char *app_id;
+	struct wl_list toplevels; // xdpw_toplevel::app_link
+};
+
 struct xdpw_toplevel {
 	struct wl_list link;
 	struct ext_foreign_toplevel_handle_v1 *handle;
 	char *app_id;
 	char *title;
 	char *identifier;
+
+	struct xdpw_screencast_context *ctx;
+	struct xdpw_toplevel_app *app;
+	struct wl_list app_link;
 };
 
 struct xdpw_screencast_context {
 	// xdpw
 	struct xdpw_state *state;
+	// pipewire and gbm are set up on the first session
+	bool backends_ready;
 
 	// pipewire
 	struct pw_context *pwr_context;
 	struct pw_core *core;
+	struct xdpw_timer *pwr_reconnect_timer;
+	uint32_t pwr_reconnect_attempts;
 
 	// wlroots
 	struct wl_list output_list;
@@ -130,17 +160,28 @@ struct xdpw_screencast_context {
 
 	// sessions
 	struct wl_list screencast_instances;
+	// memory of the buffers of every instance
+	uint64_t allocated_bytes;
 
 	// toplevels
 	struct wl_list toplevels;
+	struct xdpw_hash_table toplevels_by_identifier;
+	struct xdpw_hash_table toplevel_apps; // xdpw_toplevel_app by app_id
 };
 
+struct xdpw_session;
+struct xdpw_composite;
+struct xdpw_composite_output;
+
 struct xdpw_screencast_target {
+	// VIRTUAL composes every output
 	enum source_types type;
 	bool with_cursor;
 
 	// only for MONITOR
 	struct xdpw_wlr_output *output;
+	// part of the output in logical coordinates, the whole output if empty
+	struct xdpw_pixel_rect region;
 
 	// only for WINDOW
 	struct xdpw_toplevel *toplevel;
@@ -149,6 +190,16 @@ struct xdpw_screencast_target {
 struct xdpw_screencast_restore_data {
 	uint32_t version;
 	const char *output_name;
+	const char *window_identifier;
+	const char *app_id;
+	const char *title;
+	bool all_outputs;
+	// only with output_name
+	bool has_region;
+	struct xdpw_pixel_rect region;
+	// sessions with several sources describe each of them in the
+	// fields above
+	struct wl_array sources; // struct xdpw_screencast_restore_data
 };
 
 struct xdpw_format_modifier_pair {
@@ -178,12 +229,36 @@ struct xdpw_screencast_wlr_session {
 	struct zwlr_screencopy_frame_v1 *wlr_frame;
 };
 
+struct xdpw_screencast_metrics {
+	struct timespec capture_start;
+	// moving averages
+	uint64_t capture_latency_ns; // capture request to ready
+	uint64_t buffer_cycle_ns; // buffer queued to buffer dequeued again
+	double damage_ratio; // damaged area of a frame
+	// counters
+	uint64_t frames_delivered;
+	uint64_t frames_corrupt;
+	uint64_t frames_dropped;
+	uint64_t frames_skipped;
+	uint64_t dequeue_failures;
+	uint64_t capture_failures;
+	uint64_t renegotiations;
+	uint64_t allocated_bytes;
+	uint64_t shm_bytes;
+	uint64_t dmabuf_bytes;
+	uint64_t released_bytes;
+	// granted by the capture scheduler
+	double capture_rate;
+	double capture_share;
+};
+
 struct xdpw_screencast_instance {
 	// list
 	struct wl_list link;
 
 	// xdpw
 	uint32_t refcount;
+	struct wl_list sources; // xdpw_screencast_source::instance_link
 	struct xdpw_screencast_context *ctx;
 	bool initialized;
 	struct xdpw_frame current_frame;
@@ -198,6 +273,25 @@ struct xdpw_screencast_instance {
 	uint32_t node_id;
 	bool pwr_stream_state;
 	uint32_t framerate;
+	// most buffers offered in the last negotiation
+	uint32_t max_buffers;
+	// buffers asked for in the next negotiation, XDPW_PWR_BUFFERS until
+	// adapted to the consumer
+	uint32_t ring_depth;
+	// dequeue failures and longest time a buffer was away during the
+	// current adaptation period
+	struct timespec ring_period_start;
+	uint64_t ring_period_failures;
+	int64_t ring_max_hold_ns;
+	// periods without dequeue failures, the ring shrinks after
+	// ring_shrink_periods of them
+	uint32_t ring_quiet_periods;
+	uint32_t ring_shrink_periods;
+	bool ring_shrunk;
+	// the stream is renegotiated from the event loop, once no frame is
+	// captured into a dequeued buffer
+	bool ring_update_pending;
+	struct xdpw_timer *ring_timer;
 
 	// wlroots
 	union {
@@ -214,16 +308,71 @@ struct xdpw_screencast_instance {
 
 	// fps limit
 	struct fps_limit_state fps_limit;
+	struct xdpw_timer *capture_timer;
+
+	// capture recovery
+	uint32_t capture_failures;
+
+	// capture scheduling, only linked while capturing an output
+	struct wl_list capture_link; // xdpw_wlr_output::capture_streams
+	struct xdpw_wlr_output *capture_output;
+	// earliest start of the next capture if the granted rate is lower
+	// than the negotiated one
+	uint64_t capture_next_ns;
+
+	// output hotplug, only set while the output is gone
+	char *detached_output_name;
+	struct xdpw_timer *detach_timer;
+
+	// memory release while paused
+	struct xdpw_timer *release_timer;
+
+	// shm format conversion, only set if the negotiated format isn't
+	// offered by the compositor
+	bool converting;
+	struct xdpw_pixel_convert convert;
+	// shm downscaling, only set if the negotiated size is smaller than
+	// the output
+	bool scaling;
+	struct xdpw_pixel_scale scale;
+	// frames are captured in this format if converting or scaling
+	uint32_t staging_format;
+	struct xdpw_buffer *staging_buffer;
+	// scaled frames in the staging format, only if they're converted too
+	struct xdpw_buffer *scaled_buffer;
+
+	// damage detection on shm frames, the hashes describe the last
+	// frame which was queued
+	struct xdpw_frame_diff frame_diff;
+
+	// only for VIRTUAL, every output is captured by an instance of its
+	// own and composed into the staging buffer
+	struct xdpw_composite *composite;
+	// only set for the instances which capture an output of a composite
+	struct xdpw_composite_output *composite_output;
+
+	struct xdpw_screencast_metrics metrics;
+};
+
+// A source selected for a session, every source has a stream of its own
+struct xdpw_screencast_source {
+	struct wl_list link; // xdpw_screencast_session_data::sources
+	struct wl_list instance_link; // xdpw_screencast_instance::sources
+	struct xdpw_session *sess;
+	struct xdpw_screencast_instance *cast;
 };
 
 struct xdpw_screencast_session_data {
-	struct xdpw_screencast_instance *screencast_instance;
+	struct sd_bus_slot *slot;
+	struct wl_list sources; // xdpw_screencast_source::link
+	bool multiple;
 	uint32_t cursor_mode;
 	uint32_t persist_mode;
 };
 
 struct xdpw_wlr_output {
 	struct wl_list link;
+	struct xdpw_screencast_context *ctx;
 	uint32_t id;
 	struct wl_output *output;
 	struct zxdg_output_v1 *xdg_output;
@@ -235,6 +384,11 @@ struct xdpw_wlr_output {
 	int height;
 	float framerate;
 	enum wl_output_transform transformation;
+
+	// instances capturing this output
+	struct wl_list capture_streams; // xdpw_screencast_instance::capture_link
+	// earliest start of the next capture of any of them
+	uint64_t capture_next_ns;
 };
 
 void randname(char *buf);
@@ -242,7 +396,21 @@ struct gbm_device *xdpw_gbm_device_create(drmDevice *device);
 void xdpw_gbm_device_update(struct xdpw_screencast_instance *cast);
 struct xdpw_buffer *xdpw_buffer_create(struct xdpw_screencast_instance *cast,
 	enum buffer_type buffer_type);
+struct xdpw_buffer *xdpw_staging_buffer_create(struct xdpw_screencast_instance *cast);
+struct xdpw_buffer *xdpw_scaled_buffer_create(struct xdpw_screencast_instance *cast);
+struct xdpw_buffer *xdpw_frame_capture_buffer(struct xdpw_screencast_instance *cast);
 void xdpw_buffer_destroy(struct xdpw_buffer *buffer);
+void xdpw_buffer_flip_y(struct xdpw_buffer *buffer);
+size_t xdpw_buffer_release_memory(struct xdpw_buffer *buffer);
+uint64_t xdpw_buffer_allocated_size(struct xdpw_buffer *buffer);
+// Accounts the memory of a buffer of the instance after it was created
+// or before it is destroyed
+void xdpw_buffer_account(struct xdpw_screencast_instance *cast,
+	struct xdpw_buffer *buffer, bool allocated);
+
+uint32_t xdpw_transform_flip_y(uint32_t transform);
+
+struct xdpw_shm_format *xdpw_find_shm_format(struct xdpw_buffer_constraints *constraints, uint32_t format);
 
 void xdpw_buffer_constraints_init(struct xdpw_buffer_constraints *constraints);
 void xdpw_buffer_constraints_finish(struct xdpw_buffer_constraints *constraints);
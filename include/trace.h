@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum xdpw_trace_phase {
+	XDPW_TRACE_BEGIN,
+	XDPW_TRACE_END,
+	XDPW_TRACE_ASYNC_BEGIN,
+	XDPW_TRACE_ASYNC_END,
+	XDPW_TRACE_INSTANT,
+	XDPW_TRACE_COUNTER,
+};
+
+extern bool xdpw_trace_active;
+
+int xdpw_trace_init(const char *path);
+void xdpw_trace_finish(void);
+int xdpw_trace_dump(void);
+// name must be a string literal, only the pointer is recorded
+void xdpw_trace_record(enum xdpw_trace_phase phase, const char *name,
+	uint64_t id, int64_t value);
+
+static inline void xdpw_trace(enum xdpw_trace_phase phase, const char *name,
+		uint64_t id, int64_t value) {
+	if (xdpw_trace_active) {
+		xdpw_trace_record(phase, name, id, value);
+	}
+}
+
+#define xdpw_trace_begin(name) xdpw_trace(XDPW_TRACE_BEGIN, name, 0, 0)
+#define xdpw_trace_end(name) xdpw_trace(XDPW_TRACE_END, name, 0, 0)
+#define xdpw_trace_async_begin(name, id) xdpw_trace(XDPW_TRACE_ASYNC_BEGIN, name, id, 0)
+#define xdpw_trace_async_end(name, id) xdpw_trace(XDPW_TRACE_ASYNC_END, name, id, 0)
+#define xdpw_trace_instant(name) xdpw_trace(XDPW_TRACE_INSTANT, name, 0, 0)
+#define xdpw_trace_counter(name, value) xdpw_trace(XDPW_TRACE_COUNTER, name, 0, value)
+
+#endif
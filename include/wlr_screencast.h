@@ -16,15 +16,21 @@
 struct xdpw_state;
 
 int xdpw_wlr_screencopy_init(struct xdpw_state *state);
+void xdpw_wlr_screencopy_setup(struct xdpw_state *state);
 void xdpw_wlr_screencopy_finish(struct xdpw_screencast_context *ctx);
 
 struct xdpw_wlr_output *xdpw_wlr_output_find_by_name(struct wl_list *output_list, const char *name);
 
-bool xdpw_wlr_target_chooser(struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target, uint32_t type_mask);
+// Appends the selected targets, only one unless multiple is set
+bool xdpw_wlr_target_chooser(struct xdpw_screencast_context *ctx, struct wl_array *targets,
+		uint32_t type_mask, bool multiple);
 bool xdpw_wlr_target_from_data(struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target,
 		struct xdpw_screencast_restore_data *data);
+bool xdpw_wlr_target_set_region(struct xdpw_screencast_context *ctx,
+		struct xdpw_screencast_target *target, struct xdpw_pixel_rect region);
 
 void xdpw_wlr_frame_capture(struct xdpw_screencast_instance *cast);
+void xdpw_wlr_frame_failed(struct xdpw_screencast_instance *cast);
 int xdpw_wlr_session_init(struct xdpw_screencast_instance *cast);
 void xdpw_wlr_session_close(struct xdpw_screencast_instance *cast);
 
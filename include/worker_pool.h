@@ -0,0 +1,16 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdint.h>
+
+// Processes the items [first, last) of a job
+typedef void (*xdpw_worker_func)(void *data, uint32_t first, uint32_t last);
+
+// Splits count items into bands which are processed by a few worker
+// threads and the calling thread together. Returns once all of them are
+// done. Jobs with a cost (e.g. in pixels) below a threshold run on the
+// calling thread only.
+void xdpw_worker_pool_run(xdpw_worker_func func, void *data, uint32_t count, uint64_t cost);
+void xdpw_worker_pool_finish(void);
+
+#endif
@@ -13,9 +13,11 @@
 #include "screencast_common.h"
 #include "screenshot_common.h"
 #include "config.h"
+#include "hash_table.h"
 
 struct xdpw_state {
 	struct wl_list xdpw_sessions;
+	struct xdpw_hash_table sessions_by_handle;
 	sd_bus *bus;
 	struct wl_display *wl_display;
 	struct pw_loop *pw_loop;
@@ -28,6 +30,10 @@ struct xdpw_state {
 	int timer_poll_fd;
 	struct wl_list timers;
 	struct xdpw_timer *next_timer;
+	struct xdpw_timer *idle_timer;
+	bool idle_exit;
+	bool quit;
+	struct wl_list children; // xdpw_child::link
 };
 
 struct xdpw_request {
@@ -36,9 +42,12 @@ struct xdpw_request {
 
 struct xdpw_session {
 	struct wl_list link;
+	struct xdpw_state *state;
 	sd_bus_slot *slot;
 	char *session_handle;
 	bool closed;
+	// set once the session is going to be destroyed
+	struct xdpw_timer *destroy_timer;
 	struct xdpw_screencast_session_data screencast_data;
 };
 
@@ -60,12 +69,17 @@ enum {
 
 int xdpw_screenshot_init(struct xdpw_state *state);
 int xdpw_screencast_init(struct xdpw_state *state);
+void xdpw_screencast_finish(struct xdpw_state *state);
 
 struct xdpw_request *xdpw_request_create(sd_bus *bus, const char *object_path);
 void xdpw_request_destroy(struct xdpw_request *req);
 
 struct xdpw_session *xdpw_session_create(struct xdpw_state *state, sd_bus *bus, char *object_path);
 void xdpw_session_destroy(struct xdpw_session *req);
+void xdpw_session_destroy_later(struct xdpw_session *sess);
+struct xdpw_session *xdpw_session_find(struct xdpw_state *state, const char *session_handle);
+bool xdpw_session_idle(struct xdpw_state *state);
+void xdpw_session_update_idle(struct xdpw_state *state);
 
 struct xdpw_timer *xdpw_add_timer(struct xdpw_state *state,
 	uint64_t delay_ns, xdpw_event_loop_timer_func_t func, void *data);
@@ -9,6 +9,26 @@
 #include <unistd.h>
 #include <ini.h>
 
+static const char *yuv_matrix_str(enum xdpw_yuv_matrix matrix) {
+	switch (matrix) {
+	case XDPW_YUV_MATRIX_BT601:
+		return "bt601";
+	case XDPW_YUV_MATRIX_BT709:
+		return "bt709";
+	}
+	return "unknown";
+}
+
+static const char *yuv_range_str(enum xdpw_yuv_range range) {
+	switch (range) {
+	case XDPW_YUV_RANGE_LIMITED:
+		return "limited";
+	case XDPW_YUV_RANGE_FULL:
+		return "full";
+	}
+	return "unknown";
+}
+
 void print_config(enum LOGLEVEL loglevel, struct xdpw_config *config) {
 	logprint(loglevel, "config: outputname:  %s", config->screencast_conf.output_name);
 	logprint(loglevel, "config: max_fps:  %f", config->screencast_conf.max_fps);
@@ -17,6 +37,20 @@ void print_config(enum LOGLEVEL loglevel, struct xdpw_config *config) {
 	logprint(loglevel, "config: chooser_cmd: %s", config->screencast_conf.chooser_cmd);
 	logprint(loglevel, "config: chooser_type: %s", chooser_type_str(config->screencast_conf.chooser_type));
 	logprint(loglevel, "config: force_mod_linear: %d", config->screencast_conf.force_mod_linear);
+	logprint(loglevel, "config: shm_conversion: %d", config->screencast_conf.shm_conversion);
+	logprint(loglevel, "config: shm_yuv_conversion: %d", config->screencast_conf.shm_yuv_conversion);
+	logprint(loglevel, "config: yuv_matrix: %s", yuv_matrix_str(config->screencast_conf.yuv_matrix));
+	logprint(loglevel, "config: yuv_range: %s", yuv_range_str(config->screencast_conf.yuv_range));
+	logprint(loglevel, "config: shm_scaling: %d", config->screencast_conf.shm_scaling);
+	logprint(loglevel, "config: shm_damage_detection: %d", config->screencast_conf.shm_damage_detection);
+	logprint(loglevel, "config: capture_retries: %d", config->screencast_conf.capture_retries);
+	logprint(loglevel, "config: max_capture_bandwidth: %d", config->screencast_conf.max_capture_bandwidth);
+	logprint(loglevel, "config: max_buffer_memory: %d", config->screencast_conf.max_buffer_memory);
+	logprint(loglevel, "config: adaptive_buffers: %d", config->screencast_conf.adaptive_buffers);
+	logprint(loglevel, "config: output_reconnect_timeout: %d", config->screencast_conf.output_reconnect_timeout);
+	logprint(loglevel, "config: paused_release_timeout: %d", config->screencast_conf.paused_release_timeout);
+	logprint(loglevel, "config: idle_timeout: %d", config->screencast_conf.idle_timeout);
+	logprint(loglevel, "config: exec_timeout: %d", config->screencast_conf.exec_timeout);
 }
 
 // NOTE: calling finish_config won't prepare the config to be read again from config file
@@ -48,6 +82,14 @@ static void parse_double(double *dest, const char* value) {
 	*dest = strtod(value, (char**)NULL);
 }
 
+static void parse_int(int *dest, const char* value) {
+	if (value == NULL || *value == '\0') {
+		logprint(TRACE, "config: skipping empty value in config file");
+		return;
+	}
+	*dest = strtol(value, (char**)NULL, 10);
+}
+
 static void parse_bool(bool *dest, const char* value) {
 	if (value == NULL || *value == '\0') {
 		logprint(TRACE, "config: skipping empty value in config file");
@@ -60,6 +102,34 @@ static void parse_bool(bool *dest, const char* value) {
 	}
 }
 
+static void parse_yuv_matrix(enum xdpw_yuv_matrix *dest, const char *value) {
+	if (value == NULL || *value == '\0') {
+		logprint(TRACE, "config: skipping empty value in config file");
+		return;
+	}
+	if (strcmp(value, "bt601") == 0) {
+		*dest = XDPW_YUV_MATRIX_BT601;
+	} else if (strcmp(value, "bt709") == 0) {
+		*dest = XDPW_YUV_MATRIX_BT709;
+	} else {
+		logprint(WARN, "config: unknown yuv_matrix %s", value);
+	}
+}
+
+static void parse_yuv_range(enum xdpw_yuv_range *dest, const char *value) {
+	if (value == NULL || *value == '\0') {
+		logprint(TRACE, "config: skipping empty value in config file");
+		return;
+	}
+	if (strcmp(value, "limited") == 0) {
+		*dest = XDPW_YUV_RANGE_LIMITED;
+	} else if (strcmp(value, "full") == 0) {
+		*dest = XDPW_YUV_RANGE_FULL;
+	} else {
+		logprint(WARN, "config: unknown yuv_range %s", value);
+	}
+}
+
 static int handle_ini_screencast(struct config_screencast *screencast_conf, const char *key, const char *value) {
 	if (strcmp(key, "output_name") == 0) {
 		parse_string(&screencast_conf->output_name, value);
@@ -78,6 +148,34 @@ static int handle_ini_screencast(struct config_screencast *screencast_conf, cons
 		free(chooser_type);
 	} else if (strcmp(key, "force_mod_linear") == 0) {
 		parse_bool(&screencast_conf->force_mod_linear, value);
+	} else if (strcmp(key, "shm_conversion") == 0) {
+		parse_bool(&screencast_conf->shm_conversion, value);
+	} else if (strcmp(key, "shm_yuv_conversion") == 0) {
+		parse_bool(&screencast_conf->shm_yuv_conversion, value);
+	} else if (strcmp(key, "yuv_matrix") == 0) {
+		parse_yuv_matrix(&screencast_conf->yuv_matrix, value);
+	} else if (strcmp(key, "yuv_range") == 0) {
+		parse_yuv_range(&screencast_conf->yuv_range, value);
+	} else if (strcmp(key, "shm_scaling") == 0) {
+		parse_bool(&screencast_conf->shm_scaling, value);
+	} else if (strcmp(key, "shm_damage_detection") == 0) {
+		parse_bool(&screencast_conf->shm_damage_detection, value);
+	} else if (strcmp(key, "capture_retries") == 0) {
+		parse_int(&screencast_conf->capture_retries, value);
+	} else if (strcmp(key, "max_capture_bandwidth") == 0) {
+		parse_int(&screencast_conf->max_capture_bandwidth, value);
+	} else if (strcmp(key, "max_buffer_memory") == 0) {
+		parse_int(&screencast_conf->max_buffer_memory, value);
+	} else if (strcmp(key, "adaptive_buffers") == 0) {
+		parse_bool(&screencast_conf->adaptive_buffers, value);
+	} else if (strcmp(key, "output_reconnect_timeout") == 0) {
+		parse_int(&screencast_conf->output_reconnect_timeout, value);
+	} else if (strcmp(key, "paused_release_timeout") == 0) {
+		parse_int(&screencast_conf->paused_release_timeout, value);
+	} else if (strcmp(key, "idle_timeout") == 0) {
+		parse_int(&screencast_conf->idle_timeout, value);
+	} else if (strcmp(key, "exec_timeout") == 0) {
+		parse_int(&screencast_conf->exec_timeout, value);
 	} else {
 		logprint(TRACE, "config: skipping invalid key in config file");
 		return 0;
@@ -100,6 +198,11 @@ static int handle_ini_config(void *data, const char* section, const char *key, c
 static void default_config(struct xdpw_config *config) {
 	config->screencast_conf.max_fps = 0;
 	config->screencast_conf.chooser_type = XDPW_CHOOSER_DEFAULT;
+	config->screencast_conf.yuv_matrix = XDPW_YUV_MATRIX_BT709;
+	config->screencast_conf.yuv_range = XDPW_YUV_RANGE_LIMITED;
+	config->screencast_conf.capture_retries = 5;
+	config->screencast_conf.output_reconnect_timeout = 10;
+	config->screencast_conf.exec_timeout = 30;
 }
 
 static bool file_exists(const char *path) {
@@ -0,0 +1,120 @@
+#include "exec.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "xdpw.h"
+#include "logger.h"
+#include "timespec_util.h"
+
+static void child_destroy(struct xdpw_child *child) {
+	xdpw_destroy_timer(child->timeout_timer);
+	wl_list_remove(&child->link);
+	free(child->command);
+	free(child);
+}
+
+static void child_timeout(void *data) {
+	struct xdpw_child *child = data;
+	child->timeout_timer = NULL;
+
+	logprint(WARN, "exec: '%s' (pid %d) timed out, terminating it",
+		child->command, child->pid);
+	// The command runs in its own process group, so this also reaches
+	// anything the shell started
+	if (kill(-child->pid, SIGTERM) < 0) {
+		logprint(ERROR, "exec: failed to terminate pid %d: %s",
+			child->pid, strerror(errno));
+	}
+}
+
+int xdpw_exec_shell(struct xdpw_state *state, const char *command) {
+	struct xdpw_child *child = calloc(1, sizeof(*child));
+	if (!child) {
+		logprint(ERROR, "exec: allocation failed");
+		return -1;
+	}
+	child->state = state;
+	child->command = strdup(command);
+	if (!child->command) {
+		free(child);
+		logprint(ERROR, "exec: allocation failed");
+		return -1;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		logprint(ERROR, "exec: fork failed: %s", strerror(errno));
+		free(child->command);
+		free(child);
+		return -1;
+	} else if (pid == 0) {
+		setpgid(0, 0);
+
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		char *const argv[] = {
+			"sh",
+			"-c",
+			child->command,
+			NULL,
+		};
+		execvp("sh", argv);
+		perror("execvp");
+		_exit(127);
+	}
+	// Also set it from the parent, so kill() can't race the child
+	setpgid(pid, pid);
+
+	child->pid = pid;
+	wl_list_insert(&state->children, &child->link);
+
+	int timeout = state->config->screencast_conf.exec_timeout;
+	if (timeout > 0) {
+		child->timeout_timer = xdpw_add_timer(state,
+			(uint64_t)timeout * TIMESPEC_NSEC_PER_SEC, child_timeout, child);
+	}
+
+	xdpw_session_update_idle(state);
+
+	logprint(DEBUG, "exec: started '%s' as pid %d", command, pid);
+	return 0;
+}
+
+void xdpw_exec_reap(struct xdpw_state *state) {
+	struct xdpw_child *child, *tmp;
+	wl_list_for_each_safe(child, tmp, &state->children, link) {
+		int status;
+		pid_t ret = waitpid(child->pid, &status, WNOHANG);
+		if (ret == 0) {
+			continue;
+		} else if (ret < 0) {
+			logprint(ERROR, "exec: waitpid for pid %d failed: %s",
+				child->pid, strerror(errno));
+		} else if (WIFEXITED(status)) {
+			enum LOGLEVEL level = WEXITSTATUS(status) == 0 ? DEBUG : WARN;
+			logprint(level, "exec: '%s' exited with status %d",
+				child->command, WEXITSTATUS(status));
+		} else if (WIFSIGNALED(status)) {
+			logprint(WARN, "exec: '%s' was killed by signal %d",
+				child->command, WTERMSIG(status));
+		}
+		child_destroy(child);
+	}
+	xdpw_session_update_idle(state);
+}
+
+void xdpw_exec_finish(struct xdpw_state *state) {
+	// Leave hooks that are still running alone, they might be restoring
+	// state (e.g. re-enabling notifications after the screencast)
+	struct xdpw_child *child, *tmp;
+	wl_list_for_each_safe(child, tmp, &state->children, link) {
+		child_destroy(child);
+	}
+}
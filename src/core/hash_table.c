@@ -0,0 +1,121 @@
+#include "hash_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_TABLE_MIN_BUCKETS 16
+
+struct xdpw_hash_entry {
+	struct xdpw_hash_entry *next;
+	const char *key;
+	uint32_t hash;
+	void *value;
+};
+
+// FNV-1a
+static uint32_t hash_string(const char *str) {
+	uint32_t hash = 2166136261u;
+	for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+		hash ^= *c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool hash_table_resize(struct xdpw_hash_table *table, size_t bucket_count) {
+	struct xdpw_hash_entry **buckets = calloc(bucket_count, sizeof(*buckets));
+	if (!buckets) {
+		return false;
+	}
+
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		struct xdpw_hash_entry *entry = table->buckets[i];
+		while (entry) {
+			struct xdpw_hash_entry *next = entry->next;
+			size_t index = entry->hash & (bucket_count - 1);
+			entry->next = buckets[index];
+			buckets[index] = entry;
+			entry = next;
+		}
+	}
+
+	free(table->buckets);
+	table->buckets = buckets;
+	table->bucket_count = bucket_count;
+	return true;
+}
+
+void xdpw_hash_table_init(struct xdpw_hash_table *table) {
+	*table = (struct xdpw_hash_table){0};
+}
+
+void xdpw_hash_table_finish(struct xdpw_hash_table *table) {
+	for (size_t i = 0; i < table->bucket_count; i++) {
+		struct xdpw_hash_entry *entry = table->buckets[i];
+		while (entry) {
+			struct xdpw_hash_entry *next = entry->next;
+			free(entry);
+			entry = next;
+		}
+	}
+	free(table->buckets);
+	*table = (struct xdpw_hash_table){0};
+}
+
+bool xdpw_hash_table_insert(struct xdpw_hash_table *table, const char *key, void *value) {
+	if (table->bucket_count == 0) {
+		if (!hash_table_resize(table, HASH_TABLE_MIN_BUCKETS)) {
+			return false;
+		}
+	} else if (table->count + 1 > table->bucket_count * 3 / 4) {
+		// Keep going with a crowded table if growing fails
+		hash_table_resize(table, table->bucket_count * 2);
+	}
+
+	struct xdpw_hash_entry *entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		return false;
+	}
+	entry->key = key;
+	entry->hash = hash_string(key);
+	entry->value = value;
+
+	size_t index = entry->hash & (table->bucket_count - 1);
+	entry->next = table->buckets[index];
+	table->buckets[index] = entry;
+	table->count++;
+	return true;
+}
+
+static struct xdpw_hash_entry **hash_table_find(struct xdpw_hash_table *table, const char *key) {
+	if (table->bucket_count == 0) {
+		return NULL;
+	}
+	uint32_t hash = hash_string(key);
+	struct xdpw_hash_entry **entry = &table->buckets[hash & (table->bucket_count - 1)];
+	for (; *entry; entry = &(*entry)->next) {
+		if ((*entry)->hash == hash && strcmp((*entry)->key, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void *xdpw_hash_table_lookup(struct xdpw_hash_table *table, const char *key) {
+	struct xdpw_hash_entry **entry = hash_table_find(table, key);
+	return entry ? (*entry)->value : NULL;
+}
+
+void *xdpw_hash_table_remove(struct xdpw_hash_table *table, const char *key) {
+	struct xdpw_hash_entry **link = hash_table_find(table, key);
+	if (!link) {
+		return NULL;
+	}
+	struct xdpw_hash_entry *entry = *link;
+	void *value = entry->value;
+	*link = entry->next;
+	free(entry);
+	table->count--;
+	return value;
+}
@@ -1,15 +1,158 @@
 #include "logger.h"
 
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-static struct logger_properties logprops;
+#define LOG_RING_SIZE 1024 // must be a power of two
+#define LOG_LINE_MAX 512
+
+/*
+ * Messages are formatted by the calling thread and handed to a writer
+ * thread through a bounded multi-producer single-consumer ring. Each slot
+ * carries a sequence number telling whether it is free for the producer
+ * at position pos (seq == pos) or ready for the consumer (seq == pos + 1).
+ * When the ring is full, messages are dropped and counted instead of
+ * blocking the caller.
+ */
+struct log_slot {
+	atomic_size_t seq;
+	size_t len;
+	char line[LOG_LINE_MAX];
+};
+
+struct logger_ring {
+	struct log_slot slots[LOG_RING_SIZE];
+	atomic_size_t enqueue_pos;
+	size_t dequeue_pos;
+	atomic_uint_fast64_t dropped;
+	atomic_bool stop;
+	sem_t wakeup;
+	pthread_t writer;
+	pid_t pid; // the writer doesn't survive fork()
+	bool running;
+};
+
+struct logger_properties logprops;
+
+static struct logger_ring *ring;
+
+static bool ring_pop(FILE *dst) {
+	struct log_slot *slot = &ring->slots[ring->dequeue_pos & (LOG_RING_SIZE - 1)];
+	size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq != ring->dequeue_pos + 1) {
+		return false;
+	}
+	fwrite(slot->line, 1, slot->len, dst);
+	atomic_store_explicit(&slot->seq, ring->dequeue_pos + LOG_RING_SIZE, memory_order_release);
+	ring->dequeue_pos++;
+	return true;
+}
+
+static void ring_drain(FILE *dst) {
+	while (ring_pop(dst)) {
+		// keep writing
+	}
+	uint64_t dropped = atomic_exchange(&ring->dropped, 0);
+	if (dropped > 0) {
+		fprintf(dst, "[logger] %"PRIu64" messages dropped\n", dropped);
+	}
+	fflush(dst);
+}
+
+static struct log_slot *ring_push(const char *line, size_t len, size_t *out_pos) {
+	size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+	struct log_slot *slot;
+	while (true) {
+		slot = &ring->slots[pos & (LOG_RING_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			atomic_fetch_add(&ring->dropped, 1);
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	memcpy(slot->line, line, len);
+	slot->len = len;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	sem_post(&ring->wakeup);
+	*out_pos = pos;
+	return slot;
+}
+
+static void *writer_thread(void *data) {
+	FILE *dst = data;
+	while (!atomic_load(&ring->stop)) {
+		while (sem_wait(&ring->wakeup) < 0) {
+			// interrupted by a signal
+		}
+		ring_drain(dst);
+	}
+	return NULL;
+}
+
+static bool ring_running(void) {
+	return ring && ring->running && ring->pid == getpid();
+}
+
+static void logger_finish(void) {
+	if (!ring || ring->pid != getpid()) {
+		return;
+	}
+	if (ring->running) {
+		atomic_store(&ring->stop, true);
+		sem_post(&ring->wakeup);
+		pthread_join(ring->writer, NULL);
+		ring->running = false;
+	}
+	ring_drain(logprops.dst);
+}
 
 void init_logger(FILE *dst, enum LOGLEVEL level) {
 	logprops.dst = dst;
 	logprops.level = level;
+
+	if (level == QUIET || ring) {
+		return;
+	}
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		return;
+	}
+	for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+		atomic_init(&ring->slots[i].seq, i);
+	}
+	if (sem_init(&ring->wakeup, 0, 0) < 0) {
+		free(ring);
+		ring = NULL;
+		return;
+	}
+	if (pthread_create(&ring->writer, NULL, writer_thread, dst) != 0) {
+		sem_destroy(&ring->wakeup);
+		free(ring);
+		ring = NULL;
+		return;
+	}
+	ring->pid = getpid();
+	ring->running = true;
+	atexit(logger_finish);
 }
 
 enum LOGLEVEL get_loglevel(const char *level) {
@@ -50,7 +193,15 @@ static const char *print_loglevel(enum LOGLEVEL loglevel) {
 	abort();
 }
 
-void logprint(enum LOGLEVEL level, char *msg, ...) {
+void logger_flush(void) {
+	if (ring_running()) {
+		sem_post(&ring->wakeup);
+	} else if (logprops.dst) {
+		fflush(logprops.dst);
+	}
+}
+
+void logger_print(enum LOGLEVEL level, char *msg, ...) {
 	if (!logprops.dst) {
 		fprintf(stderr, "Logger has been called, but was not initialized\n");
 		abort();
@@ -59,27 +210,46 @@ void logprint(enum LOGLEVEL level, char *msg, ...) {
 	if (level > logprops.level || level == QUIET) {
 		return;
 	}
-	va_list args;
 
-	char timestr[200];
-	time_t t = time(NULL);
-	struct tm *tmp = localtime(&t);
-
-	if (strftime(timestr, sizeof(timestr), "%Y/%m/%d %H:%M:%S", tmp) == 0) {
-		fprintf(stderr, "strftime returned 0");
-		abort();
-	}
+	static _Thread_local char line[LOG_LINE_MAX];
 
-	fprintf(logprops.dst, "%s", timestr);
-	fprintf(logprops.dst, " ");
-	fprintf(logprops.dst, "[%s]", print_loglevel(level));
-	fprintf(logprops.dst, " - ");
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int len = snprintf(line, sizeof(line), "%5"PRIu64".%06ld [%s] - ",
+		(uint64_t)now.tv_sec, now.tv_nsec / 1000, print_loglevel(level));
 
+	va_list args;
 	va_start(args, msg);
-	vfprintf(logprops.dst, msg, args);
+	int n = vsnprintf(line + len, sizeof(line) - len, msg, args);
 	va_end(args);
+	if (n < 0) {
+		return;
+	}
+	len += n;
+	if (len > LOG_LINE_MAX - 2) {
+		// truncated
+		len = LOG_LINE_MAX - 2;
+	}
+	line[len++] = '\n';
+	line[len] = '\0';
 
-
-	fprintf(logprops.dst, "\n");
-	fflush(logprops.dst);
+	if (ring_running()) {
+		size_t pos;
+		struct log_slot *slot = ring_push(line, len, &pos);
+		if (level == ERROR) {
+			// Errors are often followed by abort(), make sure they hit the
+			// destination before returning
+			if (!slot) {
+				fwrite(line, 1, len, logprops.dst);
+				fflush(logprops.dst);
+				return;
+			}
+			while (atomic_load_explicit(&slot->seq, memory_order_acquire) == pos + 1) {
+				sched_yield();
+			}
+		}
+	} else {
+		fwrite(line, 1, len, logprops.dst);
+		fflush(logprops.dst);
+	}
 }
@@ -1,21 +1,28 @@
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/timerfd.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <pipewire/pipewire.h>
 #include <spa/utils/result.h>
 #include <unistd.h>
 
 #include "xdpw.h"
+#include "exec.h"
 #include "logger.h"
+#include "trace.h"
+#include "timespec_util.h"
 
 enum event_loop_fd {
 	EVENT_LOOP_DBUS,
 	EVENT_LOOP_WAYLAND,
 	EVENT_LOOP_PIPEWIRE,
 	EVENT_LOOP_TIMER,
+	EVENT_LOOP_SIGNAL,
 };
 
 static const char service_name[] = "org.freedesktop.impl.portal.desktop.wlr";
@@ -29,6 +36,8 @@ static int xdpw_usage(FILE *stream, int rc) {
 		"    -c, --config=<config file>	      Select config file.\n"
 		"                                     (default is $XDG_CONFIG_HOME/xdg-desktop-portal-wlr/config)\n"
 		"    -r, --replace                    Replace a running instance.\n"
+		"    -t, --trace=<trace file>         Record a frame pipeline trace, written\n"
+		"                                     to the file on SIGUSR2 or DumpTrace.\n"
 		"    -h, --help                       Get help (this text).\n"
 		"\n";
 
@@ -36,23 +45,118 @@ static int xdpw_usage(FILE *stream, int rc) {
 	return rc;
 }
 
+static int signal_pipe[2] = { -1, -1 };
+
+static void handle_signal(int signo) {
+	int saved_errno = errno;
+	unsigned char sig = signo;
+	if (write(signal_pipe[1], &sig, sizeof(sig)) < 0) {
+		// Nothing we can do from a signal handler
+	}
+	errno = saved_errno;
+}
+
+static int init_signal_pipe(void) {
+	if (pipe(signal_pipe) < 0) {
+		return -1;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC) < 0 ||
+				fcntl(signal_pipe[i], F_SETFL, O_NONBLOCK) < 0) {
+			return -1;
+		}
+	}
+
+	struct sigaction sa = {
+		.sa_handler = handle_signal,
+		.sa_flags = SA_RESTART | SA_NOCLDSTOP,
+	};
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR2, &sa, NULL) < 0 || sigaction(SIGCHLD, &sa, NULL) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static void dispatch_signals(struct xdpw_state *state) {
+	unsigned char sig;
+	while (read(signal_pipe[0], &sig, sizeof(sig)) == sizeof(sig)) {
+		switch (sig) {
+		case SIGUSR2:
+			logprint(DEBUG, "event-loop: got SIGUSR2");
+			if (xdpw_trace_dump() < 0) {
+				logprint(WARN, "trace: no trace written");
+			}
+			break;
+		case SIGCHLD:
+			xdpw_exec_reap(state);
+			break;
+		}
+	}
+}
+
 static int handle_name_lost(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
 	logprint(INFO, "dbus: lost name, closing connection");
 	sd_bus_close(sd_bus_message_get_bus(m));
 	return 1;
 }
 
+// Gives up the service name and answers the calls that are still queued,
+// returns false if one of them started a session
+static bool release_name_on_idle(struct xdpw_state *state, sd_bus_slot **slot,
+		const char *match) {
+	// Losing the name is expected from now on
+	*slot = sd_bus_slot_unref(*slot);
+
+	int ret = sd_bus_release_name(state->bus, service_name);
+	if (ret < 0) {
+		logprint(WARN, "dbus: failed to release service name: %s", strerror(-ret));
+	}
+
+	// Calls routed to us before the name was released precede the reply
+	// to ReleaseName, so they have all been queued by now
+	do {
+		ret = sd_bus_process(state->bus, NULL);
+	} while (ret > 0);
+	if (ret < 0) {
+		logprint(ERROR, "sd_bus_process failed: %s", strerror(-ret));
+		return true;
+	}
+	sd_bus_flush(state->bus);
+
+	if (xdpw_session_idle(state)) {
+		return true;
+	}
+
+	logprint(INFO, "xdpw: got a request while exiting, staying around");
+	ret = sd_bus_request_name(state->bus, service_name, SD_BUS_NAME_ALLOW_REPLACEMENT);
+	if (ret < 0) {
+		logprint(WARN, "dbus: failed to re-acquire service name: %s", strerror(-ret));
+		return false;
+	}
+	ret = sd_bus_add_match(state->bus, slot, match, handle_name_lost, NULL);
+	if (ret < 0) {
+		logprint(ERROR, "dbus: failed to add NameOwnerChanged signal match: %s", strerror(-ret));
+	}
+	return false;
+}
+
 int main(int argc, char *argv[]) {
+	struct timespec startup_time;
+	clock_gettime(CLOCK_MONOTONIC, &startup_time);
+
 	struct xdpw_config config = {0};
 	char *configfile = NULL;
+	char *tracefile = NULL;
 	enum LOGLEVEL loglevel = DEFAULT_LOGLEVEL;
 	bool replace = false;
 
-	static const char *shortopts = "l:o:c:f:rh";
+	static const char *shortopts = "l:o:c:f:t:rh";
 	static const struct option longopts[] = {
 		{ "loglevel", required_argument, NULL, 'l' },
 		{ "config", required_argument, NULL, 'c' },
 		{ "replace", no_argument, NULL, 'r' },
+		{ "trace", required_argument, NULL, 't' },
 		{ "help", no_argument, NULL, 'h' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -73,6 +177,9 @@ int main(int argc, char *argv[]) {
 		case 'r':
 			replace = true;
 			break;
+		case 't':
+			tracefile = strdup(optarg);
+			break;
 		case 'h':
 			return xdpw_usage(stdout, EXIT_SUCCESS);
 		default:
@@ -84,6 +191,14 @@ int main(int argc, char *argv[]) {
 	init_config(&configfile, &config);
 	print_config(DEBUG, &config);
 
+	if (tracefile && xdpw_trace_init(tracefile) < 0) {
+		return EXIT_FAILURE;
+	}
+	if (init_signal_pipe() < 0) {
+		logprint(ERROR, "event-loop: failed to set up signal handling: %s", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
 	int ret = 0;
 
 	sd_bus *bus = NULL;
@@ -124,6 +239,8 @@ int main(int argc, char *argv[]) {
 	};
 
 	wl_list_init(&state.xdpw_sessions);
+	xdpw_hash_table_init(&state.sessions_by_handle);
+	wl_list_init(&state.children);
 
 	ret = xdpw_screenshot_init(&state);
 	if (ret < 0) {
@@ -148,6 +265,11 @@ int main(int argc, char *argv[]) {
 		goto error;
 	}
 
+	struct timespec ready_time;
+	clock_gettime(CLOCK_MONOTONIC, &ready_time);
+	logprint(INFO, "xdpw: service name acquired %"PRId64" ms after startup",
+		timespec_diff_ns(&ready_time, &startup_time) / 1000000);
+
 	const char *unique_name;
 	ret = sd_bus_get_unique_name(bus, &unique_name);
 	if (ret < 0) {
@@ -187,12 +309,18 @@ int main(int argc, char *argv[]) {
 		[EVENT_LOOP_TIMER] = {
 			.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC),
 			.events = POLLIN,
-		}
+		},
+		[EVENT_LOOP_SIGNAL] = {
+			.fd = signal_pipe[0],
+			.events = POLLIN,
+		},
 	};
 
 	state.timer_poll_fd = pollfds[EVENT_LOOP_TIMER].fd;
 
-	while (1) {
+	xdpw_session_update_idle(&state);
+
+	while (!state.quit) {
 		// sd-bus requires that we update FD/events/timeout every time we poll
 		pollfds[EVENT_LOOP_DBUS].fd = sd_bus_get_fd(state.bus);
 		if (pollfds[EVENT_LOOP_DBUS].fd < 0) {
@@ -218,6 +346,9 @@ int main(int argc, char *argv[]) {
 
 		ret = poll(pollfds, sizeof(pollfds) / sizeof(pollfds[0]), msec_timeout);
 		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
 			logprint(ERROR, "poll failed: %s", strerror(errno));
 			goto error;
 		}
@@ -287,17 +418,50 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
+		if (pollfds[EVENT_LOOP_SIGNAL].revents & POLLIN) {
+			dispatch_signals(&state);
+		}
+
 		do {
 			ret = wl_display_dispatch_pending(state.wl_display);
 			wl_display_flush(state.wl_display);
 		} while (ret > 0);
 
 		sd_bus_flush(state.bus);
+
+		if (state.idle_exit) {
+			state.idle_exit = false;
+			state.quit = release_name_on_idle(&state, &slot, match);
+		}
+	}
+
+	struct xdpw_session *sess, *sess_tmp;
+	wl_list_for_each_safe(sess, sess_tmp, &state.xdpw_sessions, link) {
+		xdpw_session_destroy(sess);
 	}
+	xdpw_hash_table_finish(&state.sessions_by_handle);
+	xdpw_screencast_finish(&state);
+	xdpw_exec_finish(&state);
+
+	struct xdpw_timer *timer, *timer_tmp;
+	wl_list_for_each_safe(timer, timer_tmp, &state.timers, link) {
+		xdpw_destroy_timer(timer);
+	}
+	close(pollfds[EVENT_LOOP_TIMER].fd);
+
+	sd_bus_slot_unref(slot);
+	sd_bus_flush_close_unref(bus);
+	pw_loop_destroy(pw_loop);
+	pw_deinit();
+	wl_display_disconnect(wl_display);
+
+	close(signal_pipe[0]);
+	close(signal_pipe[1]);
 
-	// TODO: cleanup
 	finish_config(&config);
 	free(configfile);
+	xdpw_trace_finish();
+	free(tracefile);
 
 	return EXIT_SUCCESS;
 
@@ -6,6 +6,7 @@
 #include "xdpw.h"
 #include "screencast.h"
 #include "logger.h"
+#include "timespec_util.h"
 
 static const char interface_name[] = "org.freedesktop.impl.portal.Session";
 
@@ -43,7 +44,9 @@ static const sd_bus_vtable session_vtable[] = {
 struct xdpw_session *xdpw_session_create(struct xdpw_state *state, sd_bus *bus, char *object_path) {
 	struct xdpw_session *sess = calloc(1, sizeof(struct xdpw_session));
 
+	sess->state = state;
 	sess->session_handle = object_path;
+	wl_list_init(&sess->screencast_data.sources);
 
 	if (sd_bus_add_object_vtable(bus, &sess->slot, object_path, interface_name,
 			session_vtable, sess) < 0) {
@@ -53,7 +56,14 @@ struct xdpw_session *xdpw_session_create(struct xdpw_state *state, sd_bus *bus,
 		return NULL;
 	}
 
+	if (!xdpw_hash_table_insert(&state->sessions_by_handle, sess->session_handle, sess)) {
+		sd_bus_slot_unref(sess->slot);
+		free(sess);
+		logprint(ERROR, "dbus: failed to index session %s", object_path);
+		return NULL;
+	}
 	wl_list_insert(&state->xdpw_sessions, &sess->link);
+	xdpw_session_update_idle(state);
 	return sess;
 }
 
@@ -68,22 +78,81 @@ void xdpw_session_destroy(struct xdpw_session *sess) {
 			"org.freedesktop.impl.portal.Session", "Closed", "");
 	}
 
+	xdpw_destroy_timer(sess->destroy_timer);
+	sd_bus_slot_unref(sess->screencast_data.slot);
 	sd_bus_slot_unref(sess->slot);
 	wl_list_remove(&sess->link);
+	if (xdpw_hash_table_lookup(&sess->state->sessions_by_handle, sess->session_handle) == sess) {
+		xdpw_hash_table_remove(&sess->state->sessions_by_handle, sess->session_handle);
+	}
 
-	struct xdpw_screencast_instance *cast = sess->screencast_data.screencast_instance;
-	sess->screencast_data.screencast_instance = NULL;
-
-	if (cast) {
-		assert(cast->refcount > 0);
-		--cast->refcount;
-		logprint(DEBUG, "xdpw: screencast instance %p now has %d references",
-			cast, cast->refcount);
-		if (cast->refcount < 1) {
-			logprint(TRACE, "xdpw: destroying screencast instance");
-			xdpw_screencast_instance_destroy(cast);
-		}
+	struct xdpw_screencast_source *source, *tmp;
+	wl_list_for_each_safe(source, tmp, &sess->screencast_data.sources, link) {
+		xdpw_screencast_source_destroy(source);
 	}
+	struct xdpw_state *state = sess->state;
 	free(sess->session_handle);
 	free(sess);
+
+	xdpw_session_update_idle(state);
+}
+
+static void session_destroy_timer(void *data) {
+	struct xdpw_session *sess = data;
+	sess->destroy_timer = NULL;
+	xdpw_session_destroy(sess);
+}
+
+// Destroys the session from the event loop, for callers which might be
+// iterating over instances of the session
+void xdpw_session_destroy_later(struct xdpw_session *sess) {
+	if (sess->destroy_timer) {
+		return;
+	}
+	sess->destroy_timer = xdpw_add_timer(sess->state, 0, session_destroy_timer, sess);
+	if (!sess->destroy_timer) {
+		logprint(ERROR, "dbus: failed to schedule destruction of session %s",
+			sess->session_handle);
+	}
+}
+
+struct xdpw_session *xdpw_session_find(struct xdpw_state *state, const char *session_handle) {
+	struct xdpw_session *sess = xdpw_hash_table_lookup(&state->sessions_by_handle, session_handle);
+	// Sessions which are about to be destroyed don't take requests anymore
+	if (sess && sess->destroy_timer) {
+		return NULL;
+	}
+	return sess;
+}
+
+static void idle_timeout(void *data) {
+	struct xdpw_state *state = data;
+	state->idle_timer = NULL;
+
+	logprint(INFO, "xdpw: idle for %d seconds, exiting",
+		state->config->screencast_conf.idle_timeout);
+	// The event loop releases the bus name and answers the calls which
+	// are still queued before it exits
+	state->idle_exit = true;
+}
+
+bool xdpw_session_idle(struct xdpw_state *state) {
+	// exec_after hooks keep running after their session is gone
+	return wl_list_empty(&state->xdpw_sessions) &&
+		wl_list_empty(&state->children);
+}
+
+void xdpw_session_update_idle(struct xdpw_state *state) {
+	int timeout = state->config->screencast_conf.idle_timeout;
+	if (timeout <= 0) {
+		return;
+	}
+
+	if (!xdpw_session_idle(state)) {
+		xdpw_destroy_timer(state->idle_timer);
+		state->idle_timer = NULL;
+	} else if (!state->idle_timer) {
+		state->idle_timer = xdpw_add_timer(state,
+			(uint64_t)timeout * TIMESPEC_NSEC_PER_SEC, idle_timeout, state);
+	}
 }
@@ -0,0 +1,136 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "timespec_util.h"
+
+#define TRACE_RING_SIZE 65536
+
+struct xdpw_trace_event {
+	uint64_t timestamp_ns;
+	const char *name;
+	uint64_t id;
+	int64_t value;
+	enum xdpw_trace_phase phase;
+};
+
+static struct {
+	char *path;
+	struct xdpw_trace_event *ring;
+	uint64_t head; // total number of recorded events
+} tracer;
+
+bool xdpw_trace_active = false;
+
+int xdpw_trace_init(const char *path) {
+	tracer.ring = calloc(TRACE_RING_SIZE, sizeof(struct xdpw_trace_event));
+	tracer.path = strdup(path);
+	if (!tracer.ring || !tracer.path) {
+		logprint(ERROR, "trace: failed to allocate the event ring");
+		xdpw_trace_finish();
+		return -1;
+	}
+	tracer.head = 0;
+	xdpw_trace_active = true;
+	logprint(INFO, "trace: recording, send SIGUSR2 to write the trace to %s", path);
+	return 0;
+}
+
+void xdpw_trace_finish(void) {
+	xdpw_trace_active = false;
+	free(tracer.ring);
+	free(tracer.path);
+	tracer.ring = NULL;
+	tracer.path = NULL;
+}
+
+void xdpw_trace_record(enum xdpw_trace_phase phase, const char *name,
+		uint64_t id, int64_t value) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct xdpw_trace_event *event = &tracer.ring[tracer.head % TRACE_RING_SIZE];
+	event->timestamp_ns = now.tv_sec * TIMESPEC_NSEC_PER_SEC + now.tv_nsec;
+	event->name = name;
+	event->id = id;
+	event->value = value;
+	event->phase = phase;
+	tracer.head++;
+}
+
+static const char *trace_phase_str(enum xdpw_trace_phase phase) {
+	switch (phase) {
+	case XDPW_TRACE_BEGIN:
+		return "B";
+	case XDPW_TRACE_END:
+		return "E";
+	case XDPW_TRACE_ASYNC_BEGIN:
+		return "b";
+	case XDPW_TRACE_ASYNC_END:
+		return "e";
+	case XDPW_TRACE_INSTANT:
+		return "i";
+	case XDPW_TRACE_COUNTER:
+		return "C";
+	}
+	abort();
+}
+
+static void write_event(FILE *f, struct xdpw_trace_event *event, int pid) {
+	fprintf(f, "{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRIu64 ".%03" PRIu64
+		",\"pid\":%d,\"tid\":%d",
+		event->name, trace_phase_str(event->phase),
+		event->timestamp_ns / 1000, event->timestamp_ns % 1000, pid, pid);
+	switch (event->phase) {
+	case XDPW_TRACE_ASYNC_BEGIN:
+	case XDPW_TRACE_ASYNC_END:
+		fprintf(f, ",\"cat\":\"xdpw\",\"id\":\"0x%" PRIx64 "\"", event->id);
+		break;
+	case XDPW_TRACE_INSTANT:
+		fprintf(f, ",\"s\":\"t\"");
+		break;
+	case XDPW_TRACE_COUNTER:
+		fprintf(f, ",\"args\":{\"value\":%" PRId64 "}", event->value);
+		break;
+	default:
+		break;
+	}
+	fprintf(f, "}");
+}
+
+int xdpw_trace_dump(void) {
+	if (!xdpw_trace_active) {
+		return -1;
+	}
+
+	FILE *f = fopen(tracer.path, "w");
+	if (!f) {
+		logprint(ERROR, "trace: failed to open %s: %s", tracer.path, strerror(errno));
+		return -1;
+	}
+
+	uint64_t count = tracer.head < TRACE_RING_SIZE ? tracer.head : TRACE_RING_SIZE;
+	uint64_t first = tracer.head - count;
+	int pid = getpid();
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (uint64_t i = first; i < tracer.head; i++) {
+		write_event(f, &tracer.ring[i % TRACE_RING_SIZE], pid);
+		fprintf(f, i + 1 < tracer.head ? ",\n" : "\n");
+	}
+	fprintf(f, "]}\n");
+
+	if (fclose(f) != 0) {
+		logprint(ERROR, "trace: failed to write %s: %s", tracer.path, strerror(errno));
+		return -1;
+	}
+	logprint(INFO, "trace: wrote %" PRIu64 " events to %s", count, tracer.path);
+	return 0;
+}
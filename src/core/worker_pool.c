@@ -0,0 +1,124 @@
+#include "worker_pool.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#define WORKER_POOL_MAX_THREADS 4
+// Smaller jobs aren't worth waking up the workers
+#define WORKER_POOL_MIN_COST (128 * 1024)
+
+struct worker_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_t threads[WORKER_POOL_MAX_THREADS - 1];
+	uint32_t thread_count;
+	bool started;
+	bool quit;
+
+	xdpw_worker_func func;
+	void *data;
+	uint32_t count;
+	uint32_t bands;
+	uint32_t next_band;
+	uint32_t pending;
+};
+
+static struct worker_pool pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+// Called with the lock held, takes bands until none are left
+static void pool_run_bands(struct worker_pool *pool) {
+	while (pool->func && pool->next_band < pool->bands) {
+		xdpw_worker_func func = pool->func;
+		void *data = pool->data;
+		uint64_t count = pool->count;
+		uint32_t band = pool->next_band++;
+		uint32_t bands = pool->bands;
+		pthread_mutex_unlock(&pool->lock);
+
+		func(data, count * band / bands, count * (band + 1) / bands);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+}
+
+static void *pool_thread(void *data) {
+	struct worker_pool *pool = data;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->quit) {
+		pool_run_bands(pool);
+		if (!pool->quit) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void pool_start(struct worker_pool *pool) {
+	pool->started = true;
+
+	// The calling thread processes a band as well
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t count = cpus > 1 ? MIN((uint32_t)cpus, WORKER_POOL_MAX_THREADS) - 1 : 0;
+
+	// Signals are handled by the main loop
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (uint32_t i = 0; i < count; i++) {
+		if (pthread_create(&pool->threads[i], NULL, pool_thread, pool) != 0) {
+			break;
+		}
+		pool->thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void xdpw_worker_pool_run(xdpw_worker_func func, void *data, uint32_t count, uint64_t cost) {
+	if (cost >= WORKER_POOL_MIN_COST && !pool.started) {
+		pool_start(&pool);
+	}
+	if (cost < WORKER_POOL_MIN_COST || pool.thread_count == 0 || count < 2) {
+		func(data, 0, count);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.func = func;
+	pool.data = data;
+	pool.count = count;
+	pool.bands = MIN(pool.thread_count + 1, count);
+	pool.next_band = 0;
+	pool.pending = pool.bands;
+	pthread_cond_broadcast(&pool.work);
+
+	pool_run_bands(&pool);
+	while (pool.pending > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pool.func = NULL;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void xdpw_worker_pool_finish(void) {
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (uint32_t i = 0; i < pool.thread_count; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+	pool.thread_count = 0;
+}
@@ -0,0 +1,177 @@
+#include "capture_scheduler.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "xdpw.h"
+#include "logger.h"
+#include "timespec_util.h"
+#include "trace.h"
+
+#define DEFAULT_REFRESH_RATE 60.0
+#define BANDWIDTH_UNIT (1024.0 * 1024.0)
+
+static uint64_t scheduler_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * TIMESPEC_NSEC_PER_SEC + now.tv_nsec;
+}
+
+static double output_refresh_rate(struct xdpw_wlr_output *output) {
+	return output->framerate > 0 ? output->framerate : DEFAULT_REFRESH_RATE;
+}
+
+// Captures per second the instance asks for, never more than the output
+// can produce
+static double desired_rate(struct xdpw_screencast_instance *cast) {
+	double refresh = output_refresh_rate(cast->capture_output);
+	if (cast->framerate > 0 && cast->framerate < refresh) {
+		return cast->framerate;
+	}
+	return refresh;
+}
+
+// Bytes copied by the compositor for every frame, unknown until the
+// capture session announced its buffer constraints
+static double frame_bytes(struct xdpw_screencast_instance *cast) {
+	return 4.0 * cast->current_constraints.width * cast->current_constraints.height;
+}
+
+static void scheduler_join(struct xdpw_screencast_instance *cast,
+		struct xdpw_wlr_output *output) {
+	if (cast->capture_output == output) {
+		return;
+	}
+	xdpw_capture_scheduler_leave(cast);
+	wl_list_insert(&output->capture_streams, &cast->capture_link);
+	cast->capture_output = output;
+	cast->capture_next_ns = 0;
+}
+
+// Shares the copy bandwidth of the output max-min fairly: instances which
+// ask for less than an equal share get all of it, the remaining bandwidth is
+// split equally between the others
+static void scheduler_update_shares(struct xdpw_wlr_output *output) {
+	int limit = output->ctx->state->config->screencast_conf.max_capture_bandwidth;
+	double bandwidth = limit > 0 ? limit * BANDWIDTH_UNIT : 0;
+	int count = wl_list_length(&output->capture_streams);
+
+	double total = 0;
+	struct xdpw_screencast_instance *cast;
+	wl_list_for_each(cast, &output->capture_streams, capture_link) {
+		total += desired_rate(cast) * frame_bytes(cast);
+	}
+
+	double level = -1;
+	if (bandwidth > 0 && total > bandwidth) {
+		// Raise the level until the bandwidth is used up, every
+		// iteration settles at least one more instance
+		level = bandwidth / count;
+		for (int i = 0; i < count; i++) {
+			double settled = 0;
+			int unsettled = 0;
+			wl_list_for_each(cast, &output->capture_streams, capture_link) {
+				double demand = desired_rate(cast) * frame_bytes(cast);
+				if (demand < level) {
+					settled += demand;
+				} else {
+					unsettled++;
+				}
+			}
+			if (unsettled == 0) {
+				break;
+			}
+			double next = (bandwidth - settled) / unsettled;
+			if (next <= level) {
+				break;
+			}
+			level = next;
+		}
+	}
+
+	wl_list_for_each(cast, &output->capture_streams, capture_link) {
+		double rate = desired_rate(cast);
+		double bytes = frame_bytes(cast);
+		double demand = rate * bytes;
+		if (level >= 0 && demand > level && bytes > 0) {
+			demand = level;
+			rate = level / bytes;
+		}
+		cast->metrics.capture_rate = rate;
+		if (bandwidth > 0) {
+			cast->metrics.capture_share = demand / bandwidth;
+		} else if (total > 0) {
+			cast->metrics.capture_share = demand / total;
+		} else {
+			cast->metrics.capture_share = 1.0 / count;
+		}
+	}
+}
+
+uint64_t xdpw_capture_scheduler_delay(struct xdpw_screencast_instance *cast,
+		uint64_t min_delay_ns) {
+	struct xdpw_wlr_output *output = cast->target->type == MONITOR ? cast->target->output : NULL;
+	if (!output) {
+		// Windows and composites don't compete for the bandwidth of
+		// an output, the outputs of a composite are scheduled on
+		// their own
+		xdpw_capture_scheduler_leave(cast);
+		cast->metrics.capture_rate = cast->framerate;
+		cast->metrics.capture_share = 1.0;
+		return min_delay_ns;
+	}
+
+	scheduler_join(cast, output);
+	scheduler_update_shares(output);
+
+	uint64_t now = scheduler_now_ns();
+	uint64_t start = now + min_delay_ns;
+	// The granted rate might be lower than the one asked for
+	if (start < cast->capture_next_ns) {
+		start = cast->capture_next_ns;
+	}
+
+	// Spread the captures of the output over its refresh interval, so
+	// that they don't reach the compositor at once
+	int count = wl_list_length(&output->capture_streams);
+	if (count > 1) {
+		if (start < output->capture_next_ns) {
+			start = output->capture_next_ns;
+		}
+		output->capture_next_ns = start +
+			(uint64_t)(TIMESPEC_NSEC_PER_SEC / output_refresh_rate(output) / count);
+	}
+
+	double rate = cast->metrics.capture_rate;
+	if (rate > 0 && rate < desired_rate(cast)) {
+		cast->capture_next_ns = start + (uint64_t)(TIMESPEC_NSEC_PER_SEC / rate);
+	} else {
+		cast->capture_next_ns = 0;
+	}
+
+	uint64_t delay_ns = start - now;
+	if (delay_ns > min_delay_ns) {
+		logprint(TRACE, "scheduler: delaying capture on output %s by %"PRIu64" us "
+			"(%d streams, granted %0.2f fps)", output->name,
+			(delay_ns - min_delay_ns) / 1000, count, rate);
+	}
+	xdpw_trace_counter("scheduler_delay_us", (delay_ns - min_delay_ns) / 1000);
+	return delay_ns;
+}
+
+void xdpw_capture_scheduler_leave(struct xdpw_screencast_instance *cast) {
+	if (!cast->capture_output) {
+		return;
+	}
+	wl_list_remove(&cast->capture_link);
+	cast->capture_output = NULL;
+	cast->capture_next_ns = 0;
+}
+
+void xdpw_capture_scheduler_output_removed(struct xdpw_wlr_output *output) {
+	struct xdpw_screencast_instance *cast, *tmp;
+	wl_list_for_each_safe(cast, tmp, &output->capture_streams, capture_link) {
+		xdpw_capture_scheduler_leave(cast);
+	}
+}
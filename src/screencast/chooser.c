@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -119,6 +122,55 @@ static char *get_output_label(struct xdpw_wlr_output *output, enum xdpw_chooser_
 	}
 }
 
+// Composes every output into one stream, see composite.c
+#define ALL_OUTPUTS_LABEL "All outputs"
+
+static bool all_outputs_available(struct xdpw_screencast_context *ctx) {
+	return ctx->xdg_output_manager && wl_list_length(&ctx->output_list) > 1;
+}
+
+// Simple choosers like slurp select a region in layout coordinates:
+// "Region: <output> <x>,<y> <width>x<height>"
+#define REGION_LABEL_PREFIX "Region: "
+
+static bool parse_region_label(struct xdpw_screencast_context *ctx, const char *label,
+		struct xdpw_screencast_target *target) {
+	const char *name = label + strlen(REGION_LABEL_PREFIX);
+	const char *name_end = strchr(name, ' ');
+	if (!name_end) {
+		return false;
+	}
+	int x, y, width, height, end = 0;
+	if (sscanf(name_end, " %d,%d %dx%d%n", &x, &y, &width, &height, &end) != 4 ||
+			name_end[end] != '\0' || width <= 0 || height <= 0) {
+		return false;
+	}
+
+	struct xdpw_wlr_output *out;
+	wl_list_for_each(out, &ctx->output_list, link) {
+		if (!out->name || strlen(out->name) != (size_t)(name_end - name) ||
+				strncmp(out->name, name, name_end - name) != 0) {
+			continue;
+		}
+		// The region starts at the output if it was dragged across its edge
+		int32_t x1 = MAX(x - out->x, 0), y1 = MAX(y - out->y, 0);
+		int32_t x2 = x - out->x + width, y2 = y - out->y + height;
+		if (x2 <= x1 || y2 <= y1) {
+			return false;
+		}
+		struct xdpw_pixel_rect region = { .x = x1, .y = y1,
+			.width = x2 - x1, .height = y2 - y1 };
+		target->type = MONITOR;
+		target->output = out;
+		if (!xdpw_wlr_target_set_region(ctx, target, region)) {
+			target->output = NULL;
+			return false;
+		}
+		return true;
+	}
+	return false;
+}
+
 static char *get_toplevel_label(struct xdpw_toplevel *toplevel, enum xdpw_chooser_types chooser_type) {
 	if (chooser_type == XDPW_CHOOSER_DMENU) {
 		return format_str("Window: %s (%s)", toplevel->title, toplevel->identifier);
@@ -127,9 +179,61 @@ static char *get_toplevel_label(struct xdpw_toplevel *toplevel, enum xdpw_choose
 	}
 }
 
+static bool chooser_select(const struct xdpw_chooser *chooser,
+		struct xdpw_screencast_context *ctx, const char *selected_label,
+		struct xdpw_screencast_target *target, uint32_t type_mask) {
+	logprint(TRACE, "wlroots: chooser %s selects %s", chooser->cmd, selected_label);
+
+	if ((type_mask & MONITOR) && ctx->xdg_output_manager &&
+			strcmp(selected_label, ALL_OUTPUTS_LABEL) == 0) {
+		target->type = VIRTUAL;
+		return true;
+	} else if ((type_mask & MONITOR) && chooser->type == XDPW_CHOOSER_SIMPLE &&
+			strncmp(selected_label, REGION_LABEL_PREFIX, strlen(REGION_LABEL_PREFIX)) == 0) {
+		if (!parse_region_label(ctx, selected_label, target)) {
+			// Don't fall back to an output named like the region
+			logprint(ERROR, "wlroots: chooser %s selected invalid region: %s",
+				chooser->cmd, selected_label);
+			return false;
+		}
+		return true;
+	}
+
+	struct xdpw_wlr_output *out;
+	wl_list_for_each(out, &ctx->output_list, link) {
+		char *label = get_output_label(out, chooser->type);
+		bool found = strcmp(selected_label, label) == 0;
+		free(label);
+		if (!found && chooser->type == XDPW_CHOOSER_SIMPLE) {
+			// Compatibility with xdg-desktop-portal-wlr < v0.8.0
+			found = strcmp(selected_label, out->name) == 0;
+		}
+		if (found) {
+			target->type = MONITOR;
+			target->output = out;
+			return true;
+		}
+	}
+
+	struct xdpw_toplevel *toplevel;
+	wl_list_for_each(toplevel, &ctx->toplevels, link) {
+		char *label = get_toplevel_label(toplevel, chooser->type);
+		bool found = strcmp(selected_label, label) == 0;
+		free(label);
+		if (found) {
+			target->type = WINDOW;
+			target->toplevel = toplevel;
+			return true;
+		}
+	}
+
+	logprint(ERROR, "wlroots: chooser %s selected unknown target: %s", chooser->cmd, selected_label);
+	return false;
+}
+
 static bool wlr_chooser(const struct xdpw_chooser *chooser,
-		struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target,
-		uint32_t type_mask) {
+		struct xdpw_screencast_context *ctx, struct wl_array *targets,
+		uint32_t type_mask, bool multiple) {
 	logprint(DEBUG, "wlroots: chooser called");
 
 	FILE *chooser_in = NULL, *chooser_out = NULL;
@@ -142,6 +246,9 @@ static bool wlr_chooser(const struct xdpw_chooser *chooser,
 	switch (chooser->type) {
 	case XDPW_CHOOSER_DMENU:
 		if (type_mask & MONITOR) {
+			if (all_outputs_available(ctx)) {
+				fprintf(chooser_in, "%s\n", ALL_OUTPUTS_LABEL);
+			}
 			struct xdpw_wlr_output *out;
 			wl_list_for_each(out, &ctx->output_list, link) {
 				char *label = get_output_label(out, chooser->type);
@@ -168,56 +275,29 @@ static bool wlr_chooser(const struct xdpw_chooser *chooser,
 		return false;
 	}
 
-	char *selected_label = read_chooser_out(chooser_out);
-	fclose(chooser_out);
-	if (selected_label == NULL) {
-		return true;
-	}
-
-	logprint(TRACE, "wlroots: chooser %s selects %s", chooser->cmd, selected_label);
-
-	bool found = false;
-	struct xdpw_wlr_output *out;
-	wl_list_for_each(out, &ctx->output_list, link) {
-		char *label = get_output_label(out, chooser->type);
-		found = strcmp(selected_label, label) == 0;
-		free(label);
-		if (!found && chooser->type == XDPW_CHOOSER_SIMPLE) {
-			// Compatibility with xdg-desktop-portal-wlr < v0.8.0
-			found = strcmp(selected_label, out->name) == 0;
-		}
-		if (found) {
-			target->type = MONITOR;
-			target->output = out;
-			break;
-		}
-	}
-
-	struct xdpw_toplevel *toplevel;
-	wl_list_for_each(toplevel, &ctx->toplevels, link) {
-		if (found) {
-			break;
+	// Every line selects a source if the application accepts several
+	char *selected_label;
+	while ((selected_label = read_chooser_out(chooser_out)) != NULL) {
+		struct xdpw_screencast_target target = { 0 };
+		if (selected_label[0] != '\0' &&
+				chooser_select(chooser, ctx, selected_label, &target, type_mask)) {
+			struct xdpw_screencast_target *selected = wl_array_add(targets, sizeof(*selected));
+			if (selected) {
+				*selected = target;
+			}
 		}
-		char *label = get_toplevel_label(toplevel, chooser->type);
-		found = strcmp(selected_label, label) == 0;
-		free(label);
-		if (found) {
-			target->type = WINDOW;
-			target->toplevel = toplevel;
+		free(selected_label);
+		if (!multiple) {
 			break;
 		}
 	}
-
-	if (!found) {
-		logprint(ERROR, "wlroots: chooser %s selected unknown target: %s", chooser->cmd, selected_label);
-	}
-
-	free(selected_label);
+	fclose(chooser_out);
 
 	return true;
 }
 
-static bool wlr_chooser_default(struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target, uint32_t type_mask) {
+static bool wlr_chooser_default(struct xdpw_screencast_context *ctx, struct wl_array *targets,
+		uint32_t type_mask, bool multiple) {
 	logprint(DEBUG, "wlroots: chooser called");
 
 	const struct xdpw_chooser default_chooser[] = {
@@ -237,29 +317,38 @@ static bool wlr_chooser_default(struct xdpw_screencast_context *ctx, struct xdpw
 		if (chooser->type == XDPW_CHOOSER_SIMPLE && type_mask != MONITOR) {
 			continue;
 		}
-		ret = wlr_chooser(chooser, ctx, target, type_mask);
+		ret = wlr_chooser(chooser, ctx, targets, type_mask, multiple);
 		if (!ret) {
 			logprint(DEBUG, "wlroots: chooser %s failed. Trying next one.",
 					default_chooser[i].cmd);
 			continue;
 		}
-		return target->output || target->toplevel;
+		return targets->size > 0;
 	}
 	return false;
 }
 
-bool xdpw_wlr_target_chooser(struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target, uint32_t type_mask) {
+bool xdpw_wlr_target_chooser(struct xdpw_screencast_context *ctx, struct wl_array *targets,
+		uint32_t type_mask, bool multiple) {
 	switch (ctx->state->config->screencast_conf.chooser_type) {
 	case XDPW_CHOOSER_DEFAULT:
-		return wlr_chooser_default(ctx, target, type_mask);
-	case XDPW_CHOOSER_NONE:
-		target->type = MONITOR;
+		return wlr_chooser_default(ctx, targets, type_mask, multiple);
+	case XDPW_CHOOSER_NONE:;
+		struct xdpw_screencast_target *target = wl_array_add(targets, sizeof(*target));
+		if (!target) {
+			goto end;
+		}
+		*target = (struct xdpw_screencast_target){ .type = MONITOR };
 		if (ctx->state->config->screencast_conf.output_name) {
 			target->output = xdpw_wlr_output_find_by_name(&ctx->output_list, ctx->state->config->screencast_conf.output_name);
 		} else {
 			target->output = xdpw_wlr_output_first(&ctx->output_list);
 		}
-		return target->output != NULL;
+		if (!target->output) {
+			targets->size = 0;
+			goto end;
+		}
+		return true;
 	case XDPW_CHOOSER_DMENU:
 	case XDPW_CHOOSER_SIMPLE:;
 		if (!ctx->state->config->screencast_conf.chooser_cmd) {
@@ -271,12 +360,12 @@ bool xdpw_wlr_target_chooser(struct xdpw_screencast_context *ctx, struct xdpw_sc
 			ctx->state->config->screencast_conf.chooser_cmd
 		};
 		logprint(DEBUG, "wlroots: chooser %s (%d)", chooser.cmd, chooser.type);
-		bool ret = wlr_chooser(&chooser, ctx, target, type_mask);
+		bool ret = wlr_chooser(&chooser, ctx, targets, type_mask, multiple);
 		if (!ret) {
 			logprint(ERROR, "wlroots: chooser %s failed", chooser.cmd);
 			goto end;
 		}
-		return target->output || target->toplevel;
+		return targets->size > 0;
 	}
 end:
 	return false;
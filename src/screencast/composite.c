@@ -0,0 +1,757 @@
+#include "composite.h"
+
+#include <drm_fourcc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <xf86drm.h>
+
+#include "pipewire_screencast.h"
+#include "screencast.h"
+#include "wlr_screencast.h"
+#include "xdpw.h"
+#include "logger.h"
+#include "trace.h"
+
+// Composed frames have 4 bytes per pixel
+#define COMPOSITE_FORMAT DRM_FORMAT_XRGB8888
+
+// Damage collected before the regions are merged
+#define COMPOSITE_DAMAGE_REGION_COUNT 16
+
+static struct xdpw_composite_output *composite_find_output(struct xdpw_composite *composite,
+		struct xdpw_wlr_output *wlr_output) {
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		if (output->cast->target->output == wlr_output) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+static void composite_add_damage(struct xdpw_composite *composite, struct xdpw_pixel_rect rect) {
+	if (rect.width == 0 || rect.height == 0) {
+		return;
+	}
+	composite->damaged = true;
+
+	struct wl_array *frame_damage = &composite->cast->current_frame.damage;
+	struct xdpw_frame_damage damage = { .x = rect.x, .y = rect.y,
+		.width = rect.width, .height = rect.height };
+	if (frame_damage->size >= COMPOSITE_DAMAGE_REGION_COUNT * sizeof(damage)) {
+		// The last region grows to cover the rest
+		struct xdpw_frame_damage *last =
+			(struct xdpw_frame_damage *)((char *)frame_damage->data + frame_damage->size) - 1;
+		*last = merge_damage(last, &damage);
+		return;
+	}
+	struct xdpw_frame_damage *entry = wl_array_add(frame_damage, sizeof(*entry));
+	if (entry == NULL) {
+		// Without damage the whole frame is considered changed
+		frame_damage->size = 0;
+		return;
+	}
+	*entry = damage;
+}
+
+static bool transform_swaps_size(uint32_t transform) {
+	return (transform & WL_OUTPUT_TRANSFORM_90) != 0;
+}
+
+// Maps a pixel of the logical output of size w x h to the frame, which
+// the compositor transformed the way the output is
+static void transform_point(uint32_t transform, uint32_t w, uint32_t h,
+		uint32_t x, uint32_t y, int32_t *fx, int32_t *fy) {
+	if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+		x = w - 1 - x;
+	}
+	switch (transform & ~WL_OUTPUT_TRANSFORM_FLIPPED) {
+	case WL_OUTPUT_TRANSFORM_90:
+		*fx = y;
+		*fy = w - 1 - x;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		*fx = w - 1 - x;
+		*fy = h - 1 - y;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		*fx = h - 1 - y;
+		*fy = x;
+		break;
+	default:
+		*fx = x;
+		*fy = y;
+		break;
+	}
+}
+
+// Maps a rectangle of the frame to the logical output of size w x h
+static struct xdpw_pixel_rect untransform_rect(uint32_t transform, uint32_t w, uint32_t h,
+		struct xdpw_pixel_rect rect) {
+	struct xdpw_pixel_rect out = rect;
+	switch (transform & ~WL_OUTPUT_TRANSFORM_FLIPPED) {
+	case WL_OUTPUT_TRANSFORM_90:
+		out = (struct xdpw_pixel_rect){ .x = w - rect.y - rect.height, .y = rect.x,
+			.width = rect.height, .height = rect.width };
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		out.x = w - rect.x - rect.width;
+		out.y = h - rect.y - rect.height;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		out = (struct xdpw_pixel_rect){ .x = rect.y, .y = h - rect.x - rect.width,
+			.width = rect.height, .height = rect.width };
+		break;
+	default:
+		break;
+	}
+	if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+		out.x = w - out.x - out.width;
+	}
+	return out;
+}
+
+// Like composite_output_blit for outputs with a transform. The frame is
+// scaled first if needed, then every row of the composed frame is read
+// from a row or a column of the frame.
+static struct xdpw_pixel_rect composite_output_blit_transformed(struct xdpw_composite_output *output,
+		struct xdpw_buffer *staging, struct xdpw_pixel_rect rect) {
+	struct xdpw_buffer *src = output->buffer;
+	bool flip_y = output->cast->current_frame.y_invert;
+	uint32_t width = output->rect.width, height = output->rect.height;
+	uint32_t frame_width = transform_swaps_size(output->transform) ? height : width;
+	uint32_t frame_height = transform_swaps_size(output->transform) ? width : height;
+
+	// The frame the rows are read from, upright
+	const uint8_t *frame = src->data;
+	uint32_t frame_stride = src->stride[0];
+	if (output->scaling) {
+		struct xdpw_pixel_rect scaled;
+		xdpw_pixel_scale_map_rect(&output->scale, &rect, &scaled);
+		frame = output->scaled;
+		frame_stride = 4 * frame_width;
+		xdpw_pixel_scale_rect(&output->scale, output->scaled, frame_stride,
+			src->data, src->stride[0], &scaled, flip_y);
+		rect = scaled;
+		flip_y = false;
+		if (output->cast->current_frame.y_invert) {
+			rect.y = frame_height - rect.y - rect.height;
+		}
+	} else if (flip_y) {
+		rect.y = frame_height - rect.y - rect.height;
+	}
+
+	struct xdpw_pixel_rect dst = untransform_rect(output->transform, width, height, rect);
+	uint32_t stride = staging->stride[0];
+	for (uint32_t y = dst.y; y < dst.y + dst.height; y++) {
+		int32_t fx, fy, next_x, next_y;
+		transform_point(output->transform, width, height, dst.x, y, &fx, &fy);
+		transform_point(output->transform, width, height, dst.x + 1, y, &next_x, &next_y);
+		int32_t step_x = next_x - fx, step_y = next_y - fy;
+		uint32_t *row = (uint32_t *)((uint8_t *)staging->data +
+			(size_t)(output->rect.y + y) * stride) + output->rect.x + dst.x;
+		for (uint32_t x = 0; x < dst.width; x++) {
+			uint32_t frame_row = flip_y ? frame_height - 1 - fy : (uint32_t)fy;
+			memcpy(&row[x], frame + (size_t)frame_row * frame_stride + 4 * (size_t)fx, 4);
+			fx += step_x;
+			fy += step_y;
+		}
+	}
+
+	dst.x += output->rect.x;
+	dst.y += output->rect.y;
+	return dst;
+}
+
+// Copies a rectangle of the last frame of an output into the composed
+// frame and returns the region of the composed frame it covers
+static struct xdpw_pixel_rect composite_output_blit(struct xdpw_composite_output *output,
+		struct xdpw_buffer *staging, struct xdpw_pixel_rect rect) {
+	if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		return composite_output_blit_transformed(output, staging, rect);
+	}
+
+	struct xdpw_buffer *src = output->buffer;
+	bool flip_y = output->cast->current_frame.y_invert;
+	uint32_t stride = staging->stride[0];
+	uint8_t *origin = (uint8_t *)staging->data +
+		(size_t)output->rect.y * stride + 4 * (size_t)output->rect.x;
+
+	if (output->scaling) {
+		struct xdpw_pixel_rect scaled;
+		xdpw_pixel_scale_map_rect(&output->scale, &rect, &scaled);
+		if (!output->converting) {
+			xdpw_pixel_scale_rect(&output->scale, origin, stride,
+				src->data, src->stride[0], &scaled, flip_y);
+		} else {
+			// The conversion flips the scaled frame
+			uint32_t scaled_stride = 4 * output->rect.width;
+			xdpw_pixel_scale_rect(&output->scale, output->scaled, scaled_stride,
+				src->data, src->stride[0], &scaled, false);
+			uint8_t *planes[] = { origin };
+			xdpw_pixel_convert_rect(&output->convert, planes, &stride,
+				output->scaled, scaled_stride, scaled.x, scaled.y, scaled.width, scaled.height,
+				output->rect.width, output->rect.height, flip_y);
+		}
+		rect = scaled;
+	} else if (output->converting) {
+		uint8_t *planes[] = { origin };
+		xdpw_pixel_convert_rect(&output->convert, planes, &stride,
+			src->data, src->stride[0], rect.x, rect.y, rect.width, rect.height,
+			src->width, src->height, flip_y);
+	} else {
+		for (uint32_t row = rect.y; row < rect.y + rect.height; row++) {
+			uint32_t dst_row = flip_y ? src->height - 1 - row : row;
+			memcpy(origin + (size_t)dst_row * stride + 4 * (size_t)rect.x,
+				(uint8_t *)src->data + (size_t)row * src->stride[0] + 4 * (size_t)rect.x,
+				4 * (size_t)rect.width);
+		}
+	}
+
+	if (flip_y) {
+		rect.y = output->rect.height - rect.y - rect.height;
+	}
+	rect.x += output->rect.x;
+	rect.y += output->rect.y;
+	return rect;
+}
+
+// Draws the damage of the last frame of an output into the composed frame
+static void composite_output_draw(struct xdpw_composite_output *output,
+		struct xdpw_buffer *staging) {
+	struct xdpw_composite *composite = output->composite;
+	struct xdpw_buffer *buffer = output->buffer;
+	struct wl_array *frame_damage = &output->cast->current_frame.damage;
+	if (output->draw_full || frame_damage->size == 0) {
+		struct xdpw_pixel_rect full = { 0, 0, buffer->width, buffer->height };
+		composite_add_damage(composite, composite_output_blit(output, staging, full));
+		output->draw_full = false;
+		return;
+	}
+
+	struct xdpw_frame_damage *damage;
+	wl_array_for_each(damage, frame_damage) {
+		// Damage comes from the compositor, keep it inside of the buffer
+		struct xdpw_pixel_rect rect;
+		rect.x = MIN(damage->x, buffer->width);
+		rect.y = MIN(damage->y, buffer->height);
+		rect.width = MIN(damage->width, buffer->width - rect.x);
+		rect.height = MIN(damage->height, buffer->height - rect.y);
+		if (rect.width == 0 || rect.height == 0) {
+			continue;
+		}
+		composite_add_damage(composite, composite_output_blit(output, staging, rect));
+	}
+}
+
+// Returns the staging buffer if outputs can be drawn into it, after it
+// has been drawn from scratch if needed
+static struct xdpw_buffer *composite_staging(struct xdpw_composite *composite) {
+	struct xdpw_buffer *staging = composite->cast->staging_buffer;
+	if (!staging || !staging->data || staging->format != COMPOSITE_FORMAT ||
+			staging->width != composite->width || staging->height != composite->height) {
+		// The stream is renegotiated
+		return NULL;
+	}
+	if (!composite->redraw) {
+		return staging;
+	}
+	composite->redraw = false;
+
+	xdpw_trace_begin("composite_redraw");
+	memset(staging->data, 0, (size_t)staging->stride[0] * staging->height);
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		output->draw_full = true;
+		if (output->supported && output->has_frame) {
+			composite_output_draw(output, staging);
+		}
+	}
+	struct xdpw_pixel_rect full = { 0, 0, composite->width, composite->height };
+	composite_add_damage(composite, full);
+	xdpw_trace_end("composite_redraw");
+	return staging;
+}
+
+static void composite_output_destroy_buffer(struct xdpw_composite_output *output) {
+	struct xdpw_buffer *buffer = output->buffer;
+	if (!buffer) {
+		return;
+	}
+	xdpw_buffer_account(output->composite->cast, buffer, false);
+	wl_list_remove(&buffer->link);
+	xdpw_buffer_destroy(buffer);
+	output->buffer = NULL;
+	output->cast->current_frame.xdpw_buffer = NULL;
+	output->has_frame = false;
+}
+
+// Prefers formats which can be copied as they are
+static uint32_t composite_output_format(struct xdpw_composite_output *output) {
+	uint32_t fallback = DRM_FORMAT_INVALID;
+	struct xdpw_shm_format *fmt;
+	wl_array_for_each(fmt, &output->cast->current_constraints.shm_formats) {
+		if (xdpw_format_pw_from_drm_fourcc(fmt->fourcc) == SPA_VIDEO_FORMAT_UNKNOWN ||
+				(output->scaling && !xdpw_pixel_scale_supported(fmt->fourcc))) {
+			continue;
+		}
+		if (fmt->fourcc == COMPOSITE_FORMAT || fmt->fourcc == DRM_FORMAT_ARGB8888) {
+			output->converting = false;
+			return fmt->fourcc;
+		}
+		// Transformed frames are only copied
+		if (fallback == DRM_FORMAT_INVALID && output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+				xdpw_pixel_convert_init(&output->convert,
+				COMPOSITE_FORMAT, fmt->fourcc, XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED)) {
+			fallback = fmt->fourcc;
+		}
+	}
+	output->converting = fallback != DRM_FORMAT_INVALID;
+	return fallback;
+}
+
+// Frames of outputs with a scale are downscaled to the logical size,
+// frames of rotated or flipped outputs are transformed back
+static void composite_output_setup(struct xdpw_composite_output *output) {
+	struct xdpw_screencast_instance *cast = output->cast;
+	struct xdpw_buffer_constraints *constraints = &cast->current_constraints;
+	const char *name = cast->target->output->name;
+
+	output->dirty = false;
+	output->supported = false;
+	if (constraints->width == 0 || constraints->height == 0 ||
+			output->rect.width == 0 || output->rect.height == 0) {
+		return;
+	}
+
+	// The size of the logical output before it is transformed
+	output->transform = cast->target->output->transformation;
+	bool swap = transform_swaps_size(output->transform);
+	uint32_t width = swap ? output->rect.height : output->rect.width;
+	uint32_t height = swap ? output->rect.width : output->rect.height;
+
+	output->scaling = constraints->width != width || constraints->height != height;
+	if (output->scaling && !xdpw_pixel_scale_init(&output->scale,
+			constraints->width, constraints->height, width, height)) {
+		logprint(WARN, "composite: unable to scale output %s from %ux%u to %ux%u",
+			name, constraints->width, constraints->height, width, height);
+		return;
+	}
+
+	uint32_t format = composite_output_format(output);
+	if (format == DRM_FORMAT_INVALID) {
+		logprint(WARN, "composite: no usable shm format for output %s%s", name,
+			output->transform != WL_OUTPUT_TRANSFORM_NORMAL ? " with a transform" : "");
+		return;
+	}
+
+	struct xdpw_buffer *buffer = output->buffer;
+	if (!buffer || buffer->format != format ||
+			buffer->width != constraints->width || buffer->height != constraints->height) {
+		composite_output_destroy_buffer(output);
+		cast->pwr_format.format = xdpw_format_pw_from_drm_fourcc(format);
+		buffer = xdpw_buffer_create(cast, WL_SHM);
+		if (!buffer) {
+			logprint(ERROR, "composite: unable to create buffer for output %s", name);
+			return;
+		}
+		// The compositor has to copy the whole frame into a new buffer
+		struct xdpw_frame_damage *damage = wl_array_add(&buffer->damage, sizeof(*damage));
+		if (damage) {
+			*damage = (struct xdpw_frame_damage){ .x = 0, .y = 0,
+				.width = buffer->width, .height = buffer->height };
+		}
+		wl_list_insert(&cast->buffer_list, &buffer->link);
+		output->buffer = buffer;
+		cast->current_frame.xdpw_buffer = buffer;
+		xdpw_buffer_account(output->composite->cast, buffer, true);
+	}
+
+	free(output->scaled);
+	output->scaled = NULL;
+	if (output->scaling && (output->converting ||
+			output->transform != WL_OUTPUT_TRANSFORM_NORMAL)) {
+		output->scaled = malloc(4 * (size_t)output->rect.width * output->rect.height);
+		if (!output->scaled) {
+			logprint(ERROR, "composite: unable to allocate scaled frame for output %s", name);
+			return;
+		}
+	}
+
+	output->draw_full = true;
+	output->supported = true;
+
+	char *fmt_name = drmGetFormatName(format);
+	logprint(DEBUG, "composite: output %s at %u,%u (%ux%u) from %ux%u %s%s%s",
+		name, output->rect.x, output->rect.y, output->rect.width, output->rect.height,
+		buffer->width, buffer->height, fmt_name, output->scaling ? ", scaled" : "",
+		output->transform != WL_OUTPUT_TRANSFORM_NORMAL ? ", transformed" : "");
+	free(fmt_name);
+}
+
+static void composite_output_capture(struct xdpw_composite_output *output) {
+	if (output->capturing || !output->supported) {
+		return;
+	}
+	output->capturing = true;
+	xdpw_wlr_frame_capture(output->cast);
+}
+
+static void composite_output_destroy(struct xdpw_composite_output *output) {
+	struct xdpw_screencast_instance *cast = output->cast;
+	xdpw_destroy_timer(cast->capture_timer);
+	cast->capture_timer = NULL;
+	xdpw_wlr_session_close(cast);
+	composite_output_destroy_buffer(output);
+
+	wl_array_release(&cast->current_frame.damage);
+	xdpw_buffer_constraints_finish(&cast->current_constraints);
+	xdpw_buffer_constraints_finish(&cast->pending_constraints);
+	free(cast->target);
+	free(cast);
+
+	free(output->scaled);
+	wl_list_remove(&output->link);
+	free(output);
+}
+
+static struct xdpw_composite_output *composite_output_create(struct xdpw_composite *composite,
+		struct xdpw_wlr_output *wlr_output) {
+	struct xdpw_screencast_instance *parent = composite->cast;
+	struct xdpw_composite_output *output = calloc(1, sizeof(*output));
+	struct xdpw_screencast_instance *cast = calloc(1, sizeof(*cast));
+	struct xdpw_screencast_target *target = calloc(1, sizeof(*target));
+	if (!output || !cast || !target) {
+		logprint(ERROR, "composite: unable to allocate output %s", wlr_output->name);
+		free(output);
+		free(cast);
+		free(target);
+		return NULL;
+	}
+	target->type = MONITOR;
+	target->output = wlr_output;
+	target->with_cursor = parent->target->with_cursor;
+
+	cast->ctx = parent->ctx;
+	cast->target = target;
+	cast->node_id = SPA_ID_INVALID;
+	cast->pwr_stream_state = true;
+	cast->composite_output = output;
+	xdpw_buffer_constraints_init(&cast->current_constraints);
+	xdpw_buffer_constraints_init(&cast->pending_constraints);
+	wl_array_init(&cast->current_frame.damage);
+	wl_list_init(&cast->buffer_list);
+	wl_list_init(&cast->sources);
+	wl_list_init(&cast->link);
+
+	output->composite = composite;
+	output->cast = cast;
+	output->dirty = true;
+	wl_list_insert(composite->outputs.prev, &output->link);
+
+	logprint(INFO, "composite: adding output %s", wlr_output->name);
+	// The output keeps its place without a capture session, so that it
+	// isn't retried on every output change
+	int ret = xdpw_wlr_session_init(cast);
+	if (output->removed) {
+		composite_output_destroy(output);
+		return NULL;
+	}
+	cast->initialized = true;
+	if (ret < 0) {
+		logprint(ERROR, "composite: unable to capture output %s", wlr_output->name);
+		output->dirty = false;
+	}
+	return output;
+}
+
+// Lays the outputs out in the smallest rectangle which contains all of
+// them and renegotiates the stream if its size changed
+static void composite_layout(struct xdpw_composite *composite) {
+	struct xdpw_screencast_instance *cast = composite->cast;
+	int32_t x1 = INT32_MAX, y1 = INT32_MAX, x2 = INT32_MIN, y2 = INT32_MIN;
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		struct xdpw_wlr_output *wlr_output = output->cast->target->output;
+		if (wlr_output->width <= 0 || wlr_output->height <= 0) {
+			continue;
+		}
+		x1 = MIN(x1, wlr_output->x);
+		y1 = MIN(y1, wlr_output->y);
+		x2 = MAX(x2, wlr_output->x + wlr_output->width);
+		y2 = MAX(y2, wlr_output->y + wlr_output->height);
+	}
+	if (x1 >= x2 || y1 >= y2) {
+		// Keep the last layout until an output shows up
+		return;
+	}
+
+	wl_list_for_each(output, &composite->outputs, link) {
+		struct xdpw_wlr_output *wlr_output = output->cast->target->output;
+		struct xdpw_pixel_rect rect = { 0 };
+		if (wlr_output->width > 0 && wlr_output->height > 0) {
+			rect = (struct xdpw_pixel_rect){ .x = wlr_output->x - x1, .y = wlr_output->y - y1,
+				.width = wlr_output->width, .height = wlr_output->height };
+		}
+		if (memcmp(&rect, &output->rect, sizeof(rect)) != 0) {
+			output->rect = rect;
+			output->dirty = true;
+			composite->redraw = true;
+		}
+		if (output->dirty && !output->capturing) {
+			composite_output_setup(output);
+		}
+	}
+
+	uint32_t width = x2 - x1, height = y2 - y1;
+	if (composite->x == x1 && composite->y == y1 &&
+			composite->width == width && composite->height == height) {
+		return;
+	}
+	bool resized = composite->width != width || composite->height != height;
+	composite->x = x1;
+	composite->y = y1;
+	composite->width = width;
+	composite->height = height;
+	composite->redraw = true;
+	logprint(INFO, "composite: composing %d outputs into %ux%u at %d,%d",
+		wl_list_length(&composite->outputs), width, height, x1, y1);
+
+	if (resized) {
+		struct xdpw_buffer_constraints *constraints = &cast->pending_constraints;
+		constraints->width = width;
+		constraints->height = height;
+		struct xdpw_shm_format *fmt = wl_array_add(&constraints->shm_formats, sizeof(*fmt));
+		if (fmt) {
+			fmt->fourcc = COMPOSITE_FORMAT;
+			fmt->stride = 4 * width;
+		}
+		constraints->dirty = true;
+		xdpw_buffer_constraints_move(&cast->current_constraints, constraints);
+		pwr_update_stream_param(cast);
+	}
+	if (cast->initialized) {
+		// Position and size are part of the stream properties
+		xdpw_screencast_instance_streams_changed(cast);
+	}
+}
+
+static void composite_update(struct xdpw_composite *composite) {
+	struct xdpw_screencast_context *ctx = composite->cast->ctx;
+
+	// Setting up a capture session dispatches wayland events, which can
+	// change the output list, so it is walked again after every output
+	bool added = true;
+	while (added) {
+		added = false;
+		struct xdpw_wlr_output *wlr_output;
+		wl_list_for_each(wlr_output, &ctx->output_list, link) {
+			if (!wlr_output->name || !wlr_output->xdg_output ||
+					composite_find_output(composite, wlr_output)) {
+				continue;
+			}
+			added = composite_output_create(composite, wlr_output) != NULL;
+			break;
+		}
+	}
+	composite_layout(composite);
+}
+
+static void composite_update_timer(void *data) {
+	struct xdpw_composite *composite = data;
+	composite->update_timer = NULL;
+	composite_update(composite);
+}
+
+static void composite_queue_frame(struct xdpw_composite *composite) {
+	struct xdpw_screencast_instance *cast = composite->cast;
+	composite->waiting = false;
+	composite->damaged = false;
+	xdpw_trace_async_end("capture", (uintptr_t)cast);
+
+	cast->current_frame.completed = true;
+	cast->current_frame.y_invert = false;
+	cast->current_frame.transformation = WL_OUTPUT_TRANSFORM_NORMAL;
+	xdpw_pwr_enqueue_buffer(cast);
+	cast->current_frame.damage.size = 0;
+}
+
+int xdpw_composite_session_init(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite *composite = cast->composite;
+	if (!composite) {
+		composite = calloc(1, sizeof(*composite));
+		if (!composite) {
+			logprint(ERROR, "composite: unable to allocate composite");
+			return -1;
+		}
+		composite->cast = cast;
+		composite->redraw = true;
+		wl_list_init(&composite->outputs);
+		cast->composite = composite;
+	}
+
+	composite_update(composite);
+	if (composite->width == 0 || composite->height == 0) {
+		logprint(ERROR, "composite: no outputs to compose");
+		return -1;
+	}
+	return 0;
+}
+
+void xdpw_composite_session_close(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite *composite = cast->composite;
+	if (!composite) {
+		return;
+	}
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		xdpw_destroy_timer(output->cast->capture_timer);
+		output->cast->capture_timer = NULL;
+		xdpw_wlr_session_close(output->cast);
+		output->capturing = false;
+	}
+	composite->waiting = false;
+}
+
+void xdpw_composite_destroy(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite *composite = cast->composite;
+	if (!composite) {
+		return;
+	}
+	xdpw_destroy_timer(composite->update_timer);
+	struct xdpw_composite_output *output, *tmp;
+	wl_list_for_each_safe(output, tmp, &composite->outputs, link) {
+		composite_output_destroy(output);
+	}
+	free(composite);
+	cast->composite = NULL;
+}
+
+void xdpw_composite_frame_capture(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite *composite = cast->composite;
+	if (xdpw_frame_capture_buffer(cast) == NULL) {
+		logprint(ERROR, "composite: started frame without buffer");
+		return;
+	}
+
+	composite_staging(composite);
+	composite->waiting = true;
+	if (composite->damaged) {
+		// Outputs changed while the consumer held every buffer
+		composite_queue_frame(composite);
+		return;
+	}
+
+	// Outputs which are still busy with a frame keep waiting for damage
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		composite_output_capture(output);
+	}
+}
+
+uint64_t xdpw_composite_release_memory(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite *composite = cast->composite;
+	uint64_t released = 0;
+	struct xdpw_composite_output *output;
+	wl_list_for_each(output, &composite->outputs, link) {
+		if (output->buffer) {
+			released += xdpw_buffer_release_memory(output->buffer);
+		}
+		output->has_frame = false;
+	}
+	composite->redraw = true;
+	return released;
+}
+
+void xdpw_composite_output_frame_done(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite_output *output = cast->composite_output;
+	struct xdpw_composite *composite = output->composite;
+	output->capturing = false;
+
+	if (cast->current_frame.transformation != output->transform) {
+		// The output was rotated, the frame doesn't fit the setup
+		output->dirty = true;
+		output->has_frame = false;
+		composite->redraw = true;
+	} else if (cast->current_frame.completed && output->supported) {
+		output->has_frame = true;
+		composite->cast->current_frame.tv_sec = cast->current_frame.tv_sec;
+		composite->cast->current_frame.tv_nsec = cast->current_frame.tv_nsec;
+
+		xdpw_trace_begin("composite_output_draw");
+		struct xdpw_buffer *staging = composite_staging(composite);
+		if (staging) {
+			composite_output_draw(output, staging);
+		}
+		xdpw_trace_end("composite_output_draw");
+	}
+	cast->current_frame.completed = false;
+
+	if (output->dirty) {
+		composite_output_setup(output);
+	}
+
+	if (!composite->waiting || !composite->cast->current_frame.pw_buffer) {
+		return;
+	}
+	if (composite->damaged) {
+		composite_queue_frame(composite);
+	} else {
+		composite_output_capture(output);
+	}
+}
+
+void xdpw_composite_output_constraints_changed(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite_output *output = cast->composite_output;
+	logprint(DEBUG, "composite: buffer constraints of output %s changed",
+		cast->target->output->name);
+	output->dirty = true;
+	// The buffer might still be attached to a frame
+	if (cast->initialized && !output->capturing) {
+		composite_output_setup(output);
+	}
+}
+
+void xdpw_composite_output_failed(struct xdpw_screencast_instance *cast) {
+	struct xdpw_composite_output *output = cast->composite_output;
+	logprint(ERROR, "composite: giving up on output %s", cast->target->output->name);
+	xdpw_wlr_session_close(cast);
+	output->capturing = false;
+	output->supported = false;
+}
+
+void xdpw_composite_outputs_changed(struct xdpw_screencast_context *ctx) {
+	struct xdpw_screencast_instance *cast;
+	wl_list_for_each(cast, &ctx->screencast_instances, link) {
+		struct xdpw_composite *composite = cast->composite;
+		// Capture sessions can't be set up while wayland events are
+		// dispatched
+		if (composite && !composite->update_timer) {
+			composite->update_timer = xdpw_add_timer(ctx->state, 0,
+				composite_update_timer, composite);
+		}
+	}
+}
+
+void xdpw_composite_output_removed(struct xdpw_screencast_context *ctx,
+		struct xdpw_wlr_output *wlr_output) {
+	struct xdpw_screencast_instance *cast;
+	wl_list_for_each(cast, &ctx->screencast_instances, link) {
+		struct xdpw_composite *composite = cast->composite;
+		struct xdpw_composite_output *output =
+			composite ? composite_find_output(composite, wlr_output) : NULL;
+		if (!output) {
+			continue;
+		}
+		logprint(INFO, "composite: removing output %s", wlr_output->name);
+		if (!output->cast->initialized) {
+			output->removed = true;
+			continue;
+		}
+		composite_output_destroy(output);
+		composite->redraw = true;
+		composite_layout(composite);
+	}
+}
@@ -24,6 +24,7 @@
 #include "pipewire_screencast.h"
 #include "xdpw.h"
 #include "logger.h"
+#include "trace.h"
 
 static void ext_session_buffer_size(void *data,
 		struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1,
@@ -146,8 +147,14 @@ static void ext_session_stopped(void *data,
 		struct ext_image_copy_capture_session_v1 *ext_image_copy_capture_session_v1) {
 	struct xdpw_screencast_instance *cast = data;
 
-	xdpw_screencast_instance_destroy(cast);
 	logprint(TRACE, "ext: session_stopped handler");
+	if (cast->target->type == MONITOR) {
+		// The output might be gone for a moment (e.g. on hotplug),
+		// retry until it has been detached or the retries run out
+		xdpw_wlr_frame_failed(cast);
+		return;
+	}
+	xdpw_screencast_instance_destroy(cast);
 }
 
 static const struct ext_image_copy_capture_session_v1_listener ext_session_listener = {
@@ -200,6 +207,8 @@ static void ext_frame_ready(void *data,
 	struct xdpw_screencast_instance *cast = data;
 
 	logprint(TRACE, "ext: ready event handler");
+	xdpw_trace_async_end("capture", (uintptr_t)cast);
+	xdpw_trace_begin("ext_frame_ready");
 
 	if (cast->ext_session.frame) {
 		ext_image_copy_capture_frame_v1_destroy(cast->ext_session.frame);
@@ -207,13 +216,19 @@ static void ext_frame_ready(void *data,
 	}
 
 	struct xdpw_buffer *buffer = cast->current_frame.xdpw_buffer;
+	struct xdpw_buffer *capture_buffer = xdpw_frame_capture_buffer(cast);
 	cast->current_frame.completed = true;
+	cast->capture_failures = 0;
 	xdpw_pwr_enqueue_buffer(cast);
 	if (buffer) {
 		// Clear damage for the buffer that was just submitted
 		buffer->damage.size = 0;
 	}
+	if (capture_buffer) {
+		capture_buffer->damage.size = 0;
+	}
 	cast->current_frame.damage.size = 0;
+	xdpw_trace_end("ext_frame_ready");
 }
 
 static void ext_frame_failed(void *data,
@@ -221,6 +236,9 @@ static void ext_frame_failed(void *data,
 		uint32_t reason) {
 	struct xdpw_screencast_instance *cast = data;
 
+	xdpw_trace_async_end("capture", (uintptr_t)cast);
+	xdpw_trace_instant("ext_frame_failed");
+
 	if (cast->ext_session.frame) {
 		ext_image_copy_capture_frame_v1_destroy(cast->ext_session.frame);
 		cast->ext_session.frame = NULL;
@@ -229,7 +247,7 @@ static void ext_frame_failed(void *data,
 	switch (reason) {
 	case EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN:
 		logprint(ERROR, "ext: frame capture failed: unknown reason");
-		xdpw_screencast_instance_destroy(cast);
+		xdpw_wlr_frame_failed(cast);
 		return;
 	case EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS:
 		logprint(ERROR, "ext: frame capture failed: buffer constraint mismatch");
@@ -237,6 +255,10 @@ static void ext_frame_failed(void *data,
 		return;
 	case EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED:
 		logprint(INFO, "ext: frame capture failed: capture session stopped");
+		if (cast->target->type == MONITOR) {
+			// Handled by the stopped event of the session
+			return;
+		}
 		xdpw_screencast_instance_destroy(cast);
 		return;
 	default:
@@ -273,6 +295,9 @@ static int ext_register_session_cb(struct xdpw_screencast_instance *cast) {
 			cast->ctx->ext_foreign_toplevel_image_capture_source_manager,
 			cast->target->toplevel->handle);
 		break;
+	case VIRTUAL:
+		// Every output of a composite has its own session
+		return -1;
 	}
 	assert(source != NULL);
 
@@ -297,10 +322,12 @@ static void ext_register_frame_cb(struct xdpw_screencast_instance *cast) {
 	ext_image_copy_capture_frame_v1_add_listener(cast->ext_session.frame,
 			&ext_frame_listener, cast);
 
-	ext_image_copy_capture_frame_v1_attach_buffer(cast->ext_session.frame,
-			cast->current_frame.xdpw_buffer->buffer);
+	// Converted frames are copied into the staging buffer, which always
+	// holds the previous frame
+	struct xdpw_buffer *buffer = xdpw_frame_capture_buffer(cast);
+	ext_image_copy_capture_frame_v1_attach_buffer(cast->ext_session.frame, buffer->buffer);
 	struct xdpw_frame_damage *damage;
-	wl_array_for_each(damage, &cast->current_frame.xdpw_buffer->damage) {
+	wl_array_for_each(damage, &buffer->damage) {
 		ext_image_copy_capture_frame_v1_damage_buffer(
 				cast->ext_session.frame, damage->x, damage->y, damage->width, damage->height);
 	}
@@ -311,7 +338,7 @@ static void ext_register_frame_cb(struct xdpw_screencast_instance *cast) {
 
 void xdpw_ext_ic_frame_capture(struct xdpw_screencast_instance *cast) {
 	logprint(TRACE, "ext: start screencopy");
-	if (cast->current_frame.xdpw_buffer == NULL) {
+	if (xdpw_frame_capture_buffer(cast) == NULL) {
 		logprint(ERROR, "ext: started frame without buffer");
 		return;
 	}
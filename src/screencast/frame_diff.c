@@ -0,0 +1,401 @@
+#include "frame_diff.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "worker_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XDPW_DIFF_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define XDPW_DIFF_NEON
+#include <arm_neon.h>
+#endif
+
+#define TILE_SIZE XDPW_FRAME_DIFF_TILE_SIZE
+// Pixels with up to 8 bytes, e.g. 16 bits per channel
+#define DIFF_MAX_BPP 8
+// The rows of a tile are hashed in stripes of 4 64 bit lanes
+#define DIFF_STRIPE 32
+#define DIFF_MAX_STRIPES (TILE_SIZE * DIFF_MAX_BPP / DIFF_STRIPE)
+
+enum tile_state {
+	TILE_UNCHANGED = 0,
+	TILE_CHECK,
+	TILE_CHANGED,
+};
+
+/*
+ * The hash accumulates every 64 bit word of a stripe with a key which
+ * depends on its position in the row, similar to XXH3. Rows are mixed
+ * into the lanes in order, so moved content changes the hash.
+ */
+
+// The stripe s uses the keys diff_secret[s] to diff_secret[s + 3]
+static const uint64_t diff_secret[DIFF_MAX_STRIPES + 4] = {
+	0x852010116895cea8ULL, 0xb39cfd4b8abead78ULL,
+	0x1ddd2106dcae6e9fULL, 0x612b6cd52d39f5abULL,
+	0x4a21229039a40dfeULL, 0x39850d170772eaeaULL,
+	0x91959d9d1ddccf2dULL, 0x19a56746024115e4ULL,
+	0xc64235eb281cdb93ULL, 0xb05678128382b56eULL,
+	0x4d90437bfd4f6854ULL, 0xa24eb80db189e370ULL,
+	0x974b975360e09044ULL, 0xc41edca667b13551ULL,
+	0xab8755c5b0f9aafcULL, 0x5bb88633537c9792ULL,
+	0x56bcf77c12d465daULL, 0x4860f7d0d76e0b6fULL,
+	0x28b765989e022098ULL, 0x82d1d1701cacad0bULL,
+};
+
+static const uint64_t diff_seed[4] = {
+	0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL,
+	0x165667b19e3779f9ULL, 0x85ebca77c2b2ae63ULL,
+};
+
+#define DIFF_PRIME32 0x9e3779b1ULL
+#define DIFF_PRIME64 0x9e3779b185ebca87ULL
+
+typedef void (*hash_func)(uint64_t acc[4], const uint8_t *data, uint32_t stripes);
+
+static inline uint64_t load_u64(const uint8_t *data) {
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline void hash_stripe(uint64_t acc[4], const uint8_t *data, const uint64_t *key) {
+	uint64_t words[4];
+	for (int i = 0; i < 4; i++) {
+		words[i] = load_u64(data + 8 * i);
+	}
+	for (int i = 0; i < 4; i++) {
+		uint64_t word_key = words[i] ^ key[i];
+		acc[i] += (word_key & 0xffffffff) * (word_key >> 32);
+		acc[i] += words[i ^ 1];
+	}
+}
+
+static void hash_stripes_scalar(uint64_t acc[4], const uint8_t *data, uint32_t stripes) {
+	for (uint32_t s = 0; s < stripes; s++) {
+		hash_stripe(acc, data + (size_t)s * DIFF_STRIPE, diff_secret + s);
+	}
+}
+
+#ifdef XDPW_DIFF_X86
+__attribute__((target("sse2")))
+static inline __m128i accumulate_sse2(__m128i acc, __m128i words, __m128i key) {
+	__m128i word_key = _mm_xor_si128(words, key);
+	__m128i product = _mm_mul_epu32(word_key, _mm_srli_epi64(word_key, 32));
+	__m128i swapped = _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+	return _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+}
+
+__attribute__((target("sse2")))
+static void hash_stripes_sse2(uint64_t acc[4], const uint8_t *data, uint32_t stripes) {
+	__m128i acc0 = _mm_loadu_si128((const __m128i *)acc);
+	__m128i acc1 = _mm_loadu_si128((const __m128i *)(acc + 2));
+	for (uint32_t s = 0; s < stripes; s++) {
+		const uint8_t *stripe = data + (size_t)s * DIFF_STRIPE;
+		acc0 = accumulate_sse2(acc0, _mm_loadu_si128((const __m128i *)stripe),
+			_mm_loadu_si128((const __m128i *)(diff_secret + s)));
+		acc1 = accumulate_sse2(acc1, _mm_loadu_si128((const __m128i *)(stripe + 16)),
+			_mm_loadu_si128((const __m128i *)(diff_secret + s + 2)));
+	}
+	_mm_storeu_si128((__m128i *)acc, acc0);
+	_mm_storeu_si128((__m128i *)(acc + 2), acc1);
+}
+
+__attribute__((target("avx2")))
+static void hash_stripes_avx2(uint64_t acc[4], const uint8_t *data, uint32_t stripes) {
+	__m256i lanes = _mm256_loadu_si256((const __m256i *)acc);
+	for (uint32_t s = 0; s < stripes; s++) {
+		__m256i words = _mm256_loadu_si256((const __m256i *)(data + (size_t)s * DIFF_STRIPE));
+		__m256i word_key = _mm256_xor_si256(words,
+			_mm256_loadu_si256((const __m256i *)(diff_secret + s)));
+		__m256i product = _mm256_mul_epu32(word_key, _mm256_srli_epi64(word_key, 32));
+		__m256i swapped = _mm256_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2));
+		lanes = _mm256_add_epi64(lanes, _mm256_add_epi64(product, swapped));
+	}
+	_mm256_storeu_si256((__m256i *)acc, lanes);
+}
+#endif
+
+#ifdef XDPW_DIFF_NEON
+static inline uint64x2_t accumulate_neon(uint64x2_t acc, const uint8_t *data, const uint64_t *key) {
+	uint64x2_t words = vreinterpretq_u64_u8(vld1q_u8(data));
+	uint64x2_t word_key = veorq_u64(words, vld1q_u64(key));
+	uint64x2_t product = vmull_u32(vmovn_u64(word_key), vshrn_n_u64(word_key, 32));
+	return vaddq_u64(acc, vaddq_u64(product, vextq_u64(words, words, 1)));
+}
+
+static void hash_stripes_neon(uint64_t acc[4], const uint8_t *data, uint32_t stripes) {
+	uint64x2_t acc0 = vld1q_u64(acc);
+	uint64x2_t acc1 = vld1q_u64(acc + 2);
+	for (uint32_t s = 0; s < stripes; s++) {
+		const uint8_t *stripe = data + (size_t)s * DIFF_STRIPE;
+		acc0 = accumulate_neon(acc0, stripe, diff_secret + s);
+		acc1 = accumulate_neon(acc1, stripe + 16, diff_secret + s + 2);
+	}
+	vst1q_u64(acc, acc0);
+	vst1q_u64(acc + 2, acc1);
+}
+#endif
+
+static hash_func select_hash(void) {
+#if defined(XDPW_DIFF_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return hash_stripes_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return hash_stripes_sse2;
+	}
+#elif defined(XDPW_DIFF_NEON)
+	return hash_stripes_neon;
+#endif
+	return hash_stripes_scalar;
+}
+
+static hash_func get_hash(void) {
+	static hash_func hash = NULL;
+	if (hash == NULL) {
+		hash = select_hash();
+	}
+	return hash;
+}
+
+static void hash_row(hash_func hash, uint64_t acc[4], const uint8_t *data, size_t bytes) {
+	uint32_t stripes = bytes / DIFF_STRIPE;
+	hash(acc, data, stripes);
+	size_t rest = bytes - (size_t)stripes * DIFF_STRIPE;
+	if (rest > 0) {
+		uint8_t last[DIFF_STRIPE] = { 0 };
+		memcpy(last, data + (size_t)stripes * DIFF_STRIPE, rest);
+		hash_stripe(acc, last, diff_secret + stripes);
+	}
+
+	// Mixes the row into the lanes, so that the order of rows matters
+	for (int i = 0; i < 4; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= diff_seed[i];
+		acc[i] *= DIFF_PRIME32;
+	}
+}
+
+static uint64_t avalanche(uint64_t value) {
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+static uint64_t hash_finish(const uint64_t acc[4]) {
+	uint64_t hash = 0;
+	for (int i = 0; i < 4; i++) {
+		hash = (hash ^ avalanche(acc[i])) * DIFF_PRIME64;
+	}
+	return avalanche(hash);
+}
+
+void xdpw_frame_diff_finish(struct xdpw_frame_diff *diff) {
+	free(diff->hashes);
+	free(diff->tiles);
+	*diff = (struct xdpw_frame_diff){ 0 };
+}
+
+void xdpw_frame_diff_reset(struct xdpw_frame_diff *diff) {
+	diff->valid = false;
+}
+
+static bool frame_diff_resize(struct xdpw_frame_diff *diff,
+		uint32_t width, uint32_t height, uint32_t bpp) {
+	if (diff->hashes && diff->width == width && diff->height == height && diff->bpp == bpp) {
+		return true;
+	}
+
+	xdpw_frame_diff_finish(diff);
+	uint32_t tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t count = (size_t)tiles_x * tiles_y;
+	diff->hashes = calloc(count, sizeof(*diff->hashes));
+	diff->tiles = calloc(count, sizeof(*diff->tiles));
+	if (!diff->hashes || !diff->tiles) {
+		xdpw_frame_diff_finish(diff);
+		return false;
+	}
+	diff->width = width;
+	diff->height = height;
+	diff->bpp = bpp;
+	diff->tiles_x = tiles_x;
+	diff->tiles_y = tiles_y;
+	return true;
+}
+
+static void mark_rect(struct xdpw_frame_diff *diff, const struct xdpw_pixel_rect *rect) {
+	if (rect->x >= diff->width || rect->y >= diff->height ||
+			rect->width == 0 || rect->height == 0) {
+		return;
+	}
+	uint32_t x_end = MIN((uint64_t)rect->x + rect->width, diff->width);
+	uint32_t y_end = MIN((uint64_t)rect->y + rect->height, diff->height);
+	for (uint32_t ty = rect->y / TILE_SIZE; ty <= (y_end - 1) / TILE_SIZE; ty++) {
+		uint8_t *tiles = diff->tiles + (size_t)ty * diff->tiles_x;
+		for (uint32_t tx = rect->x / TILE_SIZE; tx <= (x_end - 1) / TILE_SIZE; tx++) {
+			tiles[tx] = TILE_CHECK;
+		}
+	}
+}
+
+// Rows of tiles are hashed in bands by the worker pool
+struct diff_job {
+	struct xdpw_frame_diff *diff;
+	const uint8_t *data;
+	uint32_t stride;
+	hash_func hash;
+};
+
+static void diff_tile_rows(void *data, uint32_t first, uint32_t last) {
+	const struct diff_job *job = data;
+	struct xdpw_frame_diff *diff = job->diff;
+	uint64_t (*acc)[4] = malloc(diff->tiles_x * sizeof(*acc));
+	if (acc == NULL) {
+		// Without hashes the tiles have to be considered changed
+		for (size_t i = (size_t)first * diff->tiles_x; i < (size_t)last * diff->tiles_x; i++) {
+			if (diff->tiles[i] == TILE_CHECK) {
+				diff->tiles[i] = TILE_CHANGED;
+				diff->hashes[i] = 0;
+			}
+		}
+		return;
+	}
+
+	for (uint32_t ty = first; ty < last; ty++) {
+		uint8_t *tiles = diff->tiles + (size_t)ty * diff->tiles_x;
+		uint64_t *hashes = diff->hashes + (size_t)ty * diff->tiles_x;
+		for (uint32_t tx = 0; tx < diff->tiles_x; tx++) {
+			memcpy(acc[tx], diff_seed, sizeof(diff_seed));
+		}
+
+		// Rows are read in order, one tile after another
+		uint32_t y_end = MIN((ty + 1) * TILE_SIZE, diff->height);
+		for (uint32_t y = ty * TILE_SIZE; y < y_end; y++) {
+			const uint8_t *row = job->data + (size_t)y * job->stride;
+			for (uint32_t tx = 0; tx < diff->tiles_x; tx++) {
+				if (tiles[tx] != TILE_CHECK) {
+					continue;
+				}
+				uint32_t x = tx * TILE_SIZE;
+				uint32_t width = MIN(TILE_SIZE, diff->width - x);
+				hash_row(job->hash, acc[tx], row + (size_t)x * diff->bpp,
+					(size_t)width * diff->bpp);
+			}
+		}
+
+		for (uint32_t tx = 0; tx < diff->tiles_x; tx++) {
+			if (tiles[tx] != TILE_CHECK) {
+				continue;
+			}
+			uint64_t hash = hash_finish(acc[tx]);
+			tiles[tx] = !diff->valid || hash != hashes[tx] ? TILE_CHANGED : TILE_UNCHANGED;
+			hashes[tx] = hash;
+		}
+	}
+	free(acc);
+}
+
+bool xdpw_frame_diff_update(struct xdpw_frame_diff *diff, const uint8_t *data,
+		uint32_t width, uint32_t height, uint32_t stride, uint32_t bpp,
+		const struct xdpw_pixel_rect *rects, uint32_t rect_count) {
+	if (width == 0 || height == 0 || bpp == 0 || bpp > DIFF_MAX_BPP) {
+		return false;
+	}
+	if (!frame_diff_resize(diff, width, height, bpp)) {
+		return false;
+	}
+
+	size_t count = (size_t)diff->tiles_x * diff->tiles_y;
+	if (!diff->valid || rect_count == 0) {
+		memset(diff->tiles, TILE_CHECK, count);
+	} else {
+		memset(diff->tiles, TILE_UNCHANGED, count);
+		for (uint32_t i = 0; i < rect_count; i++) {
+			mark_rect(diff, &rects[i]);
+		}
+	}
+
+	uint64_t checked = 0;
+	for (size_t i = 0; i < count; i++) {
+		checked += diff->tiles[i] == TILE_CHECK;
+	}
+
+	struct diff_job job = {
+		.diff = diff,
+		.data = data,
+		.stride = stride,
+		.hash = get_hash(),
+	};
+	xdpw_worker_pool_run(diff_tile_rows, &job, diff->tiles_y, checked * TILE_SIZE * TILE_SIZE);
+	diff->valid = true;
+	return true;
+}
+
+uint32_t xdpw_frame_diff_damage(const struct xdpw_frame_diff *diff,
+		struct xdpw_pixel_rect *rects, uint32_t max_rects) {
+	if (max_rects == 0) {
+		return 0;
+	}
+
+	uint32_t count = 0;
+	for (uint32_t ty = 0; ty < diff->tiles_y; ty++) {
+		const uint8_t *tiles = diff->tiles + (size_t)ty * diff->tiles_x;
+		uint32_t y = ty * TILE_SIZE;
+		uint32_t height = MIN(TILE_SIZE, diff->height - y);
+		uint32_t tx = 0;
+		while (tx < diff->tiles_x) {
+			if (tiles[tx] != TILE_CHANGED) {
+				tx++;
+				continue;
+			}
+			uint32_t start = tx;
+			while (tx < diff->tiles_x && tiles[tx] == TILE_CHANGED) {
+				tx++;
+			}
+			struct xdpw_pixel_rect run = {
+				.x = start * TILE_SIZE,
+				.y = y,
+				.width = MIN(tx * TILE_SIZE, diff->width) - start * TILE_SIZE,
+				.height = height,
+			};
+
+			// Runs of tiles are appended to a rectangle of the rows above
+			// if they span the same columns
+			bool merged = false;
+			for (uint32_t i = 0; i < count; i++) {
+				if (rects[i].x == run.x && rects[i].width == run.width &&
+						rects[i].y + rects[i].height == run.y) {
+					rects[i].height += run.height;
+					merged = true;
+					break;
+				}
+			}
+			if (merged) {
+				continue;
+			}
+			if (count < max_rects) {
+				rects[count++] = run;
+				continue;
+			}
+
+			struct xdpw_pixel_rect *rest = &rects[max_rects - 1];
+			uint32_t x_end = MAX(rest->x + rest->width, run.x + run.width);
+			uint32_t y_end = MAX(rest->y + rest->height, run.y + run.height);
+			rest->x = MIN(rest->x, run.x);
+			rest->y = MIN(rest->y, run.y);
+			rest->width = x_end - rest->x;
+			rest->height = y_end - rest->y;
+		}
+	}
+	return count;
+}
@@ -8,26 +8,45 @@
 #include <spa/param/video/format-utils.h>
 #include <spa/pod/dynamic.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <unistd.h>
 #include <assert.h>
 #include <libdrm/drm_fourcc.h>
+#include <xf86drm.h>
 
+#include "composite.h"
 #include "screencast.h"
 #include "wlr_screencast.h"
 #include "xdpw.h"
 #include "logger.h"
+#include "timespec_util.h"
+#include "trace.h"
 
 #define DAMAGE_REGION_COUNT 16
 
+#define METRICS_AVERAGE_WEIGHT 16
+
+// Damage a converted buffer collects before it is converted as a whole
+#define CONVERT_DAMAGE_REGION_COUNT 64
+
+#define RECONNECT_DELAY_NS 100000000ULL
+#define RECONNECT_DELAY_MAX_NS 10000000000ULL
+
+#define RING_ADAPT_PERIOD_NS 1000000000LL
+#define RING_SHRINK_PERIODS 10
+#define RING_SHRINK_PERIODS_MAX 640
+
 static struct spa_pod *build_buffer(struct spa_pod_builder *b, uint32_t blocks, uint32_t size,
-		uint32_t stride, uint32_t datatype) {
+		uint32_t stride, uint32_t datatype, uint32_t buffers, uint32_t max_buffers) {
 	assert(blocks > 0);
 	assert(datatype > 0);
+	assert(max_buffers >= XDPW_PWR_BUFFERS_MIN);
 	struct spa_pod_frame f[1];
 
 	spa_pod_builder_push_object(b, &f[0], SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers);
 	spa_pod_builder_add(b, SPA_PARAM_BUFFERS_buffers,
-			SPA_POD_CHOICE_RANGE_Int(XDPW_PWR_BUFFERS, XDPW_PWR_BUFFERS_MIN, 32), 0);
+			SPA_POD_CHOICE_RANGE_Int(MIN(MAX(buffers, XDPW_PWR_BUFFERS_MIN), max_buffers),
+				XDPW_PWR_BUFFERS_MIN, max_buffers), 0);
 	spa_pod_builder_add(b, SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(blocks), 0);
 	if (size > 0) {
 		spa_pod_builder_add(b, SPA_PARAM_BUFFERS_size, SPA_POD_Int(size), 0);
@@ -82,7 +101,9 @@ static struct spa_pod *fixate_format(struct spa_pod_builder *b, enum spa_video_f
 
 static struct spa_pod *build_format(struct spa_pod_builder *b, enum spa_video_format format,
 		uint32_t width, uint32_t height, uint32_t framerate,
-		uint64_t *modifiers, int modifier_count) {
+		uint64_t *modifiers, int modifier_count,
+		enum spa_video_color_matrix color_matrix, enum spa_video_color_range color_range,
+		bool scalable) {
 	struct spa_pod_frame f[2];
 	int i, c;
 
@@ -113,9 +134,26 @@ static struct spa_pod *build_format(struct spa_pod_builder *b, enum spa_video_fo
 		}
 		spa_pod_builder_pop(b, &f[1]);
 	}
-	spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
-		SPA_POD_Rectangle(&SPA_RECTANGLE(width, height)),
-		0);
+	/* colorimetry of converted yuv formats */
+	if (color_matrix != SPA_VIDEO_COLOR_MATRIX_UNKNOWN) {
+		spa_pod_builder_add(b, SPA_FORMAT_VIDEO_colorMatrix, SPA_POD_Id(color_matrix), 0);
+	}
+	if (color_range != SPA_VIDEO_COLOR_RANGE_UNKNOWN) {
+		spa_pod_builder_add(b, SPA_FORMAT_VIDEO_colorRange, SPA_POD_Id(color_range), 0);
+	}
+	/* size, shm frames can be downscaled */
+	if (scalable) {
+		spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
+			SPA_POD_CHOICE_RANGE_Rectangle(
+				&SPA_RECTANGLE(width, height),
+				&SPA_RECTANGLE(1, 1),
+				&SPA_RECTANGLE(width, height)),
+			0);
+	} else {
+		spa_pod_builder_add(b, SPA_FORMAT_VIDEO_size,
+			SPA_POD_Rectangle(&SPA_RECTANGLE(width, height)),
+			0);
+	}
 	// variable framerate
 	spa_pod_builder_add(b, SPA_FORMAT_VIDEO_framerate,
 		SPA_POD_Fraction(&SPA_FRACTION(0, 1)), 0);
@@ -152,8 +190,52 @@ static void add_pod(struct wl_array *params, const struct spa_pod *pod) {
 	}
 }
 
+// Scaled frames are converted, so the source has to be scalable as well
+static uint32_t find_conversion_source(struct xdpw_screencast_instance *cast, uint32_t format,
+		bool scalable) {
+	struct config_screencast *conf = &cast->ctx->state->config->screencast_conf;
+	struct xdpw_pixel_convert convert;
+	struct xdpw_shm_format *fmt;
+	wl_array_for_each(fmt, &cast->current_constraints.shm_formats) {
+		if (scalable && !xdpw_pixel_scale_supported(fmt->fourcc)) {
+			continue;
+		}
+		if (xdpw_pixel_convert_init(&convert, format, fmt->fourcc,
+				conf->yuv_matrix, conf->yuv_range)) {
+			return fmt->fourcc;
+		}
+	}
+	return DRM_FORMAT_INVALID;
+}
+
+static void build_conversion_formats(struct spa_pod_builder *builder,
+		struct xdpw_screencast_instance *cast, struct wl_array *params,
+		const uint32_t *targets, size_t target_count) {
+	struct config_screencast *conf = &cast->ctx->state->config->screencast_conf;
+	for (size_t i = 0; i < target_count; i++) {
+		if (xdpw_find_shm_format(&cast->current_constraints, targets[i]) != NULL ||
+				find_conversion_source(cast, targets[i], false) == DRM_FORMAT_INVALID) {
+			continue;
+		}
+		bool scalable = conf->shm_scaling &&
+			find_conversion_source(cast, targets[i], true) != DRM_FORMAT_INVALID;
+		enum spa_video_color_matrix color_matrix = SPA_VIDEO_COLOR_MATRIX_UNKNOWN;
+		enum spa_video_color_range color_range = SPA_VIDEO_COLOR_RANGE_UNKNOWN;
+		if (xdpw_pixel_convert_is_yuv(targets[i])) {
+			color_matrix = conf->yuv_matrix == XDPW_YUV_MATRIX_BT601 ?
+				SPA_VIDEO_COLOR_MATRIX_BT601 : SPA_VIDEO_COLOR_MATRIX_BT709;
+			color_range = conf->yuv_range == XDPW_YUV_RANGE_FULL ?
+				SPA_VIDEO_COLOR_RANGE_0_255 : SPA_VIDEO_COLOR_RANGE_16_235;
+		}
+		add_pod(params, build_format(builder, xdpw_format_pw_from_drm_fourcc(targets[i]),
+					cast->current_constraints.width, cast->current_constraints.height,
+					cast->framerate, NULL, 0, color_matrix, color_range, scalable));
+	}
+}
+
 static void build_formats(struct spa_pod_builder *builder, struct xdpw_screencast_instance *cast,
 		struct wl_array *params) {
+	struct config_screencast *conf = &cast->ctx->state->config->screencast_conf;
 	if (!cast->avoid_dmabufs) {
 		uint32_t last_format = DRM_FORMAT_INVALID;
 		struct xdpw_format_modifier_pair *fm_pair;
@@ -173,21 +255,40 @@ static void build_formats(struct spa_pod_builder *builder, struct xdpw_screencas
 			if (modifier_count > 0) {
 				add_pod(params, build_format(builder, pw_format,
 						cast->current_constraints.width, cast->current_constraints.height,
-						cast->framerate, modifiers, modifier_count));
+						cast->framerate, modifiers, modifier_count,
+						SPA_VIDEO_COLOR_MATRIX_UNKNOWN, SPA_VIDEO_COLOR_RANGE_UNKNOWN, false));
 			}
 			free(modifiers);
 		}
 	}
 
-	uint32_t *format;
-	wl_array_for_each(format, &cast->current_constraints.shm_formats) {
-		enum spa_video_format pw_format = xdpw_format_pw_from_drm_fourcc(*format);
+	size_t target_count;
+	const uint32_t *targets;
+	if (conf->shm_yuv_conversion) {
+		// YUV 4:2:0 frames are less than half the size of RGB frames, so
+		// they are preferred over the shm formats of the compositor
+		targets = xdpw_pixel_convert_yuv_targets(&target_count);
+		build_conversion_formats(builder, cast, params, targets, target_count);
+	}
+
+	struct xdpw_shm_format *fmt;
+	wl_array_for_each(fmt, &cast->current_constraints.shm_formats) {
+		enum spa_video_format pw_format = xdpw_format_pw_from_drm_fourcc(fmt->fourcc);
 		if (pw_format != SPA_VIDEO_FORMAT_UNKNOWN) {
 			add_pod(params, build_format(builder, pw_format,
 						cast->current_constraints.width, cast->current_constraints.height,
-						cast->framerate, NULL, 0));
+						cast->framerate, NULL, 0,
+						SPA_VIDEO_COLOR_MATRIX_UNKNOWN, SPA_VIDEO_COLOR_RANGE_UNKNOWN,
+						conf->shm_scaling && xdpw_pixel_scale_supported(fmt->fourcc)));
 		}
 	}
+
+	if (conf->shm_conversion) {
+		// Formats which are converted from the shm formats of the compositor
+		// come last, so that consumers prefer the ones which are offered directly
+		targets = xdpw_pixel_convert_targets(&target_count);
+		build_conversion_formats(builder, cast, params, targets, target_count);
+	}
 }
 
 static bool has_drm_fourcc(struct xdpw_screencast_instance *cast, uint32_t format) {
@@ -205,24 +306,359 @@ static bool has_drm_fourcc(struct xdpw_screencast_instance *cast, uint32_t forma
 	return false;
 }
 
+static void metrics_average(uint64_t *average, int64_t sample) {
+	if (sample < 0) {
+		return;
+	}
+	if (*average == 0) {
+		*average = sample;
+	} else {
+		*average = *average - *average / METRICS_AVERAGE_WEIGHT + sample / METRICS_AVERAGE_WEIGHT;
+	}
+}
+
+static double frame_damage_ratio(struct xdpw_screencast_instance *cast) {
+	struct xdpw_buffer *buffer = cast->current_frame.xdpw_buffer;
+	uint64_t frame_area = (uint64_t)buffer->width * buffer->height;
+	if (frame_area == 0 || cast->current_frame.damage.size == 0) {
+		// Without damage the whole frame has to be considered changed
+		return 1.0;
+	}
+
+	uint64_t damage_area = 0;
+	struct xdpw_frame_damage *fdamage;
+	wl_array_for_each(fdamage, &cast->current_frame.damage) {
+		damage_area += (uint64_t)fdamage->width * fdamage->height;
+	}
+	return damage_area >= frame_area ? 1.0 : (double)damage_area / frame_area;
+}
+
+// Damage comes from the compositor, keep it inside of the staging buffer
+static struct xdpw_pixel_rect pwr_staging_rect(struct xdpw_screencast_instance *cast,
+		struct xdpw_frame_damage *damage) {
+	struct xdpw_buffer *staging = cast->staging_buffer;
+	struct xdpw_pixel_rect rect;
+	rect.x = MIN(damage->x, staging->width);
+	rect.y = MIN(damage->y, staging->height);
+	rect.width = MIN(damage->width, staging->width - rect.x);
+	rect.height = MIN(damage->height, staging->height - rect.y);
+	return rect;
+}
+
+static void pwr_convert_rect(struct xdpw_screencast_instance *cast, struct xdpw_buffer *buffer,
+		struct xdpw_frame_damage *damage, bool flip_y) {
+	struct xdpw_buffer *src = cast->staging_buffer;
+	struct xdpw_pixel_rect rect = pwr_staging_rect(cast, damage);
+	if (rect.width == 0 || rect.height == 0) {
+		return;
+	}
+
+	if (cast->scaling) {
+		struct xdpw_pixel_rect scaled;
+		xdpw_pixel_scale_map_rect(&cast->scale, &rect, &scaled);
+		if (!cast->converting) {
+			xdpw_pixel_scale_rect(&cast->scale, buffer->data, buffer->stride[0],
+				src->data, src->stride[0], &scaled, flip_y);
+			return;
+		}
+		// The conversion flips the scaled frame
+		xdpw_pixel_scale_rect(&cast->scale, cast->scaled_buffer->data,
+			cast->scaled_buffer->stride[0], src->data, src->stride[0], &scaled, false);
+		src = cast->scaled_buffer;
+		rect = scaled;
+	} else if (!cast->converting) {
+		// Composed frames only need to be copied
+		for (uint32_t row = rect.y; row < rect.y + rect.height; row++) {
+			uint32_t dst_row = flip_y ? buffer->height - 1 - row : row;
+			memcpy((uint8_t *)buffer->data + (size_t)dst_row * buffer->stride[0] + 4 * (size_t)rect.x,
+				(uint8_t *)src->data + (size_t)row * src->stride[0] + 4 * (size_t)rect.x,
+				4 * (size_t)rect.width);
+		}
+		return;
+	}
+
+	uint8_t *planes[XDPW_PIXEL_CONVERT_MAX_PLANES];
+	for (int plane = 0; plane < buffer->plane_count; plane++) {
+		planes[plane] = (uint8_t *)buffer->data + buffer->offset[plane];
+	}
+	xdpw_pixel_convert_rect(&cast->convert, planes, buffer->stride,
+		src->data, src->stride[0], rect.x, rect.y, rect.width, rect.height,
+		buffer->width, buffer->height, flip_y);
+}
+
+// Frame damage is reported to the consumer in the coordinates of the
+// scaled frame
+static void pwr_scale_frame_damage(struct xdpw_screencast_instance *cast) {
+	struct xdpw_frame_damage *damage;
+	wl_array_for_each(damage, &cast->current_frame.damage) {
+		struct xdpw_pixel_rect rect = pwr_staging_rect(cast, damage);
+		struct xdpw_pixel_rect scaled;
+		xdpw_pixel_scale_map_rect(&cast->scale, &rect, &scaled);
+		*damage = (struct xdpw_frame_damage){ .x = scaled.x, .y = scaled.y,
+			.width = scaled.width, .height = scaled.height };
+	}
+}
+
+static void pwr_invalidate_converted_buffers(struct xdpw_screencast_instance *cast) {
+	struct xdpw_buffer *buffer;
+	wl_list_for_each(buffer, &cast->buffer_list, link) {
+		buffer->convert_full = true;
+		buffer->convert_damage.size = 0;
+	}
+}
+
+static void pwr_convert_frame(struct xdpw_screencast_instance *cast, bool flip_y) {
+	struct xdpw_buffer *buffer = cast->current_frame.xdpw_buffer;
+	struct xdpw_buffer *staging = cast->staging_buffer;
+	uint32_t width = cast->scaling ? cast->scale.src_width : buffer->width;
+	uint32_t height = cast->scaling ? cast->scale.src_height : buffer->height;
+	if (!staging || staging->width != width || staging->height != height ||
+			(cast->scaling && cast->converting && !cast->scaled_buffer)) {
+		logprint(WARN, "pipewire: staging buffer doesn't match the frame");
+		return;
+	}
+
+	xdpw_trace_begin("pwr_convert_frame");
+
+	// Only the regions which changed since this buffer was queued last
+	// need to be converted
+	struct wl_array *frame_damage = &cast->current_frame.damage;
+	bool frame_full = frame_damage->size == 0;
+	struct xdpw_frame_damage *damage;
+	if (buffer->convert_full || frame_full) {
+		struct xdpw_frame_damage full = { 0, 0, staging->width, staging->height };
+		pwr_convert_rect(cast, buffer, &full, flip_y);
+	} else {
+		wl_array_for_each(damage, &buffer->convert_damage) {
+			pwr_convert_rect(cast, buffer, damage, flip_y);
+		}
+		wl_array_for_each(damage, frame_damage) {
+			pwr_convert_rect(cast, buffer, damage, flip_y);
+		}
+	}
+	buffer->convert_full = false;
+	buffer->convert_damage.size = 0;
+
+	// The other buffers miss the damage of this frame
+	struct xdpw_buffer *other;
+	wl_list_for_each(other, &cast->buffer_list, link) {
+		if (other == buffer || other->convert_full) {
+			continue;
+		}
+		void *dst = NULL;
+		if (!frame_full && other->convert_damage.size + frame_damage->size <=
+				CONVERT_DAMAGE_REGION_COUNT * sizeof(struct xdpw_frame_damage)) {
+			dst = wl_array_add(&other->convert_damage, frame_damage->size);
+		}
+		if (dst == NULL) {
+			other->convert_full = true;
+			other->convert_damage.size = 0;
+			continue;
+		}
+		memcpy(dst, frame_damage->data, frame_damage->size);
+	}
+
+	if (cast->scaling) {
+		pwr_scale_frame_damage(cast);
+	}
+
+	xdpw_trace_end("pwr_convert_frame");
+}
+
+// Replaces the frame damage with the tiles which actually changed.
+// Returns false if the frame is the same as the previous one.
+static bool pwr_detect_damage(struct xdpw_screencast_instance *cast) {
+	struct xdpw_buffer *buffer = xdpw_frame_capture_buffer(cast);
+	if (!buffer || buffer->buffer_type != WL_SHM || !buffer->data) {
+		return true;
+	}
+	int bpp = xdpw_bpp_from_drm_fourcc(buffer->format);
+	if (bpp <= 0) {
+		return true;
+	}
+
+	xdpw_trace_begin("pwr_detect_damage");
+
+	// Tiles outside of the damage reported by the compositor didn't change
+	struct wl_array *frame_damage = &cast->current_frame.damage;
+	struct xdpw_pixel_rect hints[CONVERT_DAMAGE_REGION_COUNT];
+	uint32_t hint_count = 0;
+	if (frame_damage->size <= sizeof(hints) / sizeof(hints[0]) * sizeof(struct xdpw_frame_damage)) {
+		struct xdpw_frame_damage *damage;
+		wl_array_for_each(damage, frame_damage) {
+			hints[hint_count++] = (struct xdpw_pixel_rect){ .x = damage->x, .y = damage->y,
+				.width = damage->width, .height = damage->height };
+		}
+	}
+
+	bool changed = true;
+	if (xdpw_frame_diff_update(&cast->frame_diff, buffer->data, buffer->width, buffer->height,
+			buffer->stride[0], bpp, hints, hint_count)) {
+		struct xdpw_pixel_rect rects[DAMAGE_REGION_COUNT];
+		uint32_t count = xdpw_frame_diff_damage(&cast->frame_diff, rects, DAMAGE_REGION_COUNT);
+		frame_damage->size = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			struct xdpw_frame_damage *damage = wl_array_add(frame_damage, sizeof(*damage));
+			if (damage == NULL) {
+				// Without damage the whole frame is considered changed
+				frame_damage->size = 0;
+				break;
+			}
+			*damage = (struct xdpw_frame_damage){ .x = rects[i].x, .y = rects[i].y,
+				.width = rects[i].width, .height = rects[i].height };
+		}
+		changed = count > 0;
+	}
+
+	xdpw_trace_end("pwr_detect_damage");
+	return changed;
+}
+
+static uint32_t pwr_ring_depth(struct xdpw_screencast_instance *cast) {
+	return cast->ring_depth > 0 ? cast->ring_depth : XDPW_PWR_BUFFERS;
+}
+
+static void pwr_ring_update_timer(void *data) {
+	struct xdpw_screencast_instance *cast = data;
+	cast->ring_timer = NULL;
+
+	if (cast->current_frame.pw_buffer) {
+		// Another frame started in the meantime
+		cast->ring_update_pending = true;
+		return;
+	}
+	logprint(DEBUG, "pipewire: renegotiating with %u buffers", cast->ring_depth);
+	pwr_update_stream_param(cast);
+}
+
+// Renegotiating drops the buffers of the stream, so it must not happen while
+// a frame is captured into one of them
+static void pwr_schedule_ring_update(struct xdpw_screencast_instance *cast) {
+	if (cast->current_frame.pw_buffer) {
+		cast->ring_update_pending = true;
+		return;
+	}
+	cast->ring_update_pending = false;
+	if (!cast->ring_timer) {
+		cast->ring_timer = xdpw_add_timer(cast->ctx->state, 0,
+			pwr_ring_update_timer, cast);
+	}
+}
+
+// Adapts the number of buffers asked for to the consumer, once per period.
+// A buffer comes back from the consumer some time after it was queued, but
+// pipewire doesn't tell when, only when it's dequeued again. While the
+// stream is out of buffers that happens as soon as the consumer returns it,
+// so the longest time away in a period with dequeue failures tells how long
+// the consumer holds buffers. In other periods it includes the time the
+// buffer sat unused, so the ring only shrinks after enough periods without
+// any dequeue failure. Every shrink which had to be undone doubles that
+// number of periods.
+static void pwr_adapt_ring_depth(struct xdpw_screencast_instance *cast) {
+	if (!cast->ctx->state->config->screencast_conf.adaptive_buffers) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_is_zero(&cast->ring_period_start)) {
+		cast->ring_period_start = now;
+		cast->ring_period_failures = cast->metrics.dequeue_failures;
+		cast->ring_max_hold_ns = 0;
+		return;
+	}
+	if (timespec_diff_ns(&now, &cast->ring_period_start) < RING_ADAPT_PERIOD_NS) {
+		return;
+	}
+
+	if (cast->ring_shrink_periods == 0) {
+		cast->ring_shrink_periods = RING_SHRINK_PERIODS;
+	}
+	uint32_t depth = pwr_ring_depth(cast);
+	uint32_t max_buffers = cast->max_buffers > 0 ? cast->max_buffers : XDPW_PWR_BUFFERS_MAX;
+	uint32_t target = depth;
+	uint64_t failures = cast->metrics.dequeue_failures - cast->ring_period_failures;
+	if (failures > 0) {
+		cast->ring_quiet_periods = 0;
+		uint64_t needed = depth + 1;
+		if (cast->framerate > 0) {
+			// One more buffer than the consumer holds at once, for
+			// the frame being captured
+			uint64_t held = ((uint64_t)cast->ring_max_hold_ns * cast->framerate +
+				TIMESPEC_NSEC_PER_SEC - 1) / TIMESPEC_NSEC_PER_SEC;
+			needed = MAX(needed, held + 1);
+		}
+		if (depth < max_buffers) {
+			target = MIN(needed, max_buffers);
+		}
+		if (cast->ring_shrunk) {
+			cast->ring_shrink_periods = MIN(cast->ring_shrink_periods * 2,
+				RING_SHRINK_PERIODS_MAX);
+			cast->ring_shrunk = false;
+		}
+	} else if (++cast->ring_quiet_periods >= cast->ring_shrink_periods &&
+			depth > XDPW_PWR_BUFFERS_MIN) {
+		cast->ring_quiet_periods = 0;
+		cast->ring_shrunk = true;
+		target = depth - 1;
+	}
+
+	if (target != depth) {
+		logprint(INFO, "pipewire: %s the buffer ring from %u to %u buffers "
+			"(%"PRIu64" dequeue failures, buffers held for up to %"PRId64" us)",
+			target > depth ? "growing" : "shrinking", depth, target,
+			failures, cast->ring_max_hold_ns / 1000);
+	}
+	cast->ring_period_start = now;
+	cast->ring_period_failures = cast->metrics.dequeue_failures;
+	cast->ring_max_hold_ns = 0;
+
+	if (target != depth) {
+		cast->ring_depth = target;
+		pwr_schedule_ring_update(cast);
+	}
+}
+
 static void xdpw_pwr_dequeue_buffer(struct xdpw_screencast_instance *cast) {
 	logprint(TRACE, "pipewire: dequeueing buffer");
 
 	assert(!cast->current_frame.pw_buffer);
 	if ((cast->current_frame.pw_buffer = pw_stream_dequeue_buffer(cast->stream)) == NULL) {
 		logprint(WARN, "pipewire: out of buffers");
+		cast->metrics.dequeue_failures++;
+		xdpw_trace_counter("dequeue_failures", cast->metrics.dequeue_failures);
+		pwr_adapt_ring_depth(cast);
 		return;
 	}
 
 	cast->current_frame.xdpw_buffer = cast->current_frame.pw_buffer->user_data;
 	cast->current_frame.completed = false;
+
+	struct xdpw_buffer *buffer = cast->current_frame.xdpw_buffer;
+	if (!timespec_is_zero(&buffer->queued_time)) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t hold_ns = timespec_diff_ns(&now, &buffer->queued_time);
+		metrics_average(&cast->metrics.buffer_cycle_ns, hold_ns);
+		cast->ring_max_hold_ns = MAX(cast->ring_max_hold_ns, hold_ns);
+		buffer->queued_time = (struct timespec){ 0 };
+	}
+	pwr_adapt_ring_depth(cast);
 }
 
 void xdpw_pwr_enqueue_buffer(struct xdpw_screencast_instance *cast) {
+	if (cast->composite_output) {
+		// The frame of an output is drawn into the composed frame
+		xdpw_composite_output_frame_done(cast);
+		return;
+	}
+
 	logprint(TRACE, "pipewire: enqueueing buffer");
+	xdpw_trace_begin("xdpw_pwr_enqueue_buffer");
 
 	if (!cast->current_frame.pw_buffer) {
 		logprint(WARN, "pipewire: no buffer to queue");
+		cast->metrics.frames_dropped++;
 		goto done;
 	}
 	struct pw_buffer *pw_buf = cast->current_frame.pw_buffer;
@@ -231,12 +667,50 @@ void xdpw_pwr_enqueue_buffer(struct xdpw_screencast_instance *cast) {
 
 	bool buffer_corrupt = !cast->current_frame.completed;
 
-	if (cast->current_frame.y_invert) {
-		//TODO: Flip buffer or set stride negative
-		xdpw_screencast_instance_destroy(cast);
+	if (buffer_corrupt) {
+		xdpw_frame_diff_reset(&cast->frame_diff);
+	} else if (cast->ctx->state->config->screencast_conf.shm_damage_detection &&
+			!pwr_detect_damage(cast)) {
+		// Nothing changed, the buffer is kept for the next frame
+		logprint(TRACE, "pipewire: frame unchanged, skipping");
+		cast->metrics.frames_skipped++;
+		cast->current_frame.completed = false;
+		cast->current_frame.damage.size = 0;
+		xdpw_trace_end("xdpw_pwr_enqueue_buffer");
+		xdpw_wlr_frame_capture(cast);
 		return;
 	}
 
+	struct xdpw_buffer *xdpw_buffer = cast->current_frame.xdpw_buffer;
+	uint32_t transformation = cast->current_frame.transformation;
+	struct spa_meta_videotransform *vt =
+		spa_buffer_find_meta_data(spa_buf, SPA_META_VideoTransform, sizeof(*vt));
+	if (xdpw_buffer->converted) {
+		if (buffer_corrupt) {
+			// The staging buffer might have been written partially
+			pwr_invalidate_converted_buffers(cast);
+		} else {
+			pwr_convert_frame(cast, cast->current_frame.y_invert && !vt);
+		}
+	}
+	if (cast->current_frame.y_invert && !buffer_corrupt) {
+		if (vt) {
+			// Let the consumer flip the buffer
+			transformation = xdpw_transform_flip_y(transformation);
+		} else if (xdpw_buffer->buffer_type == WL_SHM) {
+			if (!xdpw_buffer->converted) {
+				// Converted buffers are flipped by the conversion
+				xdpw_buffer_flip_y(xdpw_buffer);
+			}
+			struct xdpw_frame_damage *fdamage;
+			wl_array_for_each(fdamage, &cast->current_frame.damage) {
+				fdamage->y = xdpw_buffer->height - fdamage->y - fdamage->height;
+			}
+		} else {
+			logprint(WARN, "pipewire: unable to flip y-inverted dmabuf without transform meta");
+		}
+	}
+
 	logprint(TRACE, "********************");
 	struct spa_meta_header *h;
 	if ((h = spa_buffer_find_meta_data(spa_buf, SPA_META_Header, sizeof(*h)))) {
@@ -247,9 +721,8 @@ void xdpw_pwr_enqueue_buffer(struct xdpw_screencast_instance *cast) {
 		logprint(TRACE, "pipewire: timestamp %"PRId64, h->pts);
 	}
 
-	struct spa_meta_videotransform *vt;
-	if ((vt = spa_buffer_find_meta_data(spa_buf, SPA_META_VideoTransform, sizeof(*vt)))) {
-		vt->transform = cast->current_frame.transformation;
+	if (vt) {
+		vt->transform = transformation;
 		logprint(TRACE, "pipewire: transformation %u", vt->transform);
 	}
 
@@ -316,19 +789,41 @@ void xdpw_pwr_enqueue_buffer(struct xdpw_screencast_instance *cast) {
 		logprint(TRACE, "pipewire: offset %d", d[plane].chunk->offset);
 		logprint(TRACE, "pipewire: chunk flags %d", d[plane].chunk->flags);
 	}
-	logprint(TRACE, "pipewire: width %d", cast->current_frame.xdpw_buffer->width);
-	logprint(TRACE, "pipewire: height %d", cast->current_frame.xdpw_buffer->height);
+	logprint(TRACE, "pipewire: width %d", xdpw_buffer->width);
+	logprint(TRACE, "pipewire: height %d", xdpw_buffer->height);
 	logprint(TRACE, "pipewire: y_invert %d", cast->current_frame.y_invert);
 	logprint(TRACE, "********************");
 
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (buffer_corrupt) {
+		cast->metrics.frames_corrupt++;
+	} else {
+		cast->metrics.frames_delivered++;
+		metrics_average(&cast->metrics.capture_latency_ns,
+			timespec_diff_ns(&now, &cast->metrics.capture_start));
+		cast->metrics.damage_ratio += (frame_damage_ratio(cast) - cast->metrics.damage_ratio)
+			/ METRICS_AVERAGE_WEIGHT;
+	}
+	xdpw_buffer->queued_time = now;
+
 	pw_stream_queue_buffer(cast->stream, pw_buf);
 
 done:
 	cast->current_frame.xdpw_buffer = NULL;
 	cast->current_frame.pw_buffer = NULL;
+	if (cast->ring_update_pending) {
+		pwr_schedule_ring_update(cast);
+	}
+	xdpw_trace_end("xdpw_pwr_enqueue_buffer");
 }
 
 void pwr_update_stream_param(struct xdpw_screencast_instance *cast) {
+	if (cast->composite_output) {
+		xdpw_composite_output_constraints_changed(cast);
+		return;
+	}
+
 	logprint(TRACE, "pipewire: stream update parameters");
 	struct pw_stream *stream = cast->stream;
 	if (stream == NULL) {
@@ -347,15 +842,60 @@ void pwr_update_stream_param(struct xdpw_screencast_instance *cast) {
 	wl_array_release(&params);
 }
 
+static void pwr_release_memory(void *data) {
+	struct xdpw_screencast_instance *cast = data;
+	cast->release_timer = NULL;
+
+	logprint(DEBUG, "pipewire: stream is paused, releasing memory");
+
+	// The capture session is recreated with the next frame
+	xdpw_wlr_session_close(cast);
+
+	uint64_t released = 0;
+	struct xdpw_buffer *buffer;
+	wl_list_for_each(buffer, &cast->buffer_list, link) {
+		released += xdpw_buffer_release_memory(buffer);
+	}
+	if (cast->staging_buffer) {
+		released += xdpw_buffer_release_memory(cast->staging_buffer);
+	}
+	if (cast->scaled_buffer) {
+		released += xdpw_buffer_release_memory(cast->scaled_buffer);
+	}
+	if (cast->composite) {
+		released += xdpw_composite_release_memory(cast);
+	}
+	// The contents of the buffers are gone
+	xdpw_frame_diff_finish(&cast->frame_diff);
+	cast->metrics.released_bytes += released;
+
+	logprint(INFO, "pipewire: released %"PRIu64" KiB of buffer memory of a paused stream",
+		released / 1024);
+}
+
 static void pwr_handle_stream_state_changed(void *data,
 		enum pw_stream_state old, enum pw_stream_state state, const char *error) {
 	struct xdpw_screencast_instance *cast = data;
-	cast->node_id = pw_stream_get_node_id(cast->stream);
 
 	logprint(INFO, "pipewire: stream state changed to \"%s\"",
 		pw_stream_state_as_string(state));
+
+	uint32_t node_id = pw_stream_get_node_id(cast->stream);
+	if (node_id != SPA_ID_INVALID && node_id != cast->node_id) {
+		// The node id only changes after reconnecting to pipewire
+		bool changed = cast->node_id != SPA_ID_INVALID;
+		cast->node_id = node_id;
+		if (changed) {
+			xdpw_screencast_instance_streams_changed(cast);
+		}
+	}
 	logprint(INFO, "pipewire: node id is %d", (int)cast->node_id);
 
+	if (cast->release_timer) {
+		xdpw_destroy_timer(cast->release_timer);
+		cast->release_timer = NULL;
+	}
+
 	switch (state) {
 	case PW_STREAM_STATE_STREAMING:
 		cast->pwr_stream_state = true;
@@ -364,6 +904,11 @@ static void pwr_handle_stream_state_changed(void *data,
 		if (old == PW_STREAM_STATE_STREAMING) {
 			xdpw_pwr_enqueue_buffer(cast);
 		}
+		if (cast->ctx->state->config->screencast_conf.paused_release_timeout > 0) {
+			uint64_t timeout_ns = (uint64_t)cast->ctx->state->config->screencast_conf.paused_release_timeout
+				* TIMESPEC_NSEC_PER_SEC;
+			cast->release_timer = xdpw_add_timer(cast->ctx->state, timeout_ns, pwr_release_memory, cast);
+		}
 		// fall through
 	default:
 		cast->pwr_stream_state = false;
@@ -371,6 +916,144 @@ static void pwr_handle_stream_state_changed(void *data,
 	}
 }
 
+// Frames are captured into a staging buffer if they have to be converted
+// into the negotiated format or scaled to the negotiated size. Composed
+// frames are always drawn into the staging buffer.
+static void pwr_setup_conversion(struct xdpw_screencast_instance *cast) {
+	struct config_screencast *conf = &cast->ctx->state->config->screencast_conf;
+	uint32_t format = xdpw_format_drm_fourcc_from_pw_format(cast->pwr_format.format);
+	uint32_t width = cast->pwr_format.size.width;
+	uint32_t height = cast->pwr_format.size.height;
+
+	bool scale = width != cast->current_constraints.width ||
+		height != cast->current_constraints.height;
+	if (scale && (!conf->shm_scaling || !xdpw_pixel_scale_init(&cast->scale,
+			cast->current_constraints.width, cast->current_constraints.height,
+			width, height))) {
+		logprint(ERROR, "pipewire: unable to scale shm frames to %ux%u", width, height);
+		return;
+	}
+
+	uint32_t source = format;
+	if (xdpw_find_shm_format(&cast->current_constraints, format) == NULL) {
+		bool yuv = xdpw_pixel_convert_is_yuv(format);
+		if (!(yuv ? conf->shm_yuv_conversion : conf->shm_conversion)) {
+			return;
+		}
+		source = find_conversion_source(cast, format, scale);
+		if (source == DRM_FORMAT_INVALID ||
+				!xdpw_pixel_convert_init(&cast->convert, format, source,
+					conf->yuv_matrix, conf->yuv_range)) {
+			return;
+		}
+		cast->converting = true;
+
+		char *src_name = drmGetFormatName(source);
+		char *dst_name = drmGetFormatName(format);
+		logprint(INFO, "pipewire: converting shm frames from %s to %s (%s)",
+			src_name, dst_name, xdpw_pixel_convert_isa());
+		free(src_name);
+		free(dst_name);
+	} else if (scale && !xdpw_pixel_scale_supported(format)) {
+		logprint(ERROR, "pipewire: unable to scale shm format %u", format);
+		return;
+	}
+
+	if (scale) {
+		cast->scaling = true;
+		logprint(INFO, "pipewire: scaling shm frames from %ux%u to %ux%u (%s)",
+			cast->current_constraints.width, cast->current_constraints.height,
+			width, height, cast->scale.box ? "box" : "bilinear");
+	}
+	cast->staging_format = source;
+}
+
+static void pwr_destroy_buffer(struct xdpw_screencast_instance *cast, struct xdpw_buffer **buffer) {
+	if (!*buffer) {
+		return;
+	}
+	xdpw_buffer_account(cast, *buffer, false);
+	xdpw_buffer_destroy(*buffer);
+	*buffer = NULL;
+}
+
+static void pwr_destroy_staging_buffer(struct xdpw_screencast_instance *cast) {
+	pwr_destroy_buffer(cast, &cast->staging_buffer);
+	pwr_destroy_buffer(cast, &cast->scaled_buffer);
+}
+
+static bool pwr_ensure_staging_buffer(struct xdpw_screencast_instance *cast) {
+	struct xdpw_buffer *staging = cast->staging_buffer;
+	if (!staging || staging->format != cast->staging_format ||
+			staging->width != cast->current_constraints.width ||
+			staging->height != cast->current_constraints.height) {
+		pwr_destroy_buffer(cast, &cast->staging_buffer);
+		cast->staging_buffer = xdpw_staging_buffer_create(cast);
+		if (!cast->staging_buffer) {
+			return false;
+		}
+		xdpw_buffer_account(cast, cast->staging_buffer, true);
+		if (cast->composite) {
+			cast->composite->redraw = true;
+		}
+	}
+
+	// Scaled frames are only kept separately if they're converted afterwards
+	struct xdpw_buffer *scaled = cast->scaled_buffer;
+	if (!cast->scaling || !cast->converting) {
+		pwr_destroy_buffer(cast, &cast->scaled_buffer);
+	} else if (!scaled || scaled->format != cast->staging_format ||
+			scaled->width != cast->scale.dst_width ||
+			scaled->height != cast->scale.dst_height) {
+		pwr_destroy_buffer(cast, &cast->scaled_buffer);
+		cast->scaled_buffer = xdpw_scaled_buffer_create(cast);
+		if (!cast->scaled_buffer) {
+			return false;
+		}
+		xdpw_buffer_account(cast, cast->scaled_buffer, true);
+	}
+	return true;
+}
+
+// Estimates the size of a buffer in the negotiated format, YUV formats
+// have less than 2 bytes per pixel
+static uint64_t pwr_buffer_size(struct xdpw_screencast_instance *cast) {
+	int bpp = xdpw_bpp_from_drm_fourcc(
+		xdpw_format_drm_fourcc_from_pw_format(cast->pwr_format.format));
+	if (bpp <= 0) {
+		bpp = 2;
+	}
+	return (uint64_t)cast->pwr_format.size.width * cast->pwr_format.size.height * bpp;
+}
+
+// Limits the buffers of the stream so that the memory of every instance
+// stays within max_buffer_memory. The buffers the stream has now are
+// replaced by the negotiation, every stream gets the minimum.
+static uint32_t pwr_max_buffers(struct xdpw_screencast_instance *cast) {
+	int limit = cast->ctx->state->config->screencast_conf.max_buffer_memory;
+	uint64_t size = pwr_buffer_size(cast);
+	if (limit <= 0 || size == 0) {
+		return XDPW_PWR_BUFFERS_MAX;
+	}
+
+	uint64_t replaced = 0;
+	struct xdpw_buffer *buffer;
+	wl_list_for_each(buffer, &cast->buffer_list, link) {
+		replaced += xdpw_buffer_allocated_size(buffer);
+	}
+	uint64_t budget = (uint64_t)limit * 1024 * 1024;
+	uint64_t used = cast->ctx->allocated_bytes - replaced;
+	uint64_t count = budget > used ? (budget - used) / size : 0;
+
+	if (count < XDPW_PWR_BUFFERS_MIN) {
+		logprint(WARN, "pipewire: buffer memory budget of %d MiB is exhausted, "
+			"offering only %d buffers of %"PRIu64" KiB", limit, XDPW_PWR_BUFFERS_MIN,
+			size / 1024);
+		return XDPW_PWR_BUFFERS_MIN;
+	}
+	return MIN(count, XDPW_PWR_BUFFERS_MAX);
+}
+
 static void pwr_handle_stream_param_changed(void *data, uint32_t id,
 		const struct spa_pod *param) {
 	logprint(TRACE, "pipewire: stream parameters changed");
@@ -385,6 +1068,12 @@ static void pwr_handle_stream_param_changed(void *data, uint32_t id,
 	if (!param || id != SPA_PARAM_Format) {
 		return;
 	}
+	cast->metrics.renegotiations++;
+	// Dequeue failures while the buffers are replaced don't count
+	cast->ring_period_start = (struct timespec){ 0 };
+	cast->converting = false;
+	cast->scaling = false;
+	xdpw_frame_diff_reset(&cast->frame_diff);
 
 	wl_array_init(&params);
 
@@ -476,6 +1165,10 @@ fixate_format:
 		cast->buffer_type = WL_SHM;
 		blocks = 1;
 		data_type = 1<<SPA_DATA_MemFd;
+		pwr_setup_conversion(cast);
+		if (cast->converting) {
+			blocks = cast->convert.dst_planes;
+		}
 	}
 
 	logprint(DEBUG, "pipewire: Format negotiated:");
@@ -485,7 +1178,11 @@ fixate_format:
 	logprint(DEBUG, "pipewire: size: (%u, %u)", cast->pwr_format.size.width, cast->pwr_format.size.height);
 	logprint(DEBUG, "pipewire: max_framerate: (%u / %u)", cast->pwr_format.max_framerate.num, cast->pwr_format.max_framerate.denom);
 
-	add_pod(&params, build_buffer(&builder.b, blocks, 0, 0, data_type));
+	cast->max_buffers = pwr_max_buffers(cast);
+	logprint(DEBUG, "pipewire: max_buffers: %u", cast->max_buffers);
+
+	add_pod(&params, build_buffer(&builder.b, blocks, 0, 0, data_type,
+		pwr_ring_depth(cast), cast->max_buffers));
 
 	add_pod(&params, spa_pod_builder_add_object(&builder.b,
 		SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
@@ -538,6 +1235,12 @@ static void pwr_handle_stream_add_buffer(void *data, struct pw_buffer *buffer) {
 
 	logprint(TRACE, "pipewire: selected buffertype %u", t);
 
+	if ((cast->converting || cast->scaling || cast->composite) && !pwr_ensure_staging_buffer(cast)) {
+		logprint(ERROR, "pipewire: failed to create staging buffer");
+		xdpw_screencast_instance_destroy(cast);
+		return;
+	}
+
 	struct xdpw_buffer *xdpw_buffer = xdpw_buffer_create(cast, cast->buffer_type);
 	if (xdpw_buffer == NULL) {
 		logprint(ERROR, "pipewire: failed to create xdpw buffer");
@@ -546,11 +1249,16 @@ static void pwr_handle_stream_add_buffer(void *data, struct pw_buffer *buffer) {
 	}
 	wl_list_insert(&cast->buffer_list, &xdpw_buffer->link);
 	buffer->user_data = xdpw_buffer;
+	xdpw_buffer_account(cast, xdpw_buffer, true);
 
 	assert(xdpw_buffer->plane_count >= 0 && buffer->buffer->n_datas == (uint32_t)xdpw_buffer->plane_count);
 	for (uint32_t plane = 0; plane < buffer->buffer->n_datas; plane++) {
 		d[plane].type = t;
 		d[plane].maxsize = xdpw_buffer->size[plane];
+		if (t == SPA_DATA_MemFd) {
+			// The planes of shm buffers share one memfd
+			d[plane].maxsize += xdpw_buffer->offset[plane];
+		}
 		d[plane].mapoffset = 0;
 		d[plane].chunk->size = xdpw_buffer->size[plane];
 		d[plane].chunk->stride = xdpw_buffer->stride[plane];
@@ -573,9 +1281,13 @@ static void pwr_handle_stream_remove_buffer(void *data, struct pw_buffer *buffer
 
 	struct xdpw_buffer *xdpw_buffer = buffer->user_data;
 	if (xdpw_buffer) {
+		xdpw_buffer_account(cast, xdpw_buffer, false);
 		wl_list_remove(&xdpw_buffer->link);
 		xdpw_buffer_destroy(xdpw_buffer);
 	}
+	if (wl_list_empty(&cast->buffer_list)) {
+		pwr_destroy_staging_buffer(cast);
+	}
 	if (cast->current_frame.pw_buffer == buffer) {
 		cast->current_frame.pw_buffer = NULL;
 		cast->current_frame.xdpw_buffer = NULL;
@@ -601,12 +1313,14 @@ static void pwr_handle_stream_on_process(void *data) {
 		return;
 	}
 
+	xdpw_trace_begin("pwr_handle_stream_on_process");
 	xdpw_pwr_dequeue_buffer(cast);
 	if (!cast->current_frame.pw_buffer) {
 		logprint(WARN, "pipewire: unable to export buffer");
-		return;
+	} else {
+		xdpw_wlr_frame_capture(cast);
 	}
-	xdpw_wlr_frame_capture(cast);
+	xdpw_trace_end("pwr_handle_stream_on_process");
 }
 
 static const struct pw_stream_events pwr_stream_events = {
@@ -618,10 +1332,15 @@ static const struct pw_stream_events pwr_stream_events = {
 	.process = pwr_handle_stream_on_process,
 };
 
-void xdpw_pwr_stream_create(struct xdpw_screencast_instance *cast) {
+int xdpw_pwr_stream_create(struct xdpw_screencast_instance *cast) {
 	struct xdpw_screencast_context *ctx = cast->ctx;
 	struct xdpw_state *state = ctx->state;
 
+	if (!ctx->core) {
+		logprint(ERROR, "pipewire: not connected to core");
+		return -1;
+	}
+
 	pw_loop_enter(state->pw_loop);
 
 	uint8_t buffer[2 * 1024];
@@ -657,6 +1376,7 @@ void xdpw_pwr_stream_create(struct xdpw_screencast_instance *cast) {
 
 	spa_pod_dynamic_builder_clean(&builder);
 	wl_array_release(&params);
+	return 0;
 }
 
 void xdpw_pwr_stream_destroy(struct xdpw_screencast_instance *cast) {
@@ -669,14 +1389,66 @@ void xdpw_pwr_stream_destroy(struct xdpw_screencast_instance *cast) {
 	pw_stream_disconnect(cast->stream);
 	pw_stream_destroy(cast->stream);
 	cast->stream = NULL;
+	cast->pwr_stream_state = false;
+}
+
+static struct spa_hook core_listener;
+
+static void pwr_core_reconnect(void *data) {
+	struct xdpw_state *state = data;
+	struct xdpw_screencast_context *ctx = &state->screencast;
+	struct xdpw_screencast_instance *cast;
+
+	ctx->pwr_reconnect_timer = NULL;
+
+	if (ctx->core) {
+		logprint(DEBUG, "pipewire: dropping connection to core");
+		wl_list_for_each(cast, &ctx->screencast_instances, link) {
+			// Abort captures into buffers which are about to be destroyed
+			xdpw_wlr_session_close(cast);
+			xdpw_pwr_stream_destroy(cast);
+		}
+		spa_hook_remove(&core_listener);
+		pw_core_disconnect(ctx->core);
+		ctx->core = NULL;
+	}
+
+	if (xdpw_pwr_context_create(state) < 0) {
+		uint64_t delay_ns = RECONNECT_DELAY_NS << MIN(ctx->pwr_reconnect_attempts, 16u);
+		if (delay_ns > RECONNECT_DELAY_MAX_NS) {
+			delay_ns = RECONNECT_DELAY_MAX_NS;
+		}
+		ctx->pwr_reconnect_attempts++;
+		logprint(WARN, "pipewire: reconnecting in %"PRIu64" ms", delay_ns / 1000000);
+		ctx->pwr_reconnect_timer = xdpw_add_timer(state, delay_ns, pwr_core_reconnect, state);
+		return;
+	}
+
+	logprint(INFO, "pipewire: reconnected to core after %u attempts", ctx->pwr_reconnect_attempts + 1);
+	ctx->pwr_reconnect_attempts = 0;
+
+	wl_list_for_each(cast, &ctx->screencast_instances, link) {
+		if (cast->initialized) {
+			xdpw_pwr_stream_create(cast);
+		}
+	}
 }
 
 static void on_core_error(void *data, uint32_t id, int seq, int res, const char* message) {
-	// If our pipewire connection drops then we won't be able to actually
-	// do a screencast.  Exit the process so someone restarts us and the
-	// new xdpw can reconnect to pipewire.
-	logprint(ERROR, "pipewire: fatal error event from core");
-	exit(1);
+	struct xdpw_state *state = data;
+	struct xdpw_screencast_context *ctx = &state->screencast;
+
+	logprint(ERROR, "pipewire: error event from core: id %u, seq %d, %s (%s)",
+		id, seq, message, spa_strerror(res));
+
+	if (id != PW_ID_CORE || ctx->pwr_reconnect_timer) {
+		return;
+	}
+
+	// The connection to the pipewire daemon dropped (e.g. it was
+	// restarted). We must not destroy the core from within its own
+	// event, so reconnect from the event loop instead.
+	ctx->pwr_reconnect_timer = xdpw_add_timer(state, 0, pwr_core_reconnect, state);
 }
 
 static const struct pw_core_events core_events = {
@@ -684,8 +1456,6 @@ static const struct pw_core_events core_events = {
 	.error = on_core_error,
 };
 
-static struct spa_hook core_listener;
-
 int xdpw_pwr_context_create(struct xdpw_state *state) {
 	struct xdpw_screencast_context *ctx = &state->screencast;
 
@@ -719,7 +1489,13 @@ void xdpw_pwr_context_destroy(struct xdpw_state *state) {
 
 	logprint(DEBUG, "pipewire: disconnecting fom core");
 
+	if (ctx->pwr_reconnect_timer) {
+		xdpw_destroy_timer(ctx->pwr_reconnect_timer);
+		ctx->pwr_reconnect_timer = NULL;
+	}
+
 	if (ctx->core) {
+		spa_hook_remove(&core_listener);
 		pw_core_disconnect(ctx->core);
 		ctx->core = NULL;
 	}
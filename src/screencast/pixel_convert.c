@@ -0,0 +1,904 @@
+#include "pixel_convert.h"
+
+#include <assert.h>
+#include <string.h>
+#include <sys/param.h>
+#include <drm_fourcc.h>
+
+#include "worker_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XDPW_CONVERT_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define XDPW_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#define YUV_PLANE_ALIGN 16
+
+enum convert_isa {
+	ISA_UNKNOWN,
+	ISA_SCALAR,
+	ISA_SSE2,
+	ISA_SSSE3,
+	ISA_AVX2,
+	ISA_NEON,
+};
+
+struct format_layout {
+	uint32_t format;
+	uint32_t bpp;
+	// 10 bits per channel
+	bool deep;
+	// byte index of red, green and blue, or their bit offset for deep formats
+	uint8_t r, g, b;
+	// byte index of the alpha or padding byte of 32 bit formats
+	uint8_t x;
+};
+
+static const struct format_layout layouts[] = {
+	{ DRM_FORMAT_XRGB8888, 4, false, 2, 1, 0, 3 },
+	{ DRM_FORMAT_ARGB8888, 4, false, 2, 1, 0, 3 },
+	{ DRM_FORMAT_XBGR8888, 4, false, 0, 1, 2, 3 },
+	{ DRM_FORMAT_ABGR8888, 4, false, 0, 1, 2, 3 },
+	{ DRM_FORMAT_RGBX8888, 4, false, 3, 2, 1, 0 },
+	{ DRM_FORMAT_RGBA8888, 4, false, 3, 2, 1, 0 },
+	{ DRM_FORMAT_BGRX8888, 4, false, 1, 2, 3, 0 },
+	{ DRM_FORMAT_BGRA8888, 4, false, 1, 2, 3, 0 },
+	{ DRM_FORMAT_RGB888, 3, false, 2, 1, 0, 0 },
+	{ DRM_FORMAT_BGR888, 3, false, 0, 1, 2, 0 },
+	{ DRM_FORMAT_XRGB2101010, 4, true, 20, 10, 0, 0 },
+	{ DRM_FORMAT_ARGB2101010, 4, true, 20, 10, 0, 0 },
+	{ DRM_FORMAT_XBGR2101010, 4, true, 0, 10, 20, 0 },
+	{ DRM_FORMAT_ABGR2101010, 4, true, 0, 10, 20, 0 },
+	{ DRM_FORMAT_RGBX1010102, 4, true, 22, 12, 2, 0 },
+	{ DRM_FORMAT_RGBA1010102, 4, true, 22, 12, 2, 0 },
+	{ DRM_FORMAT_BGRX1010102, 4, true, 2, 12, 22, 0 },
+	{ DRM_FORMAT_BGRA1010102, 4, true, 2, 12, 22, 0 },
+};
+
+// Formats we can convert into. Alpha is dropped, so only opaque formats
+// are offered.
+static const uint32_t targets[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_RGBX8888,
+	DRM_FORMAT_BGRX8888,
+};
+
+static const uint32_t yuv_targets[] = {
+	DRM_FORMAT_NV12,
+	DRM_FORMAT_YUV420,
+};
+
+static const struct format_layout *find_layout(uint32_t format) {
+	for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+		if (layouts[i].format == format) {
+			return &layouts[i];
+		}
+	}
+	return NULL;
+}
+
+static bool is_target(uint32_t format) {
+	for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		if (targets[i] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool xdpw_pixel_convert_is_yuv(uint32_t format) {
+	for (size_t i = 0; i < sizeof(yuv_targets) / sizeof(yuv_targets[0]); i++) {
+		if (yuv_targets[i] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Scalar kernels, also used for the pixels left over by the vector kernels
+ */
+
+static void convert_row_shuffle_scalar(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	// The shuffle of the first pixel is the same for every pixel. The
+	// cleared byte is the one made opaque by fill.
+	const uint8_t *shuffle = conv->shuffle;
+	for (uint32_t i = 0; i < width; i++) {
+		for (int c = 0; c < 4; c++) {
+			dst[c] = (shuffle[c] & 0x80) ? 0xff : src[shuffle[c]];
+		}
+		src += conv->src_bpp;
+		dst += 4;
+	}
+}
+
+static inline uint32_t convert_pixel_10(const struct xdpw_pixel_convert *conv, uint32_t v) {
+	// Keep the 8 most significant bits of every channel
+	return (((v >> conv->src_shift[0]) & 0xff) << conv->dst_shift[0]) |
+		(((v >> conv->src_shift[1]) & 0xff) << conv->dst_shift[1]) |
+		(((v >> conv->src_shift[2]) & 0xff) << conv->dst_shift[2]) |
+		conv->fill;
+}
+
+static void convert_row_10_scalar(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	for (uint32_t i = 0; i < width; i++) {
+		uint32_t v;
+		memcpy(&v, src + 4 * i, sizeof(v));
+		v = convert_pixel_10(conv, v);
+		memcpy(dst + 4 * i, &v, sizeof(v));
+	}
+}
+
+static inline uint8_t clamp_u8(int32_t v) {
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline void load_rgb(const struct xdpw_pixel_convert *conv, const uint8_t *src, int32_t rgb[3]) {
+	uint32_t v;
+	memcpy(&v, src, sizeof(v));
+	for (int c = 0; c < 3; c++) {
+		rgb[c] = (v >> conv->src_shift[c]) & 0xff;
+	}
+}
+
+static inline int32_t dot_rgb(const int16_t coef[3], const int32_t rgb[3]) {
+	return coef[0] * rgb[0] + coef[1] * rgb[1] + coef[2] * rgb[2];
+}
+
+static inline uint8_t luma(const struct xdpw_pixel_convert *conv, const int32_t rgb[3]) {
+	return clamp_u8((dot_rgb(conv->y_coef, rgb) + conv->y_offset) >> 14);
+}
+
+static void convert_yuv_scalar(const struct xdpw_pixel_convert *conv,
+		uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		const uint8_t *src0, const uint8_t *src1, uint32_t width) {
+	for (uint32_t i = 0; i < width; i += 2) {
+		// The last column of an odd width is paired with itself
+		uint32_t j = i + 1 < width ? i + 1 : i;
+		int32_t px[4][3];
+		load_rgb(conv, src0 + 4 * i, px[0]);
+		load_rgb(conv, src0 + 4 * j, px[1]);
+		load_rgb(conv, src1 + 4 * i, px[2]);
+		load_rgb(conv, src1 + 4 * j, px[3]);
+
+		y0[i] = luma(conv, px[0]);
+		y0[j] = luma(conv, px[1]);
+		if (y1) {
+			y1[i] = luma(conv, px[2]);
+			y1[j] = luma(conv, px[3]);
+		}
+
+		int32_t sum[3];
+		for (int c = 0; c < 3; c++) {
+			sum[c] = px[0][c] + px[1][c] + px[2][c] + px[3][c];
+		}
+		uint8_t cb = clamp_u8((dot_rgb(conv->u_coef, sum) + conv->uv_offset) >> 16);
+		uint8_t cr = clamp_u8((dot_rgb(conv->v_coef, sum) + conv->uv_offset) >> 16);
+		if (v) {
+			u[i / 2] = cb;
+			v[i / 2] = cr;
+		} else {
+			u[i] = cb;
+			u[i + 1] = cr;
+		}
+	}
+}
+
+/*
+ * x86 kernels, selected at runtime
+ */
+
+#ifdef XDPW_CONVERT_X86
+__attribute__((target("ssse3")))
+static void convert_row_32_ssse3(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m128i shuffle = _mm_loadu_si128((const __m128i *)conv->shuffle);
+	__m128i fill = _mm_set1_epi32((int)conv->fill);
+	uint32_t i = 0;
+	for (; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+		v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), fill);
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+	}
+	convert_row_shuffle_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+__attribute__((target("ssse3")))
+static void convert_row_24_ssse3(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m128i shuffle = _mm_loadu_si128((const __m128i *)conv->shuffle);
+	__m128i fill = _mm_set1_epi32((int)conv->fill);
+	uint32_t i = 0;
+	// 4 pixels are 12 bytes, stop early enough to not read past the row
+	for (; i + 6 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+		v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), fill);
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+	}
+	convert_row_shuffle_scalar(conv, dst + 4 * i, src + 3 * i, width - i);
+}
+
+__attribute__((target("sse2")))
+static void convert_row_10_sse2(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m128i mask = _mm_set1_epi32(0xff);
+	__m128i fill = _mm_set1_epi32((int)conv->fill);
+	__m128i src_shift[3], dst_shift[3];
+	for (int c = 0; c < 3; c++) {
+		src_shift[c] = _mm_cvtsi32_si128(conv->src_shift[c]);
+		dst_shift[c] = _mm_cvtsi32_si128(conv->dst_shift[c]);
+	}
+	uint32_t i = 0;
+	for (; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+		__m128i out = fill;
+		for (int c = 0; c < 3; c++) {
+			__m128i channel = _mm_and_si128(_mm_srl_epi32(v, src_shift[c]), mask);
+			out = _mm_or_si128(out, _mm_sll_epi32(channel, dst_shift[c]));
+		}
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), out);
+	}
+	convert_row_10_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i coef_pair_sse2(int16_t lo, int16_t hi) {
+	return _mm_set1_epi32((int)((uint16_t)lo | ((uint32_t)(uint16_t)hi << 16)));
+}
+
+// Channels are at most 10 bits, so red and green share a 32 bit lane
+// for a single multiply-add
+__attribute__((target("sse2")))
+static inline __m128i dot_rgb_sse2(__m128i r, __m128i g, __m128i b,
+		__m128i coef_rg, __m128i coef_b, __m128i offset) {
+	__m128i rg = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+	return _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(rg, coef_rg),
+		_mm_madd_epi16(b, coef_b)), offset);
+}
+
+// Sums neighbouring lanes of a and b into [a0+a1, a2+a3, b0+b1, b2+b3]
+__attribute__((target("sse2")))
+static inline __m128i pair_sum_sse2(__m128i a, __m128i b) {
+	__m128 fa = _mm_castsi128_ps(a);
+	__m128 fb = _mm_castsi128_ps(b);
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+__attribute__((target("sse2")))
+static inline void store_luma_sse2(uint8_t *dst, __m128i lo, __m128i hi) {
+	__m128i packed = _mm_packs_epi32(lo, hi);
+	_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(packed, packed));
+}
+
+__attribute__((target("sse2")))
+static inline void store_chroma_sse2(uint8_t *u, uint8_t *v, __m128i cb, __m128i cr) {
+	__m128i packed = _mm_packs_epi32(cb, cr);
+	packed = _mm_packus_epi16(packed, packed);
+	if (v) {
+		uint32_t cb_bytes = (uint32_t)_mm_cvtsi128_si32(packed);
+		uint32_t cr_bytes = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4));
+		memcpy(u, &cb_bytes, sizeof(cb_bytes));
+		memcpy(v, &cr_bytes, sizeof(cr_bytes));
+	} else {
+		_mm_storel_epi64((__m128i *)u, _mm_unpacklo_epi8(packed, _mm_srli_si128(packed, 4)));
+	}
+}
+
+__attribute__((target("sse2")))
+static void convert_yuv_sse2(const struct xdpw_pixel_convert *conv,
+		uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		const uint8_t *src0, const uint8_t *src1, uint32_t width) {
+	__m128i mask = _mm_set1_epi32(0xff);
+	__m128i shift[3];
+	for (int c = 0; c < 3; c++) {
+		shift[c] = _mm_cvtsi32_si128(conv->src_shift[c]);
+	}
+	__m128i y_rg = coef_pair_sse2(conv->y_coef[0], conv->y_coef[1]);
+	__m128i y_b = coef_pair_sse2(conv->y_coef[2], 0);
+	__m128i u_rg = coef_pair_sse2(conv->u_coef[0], conv->u_coef[1]);
+	__m128i u_b = coef_pair_sse2(conv->u_coef[2], 0);
+	__m128i v_rg = coef_pair_sse2(conv->v_coef[0], conv->v_coef[1]);
+	__m128i v_b = coef_pair_sse2(conv->v_coef[2], 0);
+	__m128i y_offset = _mm_set1_epi32(conv->y_offset);
+	__m128i uv_offset = _mm_set1_epi32(conv->uv_offset);
+
+	uint32_t i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m128i px[4] = {
+			_mm_loadu_si128((const __m128i *)(src0 + 4 * i)),
+			_mm_loadu_si128((const __m128i *)(src0 + 4 * i + 16)),
+			_mm_loadu_si128((const __m128i *)(src1 + 4 * i)),
+			_mm_loadu_si128((const __m128i *)(src1 + 4 * i + 16)),
+		};
+		__m128i ch[4][3], lum[4];
+		for (int p = 0; p < 4; p++) {
+			for (int c = 0; c < 3; c++) {
+				ch[p][c] = _mm_and_si128(_mm_srl_epi32(px[p], shift[c]), mask);
+			}
+			lum[p] = _mm_srai_epi32(dot_rgb_sse2(ch[p][0], ch[p][1], ch[p][2],
+				y_rg, y_b, y_offset), 14);
+		}
+		store_luma_sse2(y0 + i, lum[0], lum[1]);
+		if (y1) {
+			store_luma_sse2(y1 + i, lum[2], lum[3]);
+		}
+
+		__m128i sum[3];
+		for (int c = 0; c < 3; c++) {
+			sum[c] = pair_sum_sse2(_mm_add_epi32(ch[0][c], ch[2][c]),
+				_mm_add_epi32(ch[1][c], ch[3][c]));
+		}
+		__m128i cb = _mm_srai_epi32(dot_rgb_sse2(sum[0], sum[1], sum[2], u_rg, u_b, uv_offset), 16);
+		__m128i cr = _mm_srai_epi32(dot_rgb_sse2(sum[0], sum[1], sum[2], v_rg, v_b, uv_offset), 16);
+		store_chroma_sse2(v ? u + i / 2 : u + i, v ? v + i / 2 : NULL, cb, cr);
+	}
+	convert_yuv_scalar(conv, y0 + i, y1 ? y1 + i : NULL,
+		v ? u + i / 2 : u + i, v ? v + i / 2 : NULL,
+		src0 + 4 * i, src1 + 4 * i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_32_avx2(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)conv->shuffle));
+	__m256i fill = _mm256_set1_epi32((int)conv->fill);
+	uint32_t i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), fill);
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+	}
+	convert_row_shuffle_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_24_avx2(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)conv->shuffle));
+	__m256i fill = _mm256_set1_epi32((int)conv->fill);
+	uint32_t i = 0;
+	// Each lane takes 4 pixels, the upper load ends 4 bytes after them
+	for (; i + 10 <= width; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(src + 3 * i + 12));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), fill);
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+	}
+	convert_row_24_ssse3(conv, dst + 4 * i, src + 3 * i, width - i);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_10_avx2(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	__m256i mask = _mm256_set1_epi32(0xff);
+	__m256i fill = _mm256_set1_epi32((int)conv->fill);
+	__m128i src_shift[3], dst_shift[3];
+	for (int c = 0; c < 3; c++) {
+		src_shift[c] = _mm_cvtsi32_si128(conv->src_shift[c]);
+		dst_shift[c] = _mm_cvtsi32_si128(conv->dst_shift[c]);
+	}
+	uint32_t i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		__m256i out = fill;
+		for (int c = 0; c < 3; c++) {
+			__m256i channel = _mm256_and_si256(_mm256_srl_epi32(v, src_shift[c]), mask);
+			out = _mm256_or_si256(out, _mm256_sll_epi32(channel, dst_shift[c]));
+		}
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), out);
+	}
+	convert_row_10_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i dot_rgb_avx2(__m256i r, __m256i g, __m256i b,
+		__m256i coef_rg, __m256i coef_b, __m256i offset) {
+	__m256i rg = _mm256_or_si256(r, _mm256_slli_epi32(g, 16));
+	return _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg, coef_rg),
+		_mm256_madd_epi16(b, coef_b)), offset);
+}
+
+__attribute__((target("avx2")))
+static void convert_yuv_avx2(const struct xdpw_pixel_convert *conv,
+		uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		const uint8_t *src0, const uint8_t *src1, uint32_t width) {
+	__m256i mask = _mm256_set1_epi32(0xff);
+	__m128i shift[3];
+	for (int c = 0; c < 3; c++) {
+		shift[c] = _mm_cvtsi32_si128(conv->src_shift[c]);
+	}
+	__m256i y_rg = _mm256_broadcastsi128_si256(coef_pair_sse2(conv->y_coef[0], conv->y_coef[1]));
+	__m256i y_b = _mm256_broadcastsi128_si256(coef_pair_sse2(conv->y_coef[2], 0));
+	__m256i y_offset = _mm256_set1_epi32(conv->y_offset);
+	__m128i u_rg = coef_pair_sse2(conv->u_coef[0], conv->u_coef[1]);
+	__m128i u_b = coef_pair_sse2(conv->u_coef[2], 0);
+	__m128i v_rg = coef_pair_sse2(conv->v_coef[0], conv->v_coef[1]);
+	__m128i v_b = coef_pair_sse2(conv->v_coef[2], 0);
+	__m128i uv_offset = _mm_set1_epi32(conv->uv_offset);
+
+	uint32_t i = 0;
+	for (; i + 8 <= width; i += 8) {
+		__m256i px[2] = {
+			_mm256_loadu_si256((const __m256i *)(src0 + 4 * i)),
+			_mm256_loadu_si256((const __m256i *)(src1 + 4 * i)),
+		};
+		__m256i ch[2][3], lum[2];
+		for (int p = 0; p < 2; p++) {
+			for (int c = 0; c < 3; c++) {
+				ch[p][c] = _mm256_and_si256(_mm256_srl_epi32(px[p], shift[c]), mask);
+			}
+			lum[p] = _mm256_srai_epi32(dot_rgb_avx2(ch[p][0], ch[p][1], ch[p][2],
+				y_rg, y_b, y_offset), 14);
+		}
+		store_luma_sse2(y0 + i, _mm256_castsi256_si128(lum[0]), _mm256_extracti128_si256(lum[0], 1));
+		if (y1) {
+			store_luma_sse2(y1 + i, _mm256_castsi256_si128(lum[1]), _mm256_extracti128_si256(lum[1], 1));
+		}
+
+		__m128i sum[3];
+		for (int c = 0; c < 3; c++) {
+			// hadd sums pairs within each 128 bit lane, gather the
+			// low halves of both lanes
+			__m256i rows = _mm256_add_epi32(ch[0][c], ch[1][c]);
+			__m256i pairs = _mm256_hadd_epi32(rows, rows);
+			sum[c] = _mm256_castsi256_si128(_mm256_permute4x64_epi64(pairs, 0x08));
+		}
+		__m128i cb = _mm_srai_epi32(dot_rgb_sse2(sum[0], sum[1], sum[2], u_rg, u_b, uv_offset), 16);
+		__m128i cr = _mm_srai_epi32(dot_rgb_sse2(sum[0], sum[1], sum[2], v_rg, v_b, uv_offset), 16);
+		store_chroma_sse2(v ? u + i / 2 : u + i, v ? v + i / 2 : NULL, cb, cr);
+	}
+	convert_yuv_scalar(conv, y0 + i, y1 ? y1 + i : NULL,
+		v ? u + i / 2 : u + i, v ? v + i / 2 : NULL,
+		src0 + 4 * i, src1 + 4 * i, width - i);
+}
+#endif
+
+/*
+ * NEON kernels, always available on aarch64
+ */
+
+#ifdef XDPW_CONVERT_NEON
+static void convert_row_32_neon(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	uint8x16_t shuffle = vld1q_u8(conv->shuffle);
+	uint8x16_t fill = vreinterpretq_u8_u32(vdupq_n_u32(conv->fill));
+	uint32_t i = 0;
+	for (; i + 4 <= width; i += 4) {
+		// Indices out of range, like 0x80, select zero
+		uint8x16_t v = vqtbl1q_u8(vld1q_u8(src + 4 * i), shuffle);
+		vst1q_u8(dst + 4 * i, vorrq_u8(v, fill));
+	}
+	convert_row_shuffle_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+static void convert_row_24_neon(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	uint8x16_t shuffle = vld1q_u8(conv->shuffle);
+	uint8x16_t fill = vreinterpretq_u8_u32(vdupq_n_u32(conv->fill));
+	uint32_t i = 0;
+	for (; i + 6 <= width; i += 4) {
+		uint8x16_t v = vqtbl1q_u8(vld1q_u8(src + 3 * i), shuffle);
+		vst1q_u8(dst + 4 * i, vorrq_u8(v, fill));
+	}
+	convert_row_shuffle_scalar(conv, dst + 4 * i, src + 3 * i, width - i);
+}
+
+static void convert_row_10_neon(const struct xdpw_pixel_convert *conv,
+		uint8_t *dst, const uint8_t *src, uint32_t width) {
+	uint32x4_t mask = vdupq_n_u32(0xff);
+	uint32x4_t fill = vdupq_n_u32(conv->fill);
+	int32x4_t src_shift[3], dst_shift[3];
+	for (int c = 0; c < 3; c++) {
+		// Negative counts shift right
+		src_shift[c] = vdupq_n_s32(-(int32_t)conv->src_shift[c]);
+		dst_shift[c] = vdupq_n_s32((int32_t)conv->dst_shift[c]);
+	}
+	uint32_t i = 0;
+	for (; i + 4 <= width; i += 4) {
+		uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(src + 4 * i));
+		uint32x4_t out = fill;
+		for (int c = 0; c < 3; c++) {
+			uint32x4_t channel = vandq_u32(vshlq_u32(v, src_shift[c]), mask);
+			out = vorrq_u32(out, vshlq_u32(channel, dst_shift[c]));
+		}
+		vst1q_u8(dst + 4 * i, vreinterpretq_u8_u32(out));
+	}
+	convert_row_10_scalar(conv, dst + 4 * i, src + 4 * i, width - i);
+}
+
+static inline int32x4_t dot_rgb_neon(const int32x4_t ch[3], const int16_t coef[3], int32_t offset) {
+	int32x4_t sum = vmlaq_n_s32(vdupq_n_s32(offset), ch[0], coef[0]);
+	sum = vmlaq_n_s32(sum, ch[1], coef[1]);
+	return vmlaq_n_s32(sum, ch[2], coef[2]);
+}
+
+static void convert_yuv_neon(const struct xdpw_pixel_convert *conv,
+		uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		const uint8_t *src0, const uint8_t *src1, uint32_t width) {
+	uint32x4_t mask = vdupq_n_u32(0xff);
+	int32x4_t shift[3];
+	for (int c = 0; c < 3; c++) {
+		shift[c] = vdupq_n_s32(-(int32_t)conv->src_shift[c]);
+	}
+
+	uint32_t i = 0;
+	for (; i + 8 <= width; i += 8) {
+		const uint8_t *src[4] = { src0 + 4 * i, src0 + 4 * i + 16, src1 + 4 * i, src1 + 4 * i + 16 };
+		int32x4_t ch[4][3];
+		uint16x4_t lum[4];
+		for (int p = 0; p < 4; p++) {
+			uint32x4_t px = vreinterpretq_u32_u8(vld1q_u8(src[p]));
+			for (int c = 0; c < 3; c++) {
+				ch[p][c] = vreinterpretq_s32_u32(vandq_u32(vshlq_u32(px, shift[c]), mask));
+			}
+			lum[p] = vqmovun_s32(vshrq_n_s32(dot_rgb_neon(ch[p], conv->y_coef, conv->y_offset), 14));
+		}
+		vst1_u8(y0 + i, vqmovn_u16(vcombine_u16(lum[0], lum[1])));
+		if (y1) {
+			vst1_u8(y1 + i, vqmovn_u16(vcombine_u16(lum[2], lum[3])));
+		}
+
+		int32x4_t sum[3];
+		for (int c = 0; c < 3; c++) {
+			sum[c] = vpaddq_s32(vaddq_s32(ch[0][c], ch[2][c]), vaddq_s32(ch[1][c], ch[3][c]));
+		}
+		uint16x4_t cb = vqmovun_s32(vshrq_n_s32(dot_rgb_neon(sum, conv->u_coef, conv->uv_offset), 16));
+		uint16x4_t cr = vqmovun_s32(vshrq_n_s32(dot_rgb_neon(sum, conv->v_coef, conv->uv_offset), 16));
+		uint8x8_t chroma = vqmovn_u16(vcombine_u16(cb, cr));
+		if (v) {
+			uint32_t cb_bytes = vget_lane_u32(vreinterpret_u32_u8(chroma), 0);
+			uint32_t cr_bytes = vget_lane_u32(vreinterpret_u32_u8(chroma), 1);
+			memcpy(u + i / 2, &cb_bytes, sizeof(cb_bytes));
+			memcpy(v + i / 2, &cr_bytes, sizeof(cr_bytes));
+		} else {
+			vst1_u8(u + i, vzip1_u8(chroma, vext_u8(chroma, chroma, 4)));
+		}
+	}
+	convert_yuv_scalar(conv, y0 + i, y1 ? y1 + i : NULL,
+		v ? u + i / 2 : u + i, v ? v + i / 2 : NULL,
+		src0 + 4 * i, src1 + 4 * i, width - i);
+}
+#endif
+
+static enum convert_isa detect_isa(void) {
+#if defined(XDPW_CONVERT_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return ISA_AVX2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		return ISA_SSSE3;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return ISA_SSE2;
+	}
+	return ISA_SCALAR;
+#elif defined(XDPW_CONVERT_NEON)
+	return ISA_NEON;
+#else
+	return ISA_SCALAR;
+#endif
+}
+
+static enum convert_isa get_isa(void) {
+	static enum convert_isa isa = ISA_UNKNOWN;
+	if (isa == ISA_UNKNOWN) {
+		isa = detect_isa();
+	}
+	return isa;
+}
+
+const char *xdpw_pixel_convert_isa(void) {
+	switch (get_isa()) {
+	case ISA_SSE2:
+		return "sse2";
+	case ISA_SSSE3:
+		return "ssse3";
+	case ISA_AVX2:
+		return "avx2";
+	case ISA_NEON:
+		return "neon";
+	default:
+		return "scalar";
+	}
+}
+
+static xdpw_pixel_convert_row_func select_row_func(uint32_t src_bpp, bool deep) {
+	enum convert_isa isa = get_isa();
+	(void)isa;
+	if (deep) {
+#if defined(XDPW_CONVERT_X86)
+		if (isa == ISA_AVX2) {
+			return convert_row_10_avx2;
+		} else if (isa >= ISA_SSE2) {
+			return convert_row_10_sse2;
+		}
+#elif defined(XDPW_CONVERT_NEON)
+		return convert_row_10_neon;
+#endif
+		return convert_row_10_scalar;
+	}
+
+#if defined(XDPW_CONVERT_X86)
+	// Byte shuffles need pshufb, which sse2 lacks
+	if (isa == ISA_AVX2) {
+		return src_bpp == 3 ? convert_row_24_avx2 : convert_row_32_avx2;
+	} else if (isa == ISA_SSSE3) {
+		return src_bpp == 3 ? convert_row_24_ssse3 : convert_row_32_ssse3;
+	}
+#elif defined(XDPW_CONVERT_NEON)
+	return src_bpp == 3 ? convert_row_24_neon : convert_row_32_neon;
+#endif
+	return convert_row_shuffle_scalar;
+}
+
+static xdpw_pixel_convert_yuv_func select_yuv_func(void) {
+	enum convert_isa isa = get_isa();
+	(void)isa;
+#if defined(XDPW_CONVERT_X86)
+	if (isa == ISA_AVX2) {
+		return convert_yuv_avx2;
+	} else if (isa >= ISA_SSE2) {
+		return convert_yuv_sse2;
+	}
+#elif defined(XDPW_CONVERT_NEON)
+	return convert_yuv_neon;
+#endif
+	return convert_yuv_scalar;
+}
+
+static int16_t to_fixed(double value) {
+	value *= 1 << 14;
+	return (int16_t)(value < 0 ? value - 0.5 : value + 0.5);
+}
+
+static void init_yuv_coefficients(struct xdpw_pixel_convert *conv,
+		enum xdpw_yuv_matrix matrix, enum xdpw_yuv_range range) {
+	double kr, kb;
+	switch (matrix) {
+	case XDPW_YUV_MATRIX_BT601:
+		kr = 0.299;
+		kb = 0.114;
+		break;
+	case XDPW_YUV_MATRIX_BT709:
+	default:
+		kr = 0.2126;
+		kb = 0.0722;
+		break;
+	}
+	double kg = 1.0 - kr - kb;
+
+	double y_scale = 1.0, uv_scale = 1.0;
+	int32_t y_min = 0;
+	if (range == XDPW_YUV_RANGE_LIMITED) {
+		y_scale = 219.0 / 255.0;
+		uv_scale = 224.0 / 255.0;
+		y_min = 16;
+	}
+
+	const double y[3] = { kr, kg, kb };
+	const double u[3] = { -kr / (2 * (1 - kb)), -kg / (2 * (1 - kb)), 0.5 };
+	const double v[3] = { 0.5, -kg / (2 * (1 - kr)), -kb / (2 * (1 - kr)) };
+	for (int c = 0; c < 3; c++) {
+		conv->y_coef[c] = to_fixed(y[c] * y_scale);
+		conv->u_coef[c] = to_fixed(u[c] * uv_scale);
+		conv->v_coef[c] = to_fixed(v[c] * uv_scale);
+	}
+	conv->y_offset = (y_min << 14) + (1 << 13);
+	conv->uv_offset = (128 << 16) + (1 << 15);
+}
+
+bool xdpw_pixel_convert_init(struct xdpw_pixel_convert *conv,
+		uint32_t dst_format, uint32_t src_format,
+		enum xdpw_yuv_matrix matrix, enum xdpw_yuv_range range) {
+	const struct format_layout *src = find_layout(src_format);
+	if (src == NULL || dst_format == src_format) {
+		return false;
+	}
+
+	uint32_t src_shift[3];
+	if (src->deep) {
+		src_shift[0] = src->r + 2;
+		src_shift[1] = src->g + 2;
+		src_shift[2] = src->b + 2;
+	} else {
+		src_shift[0] = 8 * src->r;
+		src_shift[1] = 8 * src->g;
+		src_shift[2] = 8 * src->b;
+	}
+
+	if (xdpw_pixel_convert_is_yuv(dst_format)) {
+		// The yuv kernels take 32 bit pixels apart with shifts
+		if (src->bpp != 4) {
+			return false;
+		}
+		*conv = (struct xdpw_pixel_convert){
+			.dst_format = dst_format,
+			.src_format = src_format,
+			.dst_bpp = 1,
+			.src_bpp = src->bpp,
+			.dst_planes = dst_format == DRM_FORMAT_NV12 ? 2 : 3,
+			.yuv = true,
+			.convert_yuv = select_yuv_func(),
+		};
+		memcpy(conv->src_shift, src_shift, sizeof(src_shift));
+		init_yuv_coefficients(conv, matrix, range);
+		return true;
+	}
+
+	const struct format_layout *dst = find_layout(dst_format);
+	if (dst == NULL || !is_target(dst_format)) {
+		return false;
+	}
+
+	*conv = (struct xdpw_pixel_convert){
+		.dst_format = dst_format,
+		.src_format = src_format,
+		.dst_bpp = dst->bpp,
+		.src_bpp = src->bpp,
+		.dst_planes = 1,
+		.fill = 0xffu << (8 * dst->x),
+	};
+
+	if (src->deep) {
+		memcpy(conv->src_shift, src_shift, sizeof(src_shift));
+		conv->dst_shift[0] = 8 * dst->r;
+		conv->dst_shift[1] = 8 * dst->g;
+		conv->dst_shift[2] = 8 * dst->b;
+	} else {
+		for (uint32_t p = 0; p < 4; p++) {
+			uint8_t *shuffle = &conv->shuffle[4 * p];
+			shuffle[dst->x] = 0x80;
+			shuffle[dst->r] = p * src->bpp + src->r;
+			shuffle[dst->g] = p * src->bpp + src->g;
+			shuffle[dst->b] = p * src->bpp + src->b;
+		}
+	}
+	conv->convert_row = select_row_func(src->bpp, src->deep);
+	return true;
+}
+
+static uint32_t align(uint32_t value, uint32_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t xdpw_pixel_convert_layout(const struct xdpw_pixel_convert *conv,
+		uint32_t width, uint32_t height, uint32_t stride[], uint32_t offset[], uint32_t size[]) {
+	if (!conv->yuv) {
+		stride[0] = conv->dst_bpp * width;
+		offset[0] = 0;
+		size[0] = stride[0] * height;
+		return 1;
+	}
+
+	// All planes share one memfd, chroma is subsampled by 2 in both directions
+	uint32_t chroma_width = (width + 1) / 2;
+	uint32_t chroma_height = (height + 1) / 2;
+	stride[0] = align(width, YUV_PLANE_ALIGN);
+	offset[0] = 0;
+	size[0] = stride[0] * height;
+	if (conv->dst_planes == 2) {
+		stride[1] = align(2 * chroma_width, YUV_PLANE_ALIGN);
+		offset[1] = size[0];
+		size[1] = stride[1] * chroma_height;
+	} else {
+		for (int plane = 1; plane < 3; plane++) {
+			stride[plane] = align(chroma_width, YUV_PLANE_ALIGN);
+			offset[plane] = offset[plane - 1] + size[plane - 1];
+			size[plane] = stride[plane] * chroma_height;
+		}
+	}
+	return conv->dst_planes;
+}
+
+// Rows of a rectangle are converted in bands by the worker pool
+struct convert_job {
+	const struct xdpw_pixel_convert *conv;
+	uint8_t *const *dst;
+	const uint32_t *dst_stride;
+	const uint8_t *src;
+	uint32_t src_stride;
+	uint32_t x, width;
+	// first destination row and number of rows, or of row pairs for yuv
+	uint32_t row, rows;
+	uint32_t frame_height;
+	bool flip_y;
+};
+
+static const uint8_t *job_src_row(const struct convert_job *job, uint32_t row) {
+	uint32_t src_row = job->flip_y ? job->frame_height - 1 - row : row;
+	return job->src + (size_t)src_row * job->src_stride;
+}
+
+static void convert_rows(void *data, uint32_t first, uint32_t last) {
+	const struct convert_job *job = data;
+	const struct xdpw_pixel_convert *conv = job->conv;
+	uint8_t *const *dst = job->dst;
+	const uint32_t *stride = job->dst_stride;
+	size_t src_x = (size_t)job->x * conv->src_bpp;
+
+	if (!conv->yuv) {
+		for (uint32_t i = first; i < last; i++) {
+			uint32_t row = job->row + i;
+			conv->convert_row(conv,
+				dst[0] + (size_t)row * stride[0] + (size_t)job->x * conv->dst_bpp,
+				job_src_row(job, row) + src_x, job->width);
+		}
+		return;
+	}
+
+	for (uint32_t i = first; i < last; i++) {
+		uint32_t row = job->row + 2 * i;
+		bool pair = row + 1 < job->frame_height;
+		const uint8_t *src0 = job_src_row(job, row) + src_x;
+		const uint8_t *src1 = pair ? job_src_row(job, row + 1) + src_x : src0;
+		uint8_t *y0 = dst[0] + (size_t)row * stride[0] + job->x;
+		uint8_t *y1 = pair ? y0 + stride[0] : NULL;
+		size_t chroma_row = row / 2;
+		if (conv->dst_planes == 2) {
+			conv->convert_yuv(conv, y0, y1,
+				dst[1] + chroma_row * stride[1] + job->x, NULL,
+				src0, src1, job->width);
+		} else {
+			conv->convert_yuv(conv, y0, y1,
+				dst[1] + chroma_row * stride[1] + job->x / 2,
+				dst[2] + chroma_row * stride[2] + job->x / 2,
+				src0, src1, job->width);
+		}
+	}
+}
+
+void xdpw_pixel_convert_rect(const struct xdpw_pixel_convert *conv,
+		uint8_t *const dst[], const uint32_t dst_stride[],
+		const uint8_t *src, uint32_t src_stride,
+		uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+		uint32_t frame_width, uint32_t frame_height, bool flip_y) {
+	assert(x + width <= frame_width && y + height <= frame_height);
+
+	// Rows are walked in the order of the destination
+	uint32_t row = flip_y ? frame_height - y - height : y;
+	uint32_t rows = height;
+	if (conv->yuv) {
+		// Chroma covers 2x2 pixels, so the rectangle is grown to even
+		// coordinates
+		uint32_t end_x = MIN(align(x + width, 2), frame_width);
+		uint32_t end_row = MIN(align(row + rows, 2), frame_height);
+		x &= ~1u;
+		row &= ~1u;
+		width = end_x - x;
+		rows = (end_row - row + 1) / 2;
+	}
+
+	struct convert_job job = {
+		.conv = conv,
+		.dst = dst,
+		.dst_stride = dst_stride,
+		.src = src,
+		.src_stride = src_stride,
+		.x = x,
+		.width = width,
+		.row = row,
+		.rows = rows,
+		.frame_height = frame_height,
+		.flip_y = flip_y,
+	};
+
+	xdpw_worker_pool_run(convert_rows, &job, rows, (uint64_t)width * height);
+}
+
+const uint32_t *xdpw_pixel_convert_targets(size_t *count) {
+	*count = sizeof(targets) / sizeof(targets[0]);
+	return targets;
+}
+
+const uint32_t *xdpw_pixel_convert_yuv_targets(size_t *count) {
+	*count = sizeof(yuv_targets) / sizeof(yuv_targets[0]);
+	return yuv_targets;
+}
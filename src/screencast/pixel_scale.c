@@ -0,0 +1,346 @@
+#include "pixel_scale.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <drm_fourcc.h>
+
+#include "worker_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XDPW_SCALE_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define XDPW_SCALE_NEON
+#include <arm_neon.h>
+#endif
+
+// Larger boxes only average a part of the area of a destination pixel,
+// but keep the sums of a row within 16 bits
+#define SCALE_MAX_BOX 16
+
+static const uint32_t formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_RGBX8888,
+	DRM_FORMAT_RGBA8888,
+	DRM_FORMAT_BGRX8888,
+	DRM_FORMAT_BGRA8888,
+};
+
+bool xdpw_pixel_scale_supported(uint32_t format) {
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (formats[i] == format) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Source rows are weighted and summed into 16 bit accumulators first,
+ * which are filtered horizontally afterwards
+ */
+
+typedef void (*accumulate_func)(uint16_t *acc, const uint8_t *src, uint32_t weight,
+	size_t bytes, bool first);
+
+static void accumulate_scalar(uint16_t *acc, const uint8_t *src, uint32_t weight,
+		size_t bytes, bool first) {
+	for (size_t i = 0; i < bytes; i++) {
+		acc[i] = (first ? 0 : acc[i]) + src[i] * weight;
+	}
+}
+
+#ifdef XDPW_SCALE_X86
+__attribute__((target("sse2")))
+static void accumulate_sse2(uint16_t *acc, const uint8_t *src, uint32_t weight,
+		size_t bytes, bool first) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i w = _mm_set1_epi16((short)weight);
+	size_t i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w);
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w);
+		if (!first) {
+			lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i *)(acc + i)));
+			hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i *)(acc + i + 8)));
+		}
+		_mm_storeu_si128((__m128i *)(acc + i), lo);
+		_mm_storeu_si128((__m128i *)(acc + i + 8), hi);
+	}
+	accumulate_scalar(acc + i, src + i, weight, bytes - i, first);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint16_t *acc, const uint8_t *src, uint32_t weight,
+		size_t bytes, bool first) {
+	__m256i w = _mm256_set1_epi16((short)weight);
+	size_t i = 0;
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+		__m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i + 16)));
+		lo = _mm256_mullo_epi16(lo, w);
+		hi = _mm256_mullo_epi16(hi, w);
+		if (!first) {
+			lo = _mm256_add_epi16(lo, _mm256_loadu_si256((const __m256i *)(acc + i)));
+			hi = _mm256_add_epi16(hi, _mm256_loadu_si256((const __m256i *)(acc + i + 16)));
+		}
+		_mm256_storeu_si256((__m256i *)(acc + i), lo);
+		_mm256_storeu_si256((__m256i *)(acc + i + 16), hi);
+	}
+	accumulate_sse2(acc + i, src + i, weight, bytes - i, first);
+}
+#endif
+
+#ifdef XDPW_SCALE_NEON
+static void accumulate_neon(uint16_t *acc, const uint8_t *src, uint32_t weight,
+		size_t bytes, bool first) {
+	size_t i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		uint8x16_t v = vld1q_u8(src + i);
+		uint16x8_t lo = vmulq_n_u16(vmovl_u8(vget_low_u8(v)), weight);
+		uint16x8_t hi = vmulq_n_u16(vmovl_u8(vget_high_u8(v)), weight);
+		if (!first) {
+			lo = vaddq_u16(lo, vld1q_u16(acc + i));
+			hi = vaddq_u16(hi, vld1q_u16(acc + i + 8));
+		}
+		vst1q_u16(acc + i, lo);
+		vst1q_u16(acc + i + 8, hi);
+	}
+	accumulate_scalar(acc + i, src + i, weight, bytes - i, first);
+}
+#endif
+
+static accumulate_func select_accumulate(void) {
+#if defined(XDPW_SCALE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return accumulate_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return accumulate_sse2;
+	}
+#elif defined(XDPW_SCALE_NEON)
+	return accumulate_neon;
+#endif
+	return accumulate_scalar;
+}
+
+static accumulate_func get_accumulate(void) {
+	static accumulate_func accumulate = NULL;
+	if (accumulate == NULL) {
+		accumulate = select_accumulate();
+	}
+	return accumulate;
+}
+
+bool xdpw_pixel_scale_init(struct xdpw_pixel_scale *scale,
+		uint32_t src_width, uint32_t src_height, uint32_t dst_width, uint32_t dst_height) {
+	// Only downscaling is supported
+	if (dst_width == 0 || dst_height == 0 || dst_width > src_width || dst_height > src_height) {
+		return false;
+	}
+
+	*scale = (struct xdpw_pixel_scale){
+		.src_width = src_width,
+		.src_height = src_height,
+		.dst_width = dst_width,
+		.dst_height = dst_height,
+		.box_width = MIN(src_width / dst_width, SCALE_MAX_BOX),
+		.box_height = MIN(src_height / dst_height, SCALE_MAX_BOX),
+	};
+	scale->box = scale->box_width >= 2 || scale->box_height >= 2;
+	if (scale->box) {
+		uint32_t area = scale->box_width * scale->box_height;
+		scale->box_scale = ((1u << 16) + area / 2) / area;
+	}
+	return true;
+}
+
+// Returns the first source pixel of a destination pixel along one axis.
+// For the bilinear filter the weight of the following pixel is returned
+// in 1/256.
+static uint32_t map_pixel(const struct xdpw_pixel_scale *scale, uint32_t src_size,
+		uint32_t dst_size, uint32_t box, uint32_t pixel, uint32_t *weight) {
+	*weight = 0;
+	if (scale->box) {
+		// The box is centered on the destination pixel, box <= src / dst
+		// keeps the start positive
+		uint64_t start = ((uint64_t)(2 * pixel + 1) * src_size - (uint64_t)box * dst_size) /
+			(2 * (uint64_t)dst_size);
+		return MIN(start, src_size - box);
+	}
+
+	// Sample position relative to the centers of source pixels
+	int64_t pos = (int64_t)(2 * pixel + 1) * src_size * 256 / (2 * (int64_t)dst_size) - 128;
+	if (pos <= 0) {
+		return 0;
+	}
+	uint32_t index = pos >> 8;
+	if (index >= src_size - 1) {
+		return src_size - 1;
+	}
+	*weight = pos & 0xff;
+	return index;
+}
+
+static void map_span(uint32_t src_size, uint32_t dst_size, uint32_t start, uint32_t length,
+		uint32_t *dst_start, uint32_t *dst_length) {
+	if (length == 0) {
+		*dst_start = 0;
+		*dst_length = 0;
+		return;
+	}
+	// Destination pixels read up to one source pixel outside of their
+	// own area, boxes are shifted by a pixel by rounding
+	uint64_t first = (uint64_t)start * dst_size / src_size;
+	uint64_t end = ((uint64_t)(start + length) * dst_size + src_size - 1) / src_size;
+	first = first > 2 ? first - 2 : 0;
+	end = MIN(end + 2, dst_size);
+	*dst_start = first;
+	*dst_length = end - first;
+}
+
+void xdpw_pixel_scale_map_rect(const struct xdpw_pixel_scale *scale,
+		const struct xdpw_pixel_rect *src, struct xdpw_pixel_rect *dst) {
+	map_span(scale->src_width, scale->dst_width, src->x, src->width, &dst->x, &dst->width);
+	map_span(scale->src_height, scale->dst_height, src->y, src->height, &dst->y, &dst->height);
+	if (dst->width == 0 || dst->height == 0) {
+		*dst = (struct xdpw_pixel_rect){ 0 };
+	}
+}
+
+// Destination rows of a rectangle are scaled in bands by the worker pool
+struct scale_job {
+	const struct xdpw_pixel_scale *scale;
+	uint8_t *dst;
+	uint32_t dst_stride;
+	const uint8_t *src;
+	uint32_t src_stride;
+	const struct xdpw_pixel_rect *rect;
+	bool flip_y;
+	accumulate_func accumulate;
+
+	// source columns read for the rectangle
+	uint32_t src_x, src_columns;
+	// first source column and bilinear weight of every destination column
+	const uint32_t *x_index;
+	const uint32_t *x_weight;
+};
+
+static void filter_row_box(const struct scale_job *job, uint8_t *dst, const uint16_t *acc) {
+	const struct xdpw_pixel_scale *scale = job->scale;
+	for (uint32_t i = 0; i < job->rect->width; i++) {
+		const uint16_t *column = acc + 4 * (size_t)(job->x_index[i] - job->src_x);
+		for (int c = 0; c < 4; c++) {
+			uint32_t sum = 0;
+			for (uint32_t t = 0; t < scale->box_width; t++) {
+				sum += column[4 * t + c];
+			}
+			dst[4 * i + c] = MIN((sum * scale->box_scale + (1u << 15)) >> 16, 255u);
+		}
+	}
+}
+
+static void filter_row_bilinear(const struct scale_job *job, uint8_t *dst, const uint16_t *acc) {
+	for (uint32_t i = 0; i < job->rect->width; i++) {
+		const uint16_t *column = acc + 4 * (size_t)(job->x_index[i] - job->src_x);
+		uint32_t weight = job->x_weight[i];
+		for (int c = 0; c < 4; c++) {
+			// The next column is only read if it has a weight, it might
+			// be outside of the frame
+			uint32_t sum = column[c] * (256 - weight);
+			if (weight > 0) {
+				sum += column[4 + c] * weight;
+			}
+			dst[4 * i + c] = (sum + (1u << 15)) >> 16;
+		}
+	}
+}
+
+static void scale_rows(void *data, uint32_t first, uint32_t last) {
+	const struct scale_job *job = data;
+	const struct xdpw_pixel_scale *scale = job->scale;
+	size_t bytes = 4 * (size_t)job->src_columns;
+	uint16_t *acc = malloc(bytes * sizeof(*acc));
+	if (acc == NULL) {
+		return;
+	}
+
+	for (uint32_t i = first; i < last; i++) {
+		uint32_t row = job->rect->y + i;
+		uint32_t weight;
+		uint32_t index = map_pixel(scale, scale->src_height, scale->dst_height,
+			scale->box_height, row, &weight);
+		const uint8_t *src = job->src + (size_t)index * job->src_stride + 4 * (size_t)job->src_x;
+
+		if (scale->box) {
+			for (uint32_t r = 0; r < scale->box_height; r++) {
+				job->accumulate(acc, src + (size_t)r * job->src_stride, 1, bytes, r == 0);
+			}
+		} else {
+			job->accumulate(acc, src, 256 - weight, bytes, true);
+			if (weight > 0) {
+				job->accumulate(acc, src + job->src_stride, weight, bytes, false);
+			}
+		}
+
+		uint32_t dst_row = job->flip_y ? scale->dst_height - 1 - row : row;
+		uint8_t *dst = job->dst + (size_t)dst_row * job->dst_stride + 4 * (size_t)job->rect->x;
+		if (scale->box) {
+			filter_row_box(job, dst, acc);
+		} else {
+			filter_row_bilinear(job, dst, acc);
+		}
+	}
+	free(acc);
+}
+
+void xdpw_pixel_scale_rect(const struct xdpw_pixel_scale *scale,
+		uint8_t *dst, uint32_t dst_stride, const uint8_t *src, uint32_t src_stride,
+		const struct xdpw_pixel_rect *rect, bool flip_y) {
+	assert(rect->x + rect->width <= scale->dst_width &&
+		rect->y + rect->height <= scale->dst_height);
+	if (rect->width == 0 || rect->height == 0) {
+		return;
+	}
+
+	uint32_t *x_index = malloc(2 * rect->width * sizeof(*x_index));
+	if (x_index == NULL) {
+		return;
+	}
+	uint32_t *x_weight = x_index + rect->width;
+	for (uint32_t i = 0; i < rect->width; i++) {
+		x_index[i] = map_pixel(scale, scale->src_width, scale->dst_width,
+			scale->box_width, rect->x + i, &x_weight[i]);
+	}
+	uint32_t last = rect->width - 1;
+	uint32_t src_end = scale->box ? x_index[last] + scale->box_width :
+		MIN(x_index[last] + 2, scale->src_width);
+
+	struct scale_job job = {
+		.scale = scale,
+		.dst = dst,
+		.dst_stride = dst_stride,
+		.src = src,
+		.src_stride = src_stride,
+		.rect = rect,
+		.flip_y = flip_y,
+		.accumulate = get_accumulate(),
+		.src_x = x_index[0],
+		.src_columns = src_end - x_index[0],
+		.x_index = x_index,
+		.x_weight = x_weight,
+	};
+
+	uint64_t cost = (uint64_t)rect->width * rect->height;
+	if (scale->box) {
+		cost *= scale->box_width * scale->box_height;
+	}
+	xdpw_worker_pool_run(scale_rows, &job, rect->height, cost);
+	free(x_index);
+}
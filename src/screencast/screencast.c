@@ -1,50 +1,42 @@
 #include "screencast.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
-#include <sys/wait.h>
 #include <sys/mman.h>
 #include <spa/utils/result.h>
 
+#include "composite.h"
+#include "exec.h"
 #include "pipewire_screencast.h"
 #include "wlr_screencast.h"
 #include "xdpw.h"
 #include "logger.h"
+#include "timespec_util.h"
+#include "trace.h"
+#include "worker_pool.h"
 
 static const char object_path[] = "/org/freedesktop/portal/desktop";
 static const char interface_name[] = "org.freedesktop.impl.portal.ScreenCast";
+static const char session_interface_name[] = "org.freedesktop.impl.portal.desktop.wlr.ScreenCastSession";
 
-void exec_with_shell(char *command) {
-	pid_t pid1 = fork();
-	if (pid1 < 0) {
-		perror("fork");
-		return;
-	} else if (pid1 == 0) {
-		pid_t pid2 = fork();
-		if (pid2 < 0) {
-			perror("fork");
-		} else if (pid2 == 0) {
-			char *const argv[] = {
-				"sh",
-				"-c",
-				command,
-				NULL,
-			};
-			execvp("sh", argv);
-			perror("execvp");
-			_exit(127);
-		}
-		_exit(0);
-	}
-	int stat;
-	if (waitpid(pid1, &stat, 0) < 0) {
-		perror("waitpid");
-	}
-}
+static int get_stream_metrics(sd_bus *bus, const char *path,
+		const char *interface, const char *property,
+		sd_bus_message *reply, void *data, sd_bus_error *ret_error);
+static int method_dump_trace(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error);
+
+static const sd_bus_vtable screencast_session_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_SIGNAL("StreamsChanged", "a(ua{sv})", 0),
+	SD_BUS_PROPERTY("StreamMetrics", "a(ua{sv})", get_stream_metrics, 0, 0),
+	SD_BUS_METHOD("DumpTrace", "", "", method_dump_trace, SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_VTABLE_END
+};
 
 void xdpw_screencast_instance_init(struct xdpw_screencast_context *ctx,
 		struct xdpw_screencast_instance *cast, struct xdpw_screencast_target *target) {
@@ -54,7 +46,7 @@ void xdpw_screencast_instance_init(struct xdpw_screencast_context *ctx,
 		char *exec_before = ctx->state->config->screencast_conf.exec_before;
 		if (exec_before) {
 			logprint(INFO, "xdpw: executing %s before screencast", exec_before);
-			exec_with_shell(exec_before);
+			xdpw_exec_shell(ctx->state, exec_before);
 		}
 	}
 
@@ -64,6 +56,14 @@ void xdpw_screencast_instance_init(struct xdpw_screencast_context *ctx,
 	uint32_t output_framerate = 0;
 	if (target->type == MONITOR) {
 		output_framerate = target->output->framerate;
+	} else if (target->type == VIRTUAL) {
+		// Composed frames follow the fastest output
+		struct xdpw_wlr_output *output;
+		wl_list_for_each(output, &ctx->output_list, link) {
+			if (output->framerate > output_framerate) {
+				output_framerate = output->framerate;
+			}
+		}
 	}
 
 	cast->ctx = ctx;
@@ -76,6 +76,7 @@ void xdpw_screencast_instance_init(struct xdpw_screencast_context *ctx,
 	}
 	cast->framerate = cast->max_framerate;
 	cast->refcount = 1;
+	wl_list_init(&cast->sources);
 	cast->node_id = SPA_ID_INVALID;
 	cast->avoid_dmabufs = false;
 	wl_array_init(&cast->current_frame.damage);
@@ -87,24 +88,27 @@ void xdpw_screencast_instance_init(struct xdpw_screencast_context *ctx,
 }
 
 void xdpw_screencast_instance_destroy(struct xdpw_screencast_instance *cast) {
-	struct xdpw_timer *timer, *ttmp;
-	wl_list_for_each_safe(timer, ttmp, &cast->ctx->state->timers, link) {
-		if (timer->user_data == cast) {
-			xdpw_destroy_timer(timer);
-		}
-	}
-	struct xdpw_session *sess, *stmp;
-	wl_list_for_each_safe(sess, stmp, &cast->ctx->state->xdpw_sessions, link) {
-		if (sess->screencast_data.screencast_instance == cast) {
-			wl_list_remove(&sess->link);
-			wl_list_init(&sess->link);
-			sess->screencast_data.screencast_instance = NULL;
-			cast->refcount--;
-			xdpw_session_destroy(sess);
-		}
+	xdpw_destroy_timer(cast->capture_timer);
+	xdpw_destroy_timer(cast->detach_timer);
+	xdpw_destroy_timer(cast->release_timer);
+	xdpw_destroy_timer(cast->ring_timer);
+	cast->capture_timer = cast->detach_timer = cast->release_timer = NULL;
+	cast->ring_timer = NULL;
+
+	// Sessions end with any of their sources. The other instances of the
+	// session are destroyed from the event loop, the caller might be
+	// iterating over them.
+	struct xdpw_screencast_source *source, *stmp;
+	wl_list_for_each_safe(source, stmp, &cast->sources, instance_link) {
+		wl_list_remove(&source->instance_link);
+		wl_list_init(&source->instance_link);
+		source->cast = NULL;
+		cast->refcount--;
+		xdpw_session_destroy_later(source->sess);
 	}
 
 	xdpw_wlr_session_close(cast);
+	xdpw_composite_destroy(cast);
 
 	assert(cast->refcount == 0); // Fails assert if called by screencast_finish
 	logprint(DEBUG, "xdpw: destroying cast instance");
@@ -114,21 +118,95 @@ void xdpw_screencast_instance_destroy(struct xdpw_screencast_instance *cast) {
 		char *exec_after = cast->ctx->state->config->screencast_conf.exec_after;
 		if (exec_after) {
 			logprint(INFO, "xdpw: executing %s after screencast", exec_after);
-			exec_with_shell(exec_after);
+			xdpw_exec_shell(cast->ctx->state, exec_after);
 		}
 	}
 
+	free(cast->detached_output_name);
 	free(cast->target);
 	wl_list_remove(&cast->link);
 	xdpw_pwr_stream_destroy(cast);
 	assert(wl_list_length(&cast->buffer_list) == 0);
 	wl_array_release(&cast->current_frame.damage);
+	xdpw_frame_diff_finish(&cast->frame_diff);
 
 	xdpw_buffer_constraints_finish(&cast->current_constraints);
 	xdpw_buffer_constraints_finish(&cast->pending_constraints);
 	free(cast);
 }
 
+// The source type announced to clients, a composite of all outputs is
+// offered to and reported as a monitor
+static uint32_t target_source_type(struct xdpw_screencast_target *target) {
+	return target->type == VIRTUAL ? MONITOR : target->type;
+}
+
+// Every source of a restored session has to be found again, and has to be
+// of a requested type, otherwise the sources are chosen from scratch
+static bool targets_from_data(struct xdpw_screencast_context *ctx, struct wl_array *targets,
+		struct xdpw_screencast_restore_data *data, uint32_t type_mask) {
+	struct xdpw_screencast_restore_data *source_data = data;
+	size_t count = 1;
+	if (data->sources.size > 0) {
+		source_data = data->sources.data;
+		count = data->sources.size / sizeof(*source_data);
+	}
+	for (size_t i = 0; i < count; i++) {
+		struct xdpw_screencast_target *target = wl_array_add(targets, sizeof(*target));
+		if (!target) {
+			logprint(ERROR, "wlroots: unable to allocate target");
+			targets->size = 0;
+			return false;
+		}
+		*target = (struct xdpw_screencast_target){ 0 };
+		if (!xdpw_wlr_target_from_data(ctx, target, &source_data[i]) ||
+				!(target_source_type(target) & type_mask)) {
+			targets->size = 0;
+			return false;
+		}
+	}
+	return true;
+}
+
+static void screencast_source_create(struct xdpw_screencast_context *ctx, struct xdpw_session *sess,
+		struct xdpw_screencast_target *selected) {
+	struct xdpw_screencast_source *source = calloc(1, sizeof(*source));
+	struct xdpw_screencast_target *target = calloc(1, sizeof(*target));
+	struct xdpw_screencast_instance *cast = calloc(1, sizeof(*cast));
+	if (!source || !target || !cast) {
+		logprint(ERROR, "xdpw: unable to allocate source");
+		free(source);
+		free(target);
+		free(cast);
+		return;
+	}
+	*target = *selected;
+	target->with_cursor = sess->screencast_data.cursor_mode == EMBEDDED;
+	xdpw_screencast_instance_init(ctx, cast, target);
+
+	source->sess = sess;
+	source->cast = cast;
+	wl_list_insert(sess->screencast_data.sources.prev, &source->link);
+	wl_list_insert(&cast->sources, &source->instance_link);
+
+	switch (target->type) {
+	case MONITOR:
+		if (target->region.width > 0) {
+			logprint(INFO, "wlroots: output: %s region: %u,%u %ux%u", target->output->name,
+				target->region.x, target->region.y, target->region.width, target->region.height);
+		} else {
+			logprint(INFO, "wlroots: output: %s", target->output->name);
+		}
+		break;
+	case WINDOW:
+		logprint(INFO, "wlroots: toplevel: %s", target->toplevel->title);
+		break;
+	case VIRTUAL:
+		logprint(INFO, "wlroots: all outputs");
+		break;
+	}
+}
+
 bool setup_target(struct xdpw_screencast_context *ctx, struct xdpw_session *sess, struct xdpw_screencast_restore_data *data, uint32_t type_mask) {
 	bool target_initialized = false;
 
@@ -153,17 +231,14 @@ bool setup_target(struct xdpw_screencast_context *ctx, struct xdpw_session *sess
 		}
 	}
 
-	struct xdpw_screencast_target *target = calloc(1, sizeof(struct xdpw_screencast_target));
-	if (!target) {
-		logprint(ERROR, "wlroots: unable to allocate target");
-		return false;
-	}
-	target->with_cursor = sess->screencast_data.cursor_mode == EMBEDDED;
+	struct wl_array targets;
+	wl_array_init(&targets);
 	if (data) {
-		target_initialized = xdpw_wlr_target_from_data(ctx, target, data);
+		target_initialized = targets_from_data(ctx, &targets, data, type_mask);
 	}
 	if (!target_initialized) {
-		target_initialized = xdpw_wlr_target_chooser(ctx, target, type_mask);
+		target_initialized = xdpw_wlr_target_chooser(ctx, &targets, type_mask,
+			sess->screencast_data.multiple);
 		//TODO: Chooser option to confirm the persist mode
 		const char *env_persist_str = getenv("XDPW_PERSIST_MODE");
 		if (env_persist_str) {
@@ -181,53 +256,46 @@ bool setup_target(struct xdpw_screencast_context *ctx, struct xdpw_session *sess
 			sess->screencast_data.persist_mode = PERSIST_NONE;
 		}
 	}
-	if (!target_initialized) {
+	if (!target_initialized || targets.size == 0) {
 		logprint(ERROR, "wlroots: no output found");
-		free(target);
+		wl_array_release(&targets);
 		return false;
 	}
-	assert(target->output || target->toplevel);
-
-	// Disable screencast sharing to avoid sharing between dmabuf and shm capable clients
-	/*
-	struct xdpw_screencast_instance *cast, *tmp_c;
-	wl_list_for_each_reverse_safe(cast, tmp_c, &ctx->screencast_instances, link) {
-		logprint(INFO, "xdpw: existing screencast instance: %d %s cursor",
-			cast->target->output->id,
-			cast->target->with_cursor ? "with" : "without");
-
-		if (cast->target->output->id == target->output->id && cast->target->with_cursor == target->with_cursor) {
-			if (cast->refcount == 0) {
-				logprint(DEBUG,
-					"xdpw: matching cast instance found, "
-					"but is already scheduled for destruction, skipping");
-			}
-			else {
-				sess->screencast_data.screencast_instance = cast;
-				++cast->refcount;
-			}
-			logprint(INFO, "xdpw: screencast instance %p now has %d references",
-				cast, cast->refcount);
-		}
-	}
-	*/
 
-	if (!sess->screencast_data.screencast_instance) {
-		sess->screencast_data.screencast_instance = calloc(1, sizeof(struct xdpw_screencast_instance));
-		xdpw_screencast_instance_init(ctx, sess->screencast_data.screencast_instance, target);
+	// A new selection replaces the sources which were selected before
+	struct xdpw_screencast_source *source, *tmp;
+	wl_list_for_each_safe(source, tmp, &sess->screencast_data.sources, link) {
+		xdpw_screencast_source_destroy(source);
 	}
 
-	switch (sess->screencast_data.screencast_instance->target->type) {
-	case MONITOR:
-		logprint(INFO, "wlroots: output: %s", sess->screencast_data.screencast_instance->target->output->name);
-		break;
-	case WINDOW:
-		logprint(INFO, "wlroots: toplevel: %s", sess->screencast_data.screencast_instance->target->toplevel->title);
-		break;
+	// Screencast instances aren't shared between sessions, to avoid
+	// sharing between dmabuf and shm capable clients
+	struct xdpw_screencast_target *target;
+	wl_array_for_each(target, &targets) {
+		assert(target->output || target->toplevel || target->type == VIRTUAL);
+		screencast_source_create(ctx, sess, target);
 	}
+	wl_array_release(&targets);
 
-	return true;
+	return !wl_list_empty(&sess->screencast_data.sources);
+}
 
+void xdpw_screencast_source_destroy(struct xdpw_screencast_source *source) {
+	struct xdpw_screencast_instance *cast = source->cast;
+	wl_list_remove(&source->link);
+	wl_list_remove(&source->instance_link);
+	free(source);
+
+	if (cast) {
+		assert(cast->refcount > 0);
+		--cast->refcount;
+		logprint(DEBUG, "xdpw: screencast instance %p now has %d references",
+			cast, cast->refcount);
+		if (cast->refcount < 1) {
+			logprint(TRACE, "xdpw: destroying screencast instance");
+			xdpw_screencast_instance_destroy(cast);
+		}
+	}
 }
 
 static int start_screencast(struct xdpw_screencast_instance *cast) {
@@ -237,12 +305,218 @@ static int start_screencast(struct xdpw_screencast_instance *cast) {
 		return ret;
 	}
 
-	xdpw_pwr_stream_create(cast);
+	ret = xdpw_pwr_stream_create(cast);
+	if (ret < 0) {
+		return ret;
+	}
 
 	cast->initialized = true;
 	return 0;
 }
 
+static int append_stream(sd_bus_message *msg, struct xdpw_screencast_instance *cast) {
+	int ret = sd_bus_message_open_container(msg, 'r', "ua{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_append(msg, "u", cast->node_id);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_open_container(msg, 'a', "{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+	struct xdpw_pixel_rect *region = &cast->target->region;
+	if (cast->target->output && cast->target->output->xdg_output && region->width > 0) {
+		ret = sd_bus_message_append(msg, "{sv}", "position", "(ii)",
+			cast->target->output->x + (int32_t)region->x, cast->target->output->y + (int32_t)region->y);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_append(msg, "{sv}",
+			"size", "(ii)", region->width, region->height);
+		if (ret < 0) {
+			return ret;
+		}
+	} else if (cast->target->output && cast->target->output->xdg_output) {
+		ret = sd_bus_message_append(msg, "{sv}",
+			"position", "(ii)", cast->target->output->x, cast->target->output->y);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_append(msg, "{sv}",
+			"size", "(ii)", cast->target->output->width, cast->target->output->height);
+		if (ret < 0) {
+			return ret;
+		}
+	} else if (cast->composite) {
+		ret = sd_bus_message_append(msg, "{sv}",
+			"position", "(ii)", cast->composite->x, cast->composite->y);
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_append(msg, "{sv}",
+			"size", "(ii)", cast->composite->width, cast->composite->height);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	ret = sd_bus_message_append(msg, "{sv}", "source_type", "u", target_source_type(cast->target));
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_close_container(msg);
+	if (ret < 0) {
+		return ret;
+	}
+	return sd_bus_message_close_container(msg);
+}
+
+static int append_streams(sd_bus_message *msg, struct xdpw_session *sess) {
+	int ret = sd_bus_message_open_container(msg, 'a', "(ua{sv})");
+	if (ret < 0) {
+		return ret;
+	}
+	struct xdpw_screencast_source *source;
+	wl_list_for_each(source, &sess->screencast_data.sources, link) {
+		if (!source->cast) {
+			continue;
+		}
+		ret = append_stream(msg, source->cast);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return sd_bus_message_close_container(msg);
+}
+
+static int emit_streams_changed(struct xdpw_session *sess) {
+	sd_bus *bus = sd_bus_slot_get_bus(sess->slot);
+	sd_bus_message *signal = NULL;
+
+	int ret = sd_bus_message_new_signal(bus, &signal, sess->session_handle,
+		session_interface_name, "StreamsChanged");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = append_streams(signal, sess);
+	if (ret < 0) {
+		goto out;
+	}
+	ret = sd_bus_send(bus, signal, NULL);
+
+out:
+	sd_bus_message_unref(signal);
+	return ret;
+}
+
+static int append_stream_metrics(sd_bus_message *msg, struct xdpw_screencast_instance *cast) {
+	struct xdpw_screencast_metrics *metrics = &cast->metrics;
+	int ret = sd_bus_message_open_container(msg, 'r', "ua{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_append(msg, "u", cast->node_id);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_append(msg, "a{sv}", 19,
+		"capture_latency_us", "t", metrics->capture_latency_ns / 1000,
+		"buffer_cycle_us", "t", metrics->buffer_cycle_ns / 1000,
+		"damage_ratio", "d", metrics->damage_ratio,
+		"frames_delivered", "t", metrics->frames_delivered,
+		"frames_corrupt", "t", metrics->frames_corrupt,
+		"frames_dropped", "t", metrics->frames_dropped,
+		"frames_skipped", "t", metrics->frames_skipped,
+		"dequeue_failures", "t", metrics->dequeue_failures,
+		"capture_failures", "t", metrics->capture_failures,
+		"renegotiations", "t", metrics->renegotiations,
+		"allocated_bytes", "t", metrics->allocated_bytes,
+		"shm_bytes", "t", metrics->shm_bytes,
+		"dmabuf_bytes", "t", metrics->dmabuf_bytes,
+		"released_bytes", "t", metrics->released_bytes,
+		"framerate", "u", cast->framerate,
+		"buffers", "u", wl_list_length(&cast->buffer_list),
+		"max_buffers", "u", cast->max_buffers,
+		"capture_rate", "d", metrics->capture_rate,
+		"capture_share", "d", metrics->capture_share);
+	if (ret < 0) {
+		return ret;
+	}
+	return sd_bus_message_close_container(msg);
+}
+
+static int get_stream_metrics(sd_bus *bus, const char *path,
+		const char *interface, const char *property,
+		sd_bus_message *reply, void *data, sd_bus_error *ret_error) {
+	struct xdpw_session *sess = data;
+
+	int ret = sd_bus_message_open_container(reply, 'a', "(ua{sv})");
+	if (ret < 0) {
+		return ret;
+	}
+	struct xdpw_screencast_source *source;
+	wl_list_for_each(source, &sess->screencast_data.sources, link) {
+		if (!source->cast || !source->cast->initialized) {
+			continue;
+		}
+		ret = append_stream_metrics(reply, source->cast);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return sd_bus_message_close_container(reply);
+}
+
+static int method_dump_trace(sd_bus_message *msg, void *data,
+		sd_bus_error *ret_error) {
+	if (!xdpw_trace_active) {
+		return sd_bus_error_set(ret_error, SD_BUS_ERROR_NOT_SUPPORTED,
+			"tracing is not enabled, start xdpw with --trace");
+	}
+	logprint(INFO, "dbus: dumping trace on request");
+	if (xdpw_trace_dump() < 0) {
+		return sd_bus_error_set(ret_error, SD_BUS_ERROR_FAILED,
+			"failed to write the trace");
+	}
+	return sd_bus_reply_method_return(msg, "");
+}
+
+void xdpw_screencast_instance_streams_changed(struct xdpw_screencast_instance *cast) {
+	struct xdpw_screencast_source *source;
+	wl_list_for_each(source, &cast->sources, instance_link) {
+		logprint(DEBUG, "dbus: session %s: stream moved to node %u",
+			source->sess->session_handle, cast->node_id);
+		int ret = emit_streams_changed(source->sess);
+		if (ret < 0) {
+			logprint(ERROR, "dbus: failed to emit StreamsChanged: %s", strerror(-ret));
+		}
+	}
+}
+
+static int screencast_ensure_backends(struct xdpw_state *state) {
+	struct xdpw_screencast_context *ctx = &state->screencast;
+	if (ctx->backends_ready) {
+		return 0;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (xdpw_pwr_context_create(state) < 0) {
+		xdpw_pwr_context_destroy(state);
+		return -1;
+	}
+	xdpw_wlr_screencopy_setup(state);
+	ctx->backends_ready = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	logprint(DEBUG, "xdpw: screencast backends initialized in %"PRId64" us",
+		timespec_diff_ns(&end, &start) / 1000);
+	return 0;
+}
+
 static int method_screencast_create_session(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct xdpw_state *state = data;
@@ -297,6 +571,11 @@ static int method_screencast_create_session(sd_bus_message *msg, void *data,
 		return ret;
 	}
 
+	if (screencast_ensure_backends(state) < 0) {
+		return sd_bus_error_set(ret_error, SD_BUS_ERROR_FAILED,
+			"failed to initialize screencast backends");
+	}
+
 	struct xdpw_request *req =
 		xdpw_request_create(sd_bus_message_get_bus(msg), request_handle);
 	if (req == NULL) {
@@ -305,10 +584,19 @@ static int method_screencast_create_session(sd_bus_message *msg, void *data,
 
 	struct xdpw_session *sess =
 		xdpw_session_create(state, sd_bus_message_get_bus(msg), strdup(session_handle));
+	xdpw_request_destroy(req);
 	if (sess == NULL) {
 		return -ENOMEM;
 	}
 
+	ret = sd_bus_add_object_vtable(sd_bus_message_get_bus(msg), &sess->screencast_data.slot,
+		sess->session_handle, session_interface_name, screencast_session_vtable, sess);
+	if (ret < 0) {
+		logprint(ERROR, "dbus: failed to add screencast session vtable: %s", strerror(-ret));
+		xdpw_session_destroy(sess);
+		return ret;
+	}
+
 	sd_bus_message *reply = NULL;
 	ret = sd_bus_message_new_method_return(msg, &reply);
 	if (ret < 0) {
@@ -327,14 +615,109 @@ static int method_screencast_create_session(sd_bus_message *msg, void *data,
 	return 0;
 }
 
+// Reads the a{sv} dictionary of version 1 restore data. Sessions with
+// several sources keep the dictionaries of the sources in "sources".
+static int read_restore_data(sd_bus_message *msg, struct xdpw_screencast_restore_data *data,
+		bool with_sources) {
+	int ret = sd_bus_message_enter_container(msg, 'a', "{sv}");
+	if (ret <= 0) {
+		return ret;
+	}
+	char *key;
+	while ((ret = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
+		ret = sd_bus_message_read(msg, "s", &key);
+		if (ret < 0) {
+			return ret;
+		}
+		if (strcmp(key, "output_name") == 0) {
+			sd_bus_message_read(msg, "v", "s", &data->output_name);
+			logprint(INFO, "dbus: option restore_data.output_name: %s", data->output_name);
+		} else if (strcmp(key, "window_identifier") == 0) {
+			sd_bus_message_read(msg, "v", "s", &data->window_identifier);
+			logprint(INFO, "dbus: option restore_data.window_identifier: %s", data->window_identifier);
+		} else if (strcmp(key, "app_id") == 0) {
+			sd_bus_message_read(msg, "v", "s", &data->app_id);
+			logprint(INFO, "dbus: option restore_data.app_id: %s", data->app_id);
+		} else if (strcmp(key, "title") == 0) {
+			sd_bus_message_read(msg, "v", "s", &data->title);
+			logprint(INFO, "dbus: option restore_data.title: %s", data->title);
+		} else if (strcmp(key, "region") == 0) {
+			int32_t x = 0, y = 0, width = 0, height = 0;
+			sd_bus_message_read(msg, "v", "(iiii)", &x, &y, &width, &height);
+			logprint(INFO, "dbus: option restore_data.region: %d,%d %dx%d", x, y, width, height);
+			if (x >= 0 && y >= 0 && width > 0 && height > 0) {
+				data->has_region = true;
+				data->region = (struct xdpw_pixel_rect){
+					.x = x, .y = y, .width = width, .height = height };
+			}
+		} else if (strcmp(key, "all_outputs") == 0) {
+			int all_outputs = 0;
+			sd_bus_message_read(msg, "v", "b", &all_outputs);
+			data->all_outputs = all_outputs;
+			logprint(INFO, "dbus: option restore_data.all_outputs: %d", all_outputs);
+		} else if (with_sources && strcmp(key, "sources") == 0) {
+			ret = sd_bus_message_enter_container(msg, 'v', "aa{sv}");
+			if (ret < 0) {
+				return ret;
+			}
+			ret = sd_bus_message_enter_container(msg, 'a', "a{sv}");
+			if (ret < 0) {
+				return ret;
+			}
+			while (true) {
+				struct xdpw_screencast_restore_data source = { 0 };
+				ret = read_restore_data(msg, &source, false);
+				if (ret <= 0) {
+					break;
+				}
+				struct xdpw_screencast_restore_data *entry =
+					wl_array_add(&data->sources, sizeof(*entry));
+				if (!entry) {
+					return -ENOMEM;
+				}
+				*entry = source;
+			}
+			if (ret < 0) {
+				return ret;
+			}
+			logprint(INFO, "dbus: option restore_data.sources: %zu",
+				data->sources.size / sizeof(struct xdpw_screencast_restore_data));
+			ret = sd_bus_message_exit_container(msg); // array
+			if (ret < 0) {
+				return ret;
+			}
+			ret = sd_bus_message_exit_container(msg); // variant
+			if (ret < 0) {
+				return ret;
+			}
+		} else {
+			logprint(WARN, "dbus: unknown option %s", key);
+			sd_bus_message_skip(msg, "v");
+		}
+		ret = sd_bus_message_exit_container(msg); // dictionary
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_exit_container(msg); // array
+	if (ret < 0) {
+		return ret;
+	}
+	return 1;
+}
+
 static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct xdpw_state *state = data;
 	struct xdpw_screencast_context *ctx = &state->screencast;
 
 	int ret = 0;
-	struct xdpw_session *sess, *tmp_s;
+	struct xdpw_session *sess = NULL;
 	sd_bus_message *reply = NULL;
+	struct xdpw_screencast_restore_data restore_data = {0};
 
 	logprint(INFO, "dbus: select sources method invoked");
 
@@ -352,42 +735,40 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 	logprint(INFO, "dbus: session_handle: %s", session_handle);
 	logprint(INFO, "dbus: app_id: %s", app_id);
 
-	sess = NULL;
-	wl_list_for_each_reverse_safe(sess, tmp_s, &state->xdpw_sessions, link) {
-		if (strcmp(sess->session_handle, session_handle) == 0) {
-				logprint(DEBUG, "dbus: select sources: found matching session %s", sess->session_handle);
-				break;
-		}
-	}
+	sess = xdpw_session_find(state, session_handle);
 	if (!sess) {
-		logprint(WARN, "dbus: select sources: no matching session %s found", sess->session_handle);
+		logprint(WARN, "dbus: select sources: no matching session %s found", session_handle);
 		goto error;
 	}
+	logprint(DEBUG, "dbus: select sources: found matching session %s", sess->session_handle);
 
 	// default to embedded cursor mode if not specified
 	sess->screencast_data.cursor_mode = EMBEDDED;
 	// default to no persist if not specified
 	sess->screencast_data.persist_mode = PERSIST_NONE;
+	sess->screencast_data.multiple = false;
 
 	char *key;
 	int innerRet = 0;
 	uint32_t type_mask = 0;
-	struct xdpw_screencast_restore_data restore_data = {0};
 	while ((ret = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
 		innerRet = sd_bus_message_read(msg, "s", &key);
 		if (innerRet < 0) {
-			return innerRet;
+			ret = innerRet;
+			goto release;
 		}
 
 		if (strcmp(key, "multiple") == 0) {
 			int multiple;
 			sd_bus_message_read(msg, "v", "b", &multiple);
+			sess->screencast_data.multiple = multiple;
 			logprint(INFO, "dbus: option multiple: %d", multiple);
 		} else if (strcmp(key, "types") == 0) {
 			sd_bus_message_read(msg, "v", "u", &type_mask);
 			if (!(type_mask & (MONITOR | WINDOW))) {
 				logprint(INFO, "dbus: non-monitor non-window cast requested, not replying");
-				return -1;
+				ret = -1;
+				goto release;
 			}
 			logprint(INFO, "dbus: option types: %x", type_mask);
 		} else if (strcmp(key, "cursor_mode") == 0) {
@@ -403,12 +784,14 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 			innerRet = sd_bus_message_enter_container(msg, 'v', "(suv)");
 			if (innerRet < 0) {
 				logprint(ERROR, "dbus: error entering variant");
-				return innerRet;
+				ret = innerRet;
+				goto release;
 			}
 			innerRet = sd_bus_message_enter_container(msg, 'r', "suv");
 			if (innerRet < 0) {
 				logprint(ERROR, "dbus: error entering struct");
-				return innerRet;
+				ret = innerRet;
+				goto release;
 			}
 			sd_bus_message_read(msg, "s", &portal_vendor);
 			if (strcmp(portal_vendor, "wlroots") != 0) {
@@ -420,42 +803,19 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 			if (restore_data.version == 1) {
 				innerRet = sd_bus_message_enter_container(msg, 'v', "a{sv}");
 				if (innerRet < 0) {
-					return innerRet;
-				}
-				innerRet = sd_bus_message_enter_container(msg, 'a', "{sv}");
-				if (innerRet < 0) {
-					return innerRet;
+					ret = innerRet;
+					goto release;
 				}
 				logprint(INFO, "dbus: restoring session from data");
-				int rdRet;
-				char *rdKey;
-				while ((innerRet = sd_bus_message_enter_container(msg, 'e', "sv")) > 0) {
-					rdRet = sd_bus_message_read(msg, "s", &rdKey);
-					if (rdRet < 0) {
-						return rdRet;
-					}
-					if (strcmp(rdKey, "output_name") == 0) {
-						sd_bus_message_read(msg, "v", "s", &restore_data.output_name);
-						logprint(INFO, "dbus: option restore_data.output_name: %s", restore_data.output_name);
-					} else {
-						logprint(WARN, "dbus: unknown option %s", rdKey);
-						sd_bus_message_skip(msg, "v");
-					}
-					innerRet = sd_bus_message_exit_container(msg); // dictionary
-					if (innerRet < 0) {
-						return innerRet;
-					}
-				}
+				innerRet = read_restore_data(msg, &restore_data, true);
 				if (innerRet < 0) {
-					return innerRet;
-				}
-				innerRet = sd_bus_message_exit_container(msg); //array
-				if (innerRet < 0) {
-					return innerRet;
+					ret = innerRet;
+					goto release;
 				}
 				innerRet = sd_bus_message_exit_container(msg); //variant
 				if (innerRet < 0) {
-					return innerRet;
+					ret = innerRet;
+					goto release;
 				}
 			} else {
 				sd_bus_message_skip(msg, "v");
@@ -463,11 +823,13 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 			}
 			innerRet = sd_bus_message_exit_container(msg); // struct
 			if (innerRet < 0) {
-				return innerRet;
+				ret = innerRet;
+				goto release;
 			}
 			innerRet = sd_bus_message_exit_container(msg); // variant
 			if (innerRet < 0) {
-				return innerRet;
+				ret = innerRet;
+				goto release;
 			}
 		} else if (strcmp(key, "persist_mode") == 0) {
 			sd_bus_message_read(msg, "v", "u", &sess->screencast_data.persist_mode);
@@ -478,19 +840,21 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 		}
 
 		innerRet = sd_bus_message_exit_container(msg);
-		if (ret < 0) {
-			return ret;
+		if (innerRet < 0) {
+			ret = innerRet;
+			goto release;
 		}
 	}
 	if (ret < 0) {
-		return ret;
+		goto release;
 	}
 	ret = sd_bus_message_exit_container(msg);
 	if (ret < 0) {
-		return ret;
+		goto release;
 	}
 
 	bool selection_canceled = !setup_target(ctx, sess, restore_data.version > 0 ? &restore_data : NULL, type_mask);
+	wl_array_release(&restore_data.sources);
 
 	ret = sd_bus_message_new_method_return(msg, &reply);
 	if (ret < 0) {
@@ -511,7 +875,12 @@ static int method_screencast_select_sources(sd_bus_message *msg, void *data,
 	sd_bus_message_unref(reply);
 	return 0;
 
+release:
+	wl_array_release(&restore_data.sources);
+	return ret;
+
 error:
+	wl_array_release(&restore_data.sources);
 	if (sess) {
 		xdpw_session_destroy(sess);
 	}
@@ -532,6 +901,115 @@ error:
 	return -1;
 }
 
+static bool target_persistable(struct xdpw_screencast_target *target) {
+	return target->output || (target->toplevel && target->toplevel->identifier) ||
+		target->type == VIRTUAL;
+}
+
+// Appends the a{sv} dictionary which restores a source
+static int append_restore_source(sd_bus_message *msg, struct xdpw_screencast_target *target) {
+	struct xdpw_pixel_rect *region = &target->region;
+	if (target->output && region->width > 0) {
+		return sd_bus_message_append(msg, "a{sv}", 2,
+			"output_name", "s", target->output->name,
+			"region", "(iiii)", region->x, region->y, region->width, region->height);
+	} else if (target->output) {
+		return sd_bus_message_append(msg, "a{sv}", 1,
+			"output_name", "s", target->output->name);
+	} else if (target->toplevel) {
+		struct xdpw_toplevel *toplevel = target->toplevel;
+		return sd_bus_message_append(msg, "a{sv}", 3,
+			"window_identifier", "s", toplevel->identifier,
+			"app_id", "s", toplevel->app_id ? toplevel->app_id : "",
+			"title", "s", toplevel->title ? toplevel->title : "");
+	}
+	return sd_bus_message_append(msg, "a{sv}", 1, "all_outputs", "b", 1);
+}
+
+// Sessions with a single source keep the restore data of earlier versions,
+// the dictionaries of several sources are listed in "sources"
+static int append_restore_data(sd_bus_message *msg, struct xdpw_session *sess) {
+	struct xdpw_screencast_source *source;
+	wl_list_for_each(source, &sess->screencast_data.sources, link) {
+		if (!target_persistable(source->cast->target)) {
+			return 0;
+		}
+	}
+	bool multiple = wl_list_length(&sess->screencast_data.sources) > 1;
+
+	int ret = sd_bus_message_open_container(msg, 'e', "sv");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_append(msg, "s", "restore_data");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_open_container(msg, 'v', "(suv)");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_open_container(msg, 'r', "suv");
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_append(msg, "su", "wlroots", XDP_CAST_DATA_VER);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = sd_bus_message_open_container(msg, 'v', "a{sv}");
+	if (ret < 0) {
+		return ret;
+	}
+	if (!multiple) {
+		source = wl_container_of(sess->screencast_data.sources.next, source, link);
+		ret = append_restore_source(msg, source->cast->target);
+		if (ret < 0) {
+			return ret;
+		}
+	} else {
+		ret = sd_bus_message_open_container(msg, 'a', "{sv}");
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_open_container(msg, 'e', "sv");
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_append(msg, "s", "sources");
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_open_container(msg, 'v', "aa{sv}");
+		if (ret < 0) {
+			return ret;
+		}
+		ret = sd_bus_message_open_container(msg, 'a', "a{sv}");
+		if (ret < 0) {
+			return ret;
+		}
+		wl_list_for_each(source, &sess->screencast_data.sources, link) {
+			ret = append_restore_source(msg, source->cast->target);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+		for (int i = 0; i < 4; i++) {
+			ret = sd_bus_message_close_container(msg);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		ret = sd_bus_message_close_container(msg);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
 static int method_screencast_start(sd_bus_message *msg, void *data,
 		sd_bus_error *ret_error) {
 	struct xdpw_state *state = data;
@@ -577,40 +1055,56 @@ static int method_screencast_start(sd_bus_message *msg, void *data,
 		return ret;
 	}
 
-	struct xdpw_screencast_instance *cast = NULL;
-	struct xdpw_session *sess, *tmp_s;
-	wl_list_for_each_reverse_safe(sess, tmp_s, &state->xdpw_sessions, link) {
-		if (strcmp(sess->session_handle, session_handle) == 0) {
-				logprint(DEBUG, "dbus: start: found matching session %s", sess->session_handle);
-				cast = sess->screencast_data.screencast_instance;
-		}
-	}
-	if (!cast) {
+	struct xdpw_session *sess = xdpw_session_find(state, session_handle);
+	if (!sess) {
+		logprint(WARN, "dbus: start: no matching session %s found", session_handle);
 		return -1;
 	}
-
-	if (!cast->initialized) {
-		ret = start_screencast(cast);
-	}
-	if (ret < 0) {
-		return ret;
+	logprint(DEBUG, "dbus: start: found matching session %s", sess->session_handle);
+	if (wl_list_empty(&sess->screencast_data.sources)) {
+		return -1;
 	}
 
-	while (cast->node_id == SPA_ID_INVALID) {
-		int ret = pw_loop_iterate(state->pw_loop, 0);
+	// The streams of the sources which were started already would never
+	// be announced to the client, so the session ends if any source fails
+	struct xdpw_screencast_source *source;
+	wl_list_for_each(source, &sess->screencast_data.sources, link) {
+		if (!source->cast->initialized) {
+			ret = start_screencast(source->cast);
+		}
 		if (ret < 0) {
-			logprint(ERROR, "pipewire_loop_iterate failed: %s", spa_strerror(ret));
+			logprint(ERROR, "dbus: start: failed to start a source of session %s",
+				sess->session_handle);
+			xdpw_session_destroy(sess);
 			return ret;
 		}
 	}
 
+	// The streams of all sources are returned at once
+	wl_list_for_each(source, &sess->screencast_data.sources, link) {
+		// Iterating the pipewire loop might have ended the session
+		while (source->cast && source->cast->node_id == SPA_ID_INVALID) {
+			ret = pw_loop_iterate(state->pw_loop, 0);
+			if (ret < 0) {
+				logprint(ERROR, "pipewire_loop_iterate failed: %s", spa_strerror(ret));
+				xdpw_session_destroy(sess);
+				return ret;
+			}
+		}
+		if (!source->cast) {
+			logprint(WARN, "dbus: start: session %s ended while starting", sess->session_handle);
+			xdpw_session_destroy(sess);
+			return -1;
+		}
+		logprint(DEBUG, "dbus: start: returning node %d", (int)source->cast->node_id);
+	}
+
 	sd_bus_message *reply = NULL;
 	ret = sd_bus_message_new_method_return(msg, &reply);
 	if (ret < 0) {
 		return ret;
 	}
 
-	logprint(DEBUG, "dbus: start: returning node %d", (int)cast->node_id);
 	ret = sd_bus_message_append(reply, "u", PORTAL_RESPONSE_SUCCESS);
 	if (ret < 0) {
 		return ret;
@@ -631,47 +1125,7 @@ static int method_screencast_start(sd_bus_message *msg, void *data,
 	if (ret < 0) {
 		return ret;
 	}
-	ret = sd_bus_message_open_container(reply, 'a', "(ua{sv})");
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_open_container(reply, 'r', "ua{sv}");
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_append(reply, "u", cast->node_id);
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_open_container(reply, 'a', "{sv}");
-	if (ret < 0) {
-		return ret;
-	}
-	if (cast->target->output && cast->target->output->xdg_output) {
-		ret = sd_bus_message_append(reply, "{sv}",
-			"position", "(ii)", cast->target->output->x, cast->target->output->y);
-		if (ret < 0) {
-			return ret;
-		}
-		ret = sd_bus_message_append(reply, "{sv}",
-			"size", "(ii)", cast->target->output->width, cast->target->output->height);
-		if (ret < 0) {
-			return ret;
-		}
-	}
-	ret = sd_bus_message_append(reply, "{sv}", "source_type", "u", cast->target->type);
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_close_container(reply);
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_close_container(reply);
-	if (ret < 0) {
-		return ret;
-	}
-	ret = sd_bus_message_close_container(reply);
+	ret = append_streams(reply, sess);
 	if (ret < 0) {
 		return ret;
 	}
@@ -688,13 +1142,8 @@ static int method_screencast_start(sd_bus_message *msg, void *data,
 	if (ret < 0) {
 		return ret;
 	}
-	if (sess->screencast_data.persist_mode != PERSIST_NONE && cast->target->output) {
-		struct xdpw_screencast_restore_data restore_data;
-		restore_data.output_name = cast->target->output->name;
-		ret = sd_bus_message_append(reply, "{sv}",
-			"restore_data", "(suv)",
-			"wlroots", XDP_CAST_DATA_VER,
-			"a{sv}", 1, "output_name", "s", restore_data.output_name);
+	if (sess->screencast_data.persist_mode != PERSIST_NONE) {
+		ret = append_restore_data(reply, sess);
 		if (ret < 0) {
 			return ret;
 		}
@@ -741,24 +1190,18 @@ int xdpw_screencast_init(struct xdpw_state *state) {
 	state->screencast.state = state;
 
 	int err;
-	err = xdpw_pwr_context_create(state);
-	if (err) {
-		goto fail_pipewire;
-	}
-
 	err = xdpw_wlr_screencopy_init(state);
 	if (err) {
-		goto fail_screencopy;
+		xdpw_wlr_screencopy_finish(&state->screencast);
+		return err;
 	}
 
 	return sd_bus_add_object_vtable(state->bus, &slot, object_path, interface_name,
 		screencast_vtable, state);
+}
 
-fail_screencopy:
+void xdpw_screencast_finish(struct xdpw_state *state) {
 	xdpw_wlr_screencopy_finish(&state->screencast);
-
-fail_pipewire:
 	xdpw_pwr_context_destroy(state);
-
-	return err;
+	xdpw_worker_pool_finish();
 }
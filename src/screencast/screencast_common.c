@@ -1,6 +1,11 @@
+#ifdef __linux__
+#define _GNU_SOURCE // for fallocate
+#endif
+
 #include "xdpw.h"
 #include "screencast_common.h"
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -103,6 +108,77 @@ static struct wl_buffer *import_wl_shm_buffer(struct xdpw_screencast_instance *c
 	return buffer;
 }
 
+struct xdpw_shm_format *xdpw_find_shm_format(struct xdpw_buffer_constraints *constraints,
+		uint32_t format) {
+	struct xdpw_shm_format *fmt;
+	wl_array_for_each(fmt, &constraints->shm_formats) {
+		if (fmt->fourcc == format) {
+			return fmt;
+		}
+	}
+	return NULL;
+}
+
+// Planes of shm buffers are laid out one after another in a single memfd
+static size_t shm_buffer_map_size(const struct xdpw_buffer *buffer) {
+	int last = buffer->plane_count - 1;
+	return (size_t)buffer->offset[last] + buffer->size[last];
+}
+
+static void shm_buffer_set_plane(struct xdpw_buffer *buffer, uint32_t stride) {
+	buffer->plane_count = 1;
+	buffer->size[0] = stride * buffer->height;
+	buffer->stride[0] = stride;
+	buffer->offset[0] = 0;
+}
+
+static bool shm_buffer_init(struct xdpw_screencast_instance *cast, struct xdpw_buffer *buffer,
+		bool import) {
+	for (int plane = 0; plane < buffer->plane_count; plane++) {
+		buffer->fd[plane] = -1;
+	}
+	size_t size = shm_buffer_map_size(buffer);
+
+	buffer->fd[0] = anonymous_shm_open();
+	if (buffer->fd[0] == -1) {
+		logprint(ERROR, "xdpw: unable to create anonymous filedescriptor");
+		return false;
+	}
+
+	if (ftruncate(buffer->fd[0], size) < 0) {
+		logprint(ERROR, "xdpw: unable to truncate filedescriptor");
+		return false;
+	}
+
+	// Every plane needs its own fd in the spa buffer
+	for (int plane = 1; plane < buffer->plane_count; plane++) {
+		buffer->fd[plane] = fcntl(buffer->fd[0], F_DUPFD_CLOEXEC, 0);
+		if (buffer->fd[plane] < 0) {
+			logprint(ERROR, "xdpw: unable to duplicate filedescriptor");
+			return false;
+		}
+	}
+
+	buffer->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd[0], 0);
+	if (buffer->data == MAP_FAILED) {
+		logprint(ERROR, "xdpw: unable to mmap filedescriptor");
+		buffer->data = NULL;
+		return false;
+	}
+
+	if (!import) {
+		return true;
+	}
+
+	buffer->buffer = import_wl_shm_buffer(cast, buffer->fd[0], xdpw_format_wl_shm_from_drm_fourcc(buffer->format),
+		buffer->width, buffer->height, buffer->stride[0]);
+	if (buffer->buffer == NULL) {
+		logprint(ERROR, "xdpw: unable to create wl_buffer");
+		return false;
+	}
+	return true;
+}
+
 struct xdpw_buffer *xdpw_buffer_create(struct xdpw_screencast_instance *cast,
 		enum buffer_type buffer_type) {
 	struct xdpw_buffer *buffer = calloc(1, sizeof(struct xdpw_buffer));
@@ -115,49 +191,45 @@ struct xdpw_buffer *xdpw_buffer_create(struct xdpw_screencast_instance *cast,
 	buffer->buffer_type = buffer_type;
 	buffer->format = format;
 	wl_array_init(&buffer->damage);
+	wl_array_init(&buffer->convert_damage);
 
 	switch (buffer_type) {
 	case WL_SHM:;
-		struct xdpw_shm_format *fmt;
-		bool found = false;
-		wl_array_for_each(fmt, &cast->current_constraints.shm_formats) {
-			if (fmt->fourcc == format) {
-				found = true;
-				break;
+		if (cast->converting || cast->scaling || cast->composite) {
+			// The compositor copies into the staging buffer, or the
+			// outputs are composed in it, so this buffer is only
+			// shared with the consumer
+			buffer->converted = true;
+			buffer->convert_full = true;
+			if (cast->scaling) {
+				buffer->width = cast->scale.dst_width;
+				buffer->height = cast->scale.dst_height;
 			}
+			if (cast->converting) {
+				buffer->plane_count = xdpw_pixel_convert_layout(&cast->convert,
+					buffer->width, buffer->height, buffer->stride, buffer->offset, buffer->size);
+			} else {
+				// Scaled and composed formats have 4 bytes per pixel
+				shm_buffer_set_plane(buffer, 4 * buffer->width);
+			}
+			if (!shm_buffer_init(cast, buffer, false)) {
+				xdpw_buffer_destroy(buffer);
+				return NULL;
+			}
+			break;
 		}
-		if (!found) {
+		struct xdpw_shm_format *fmt = xdpw_find_shm_format(&cast->current_constraints, format);
+		if (fmt == NULL) {
 			logprint(ERROR, "xdpw: unable to find format: %d", format);
 			xdpw_buffer_destroy(buffer);
 			return NULL;
-
-		}
-
-		buffer->plane_count = 1;
-		buffer->size[0] = fmt->stride * buffer->height;
-		buffer->stride[0] = fmt->stride;
-		buffer->offset[0] = 0;
-		buffer->fd[0] = anonymous_shm_open();
-		if (buffer->fd[0] == -1) {
-			logprint(ERROR, "xdpw: unable to create anonymous filedescriptor");
-			xdpw_buffer_destroy(buffer);
-			return NULL;
 		}
 
-		if (ftruncate(buffer->fd[0], buffer->size[0]) < 0) {
-			logprint(ERROR, "xdpw: unable to truncate filedescriptor");
+		shm_buffer_set_plane(buffer, fmt->stride);
+		if (!shm_buffer_init(cast, buffer, true)) {
 			xdpw_buffer_destroy(buffer);
 			return NULL;
 		}
-
-		buffer->buffer = import_wl_shm_buffer(cast, buffer->fd[0], xdpw_format_wl_shm_from_drm_fourcc(format),
-			buffer->width, buffer->height, fmt->stride);
-		if (buffer->buffer == NULL) {
-			logprint(ERROR, "xdpw: unable to create wl_buffer");
-			close(buffer->fd[0]);
-			free(buffer);
-			return NULL;
-		}
 		break;
 	case DMABUF:;
 		struct gbm_bo *bo;
@@ -230,17 +302,175 @@ struct xdpw_buffer *xdpw_buffer_create(struct xdpw_screencast_instance *cast,
 	return buffer;
 }
 
+struct xdpw_buffer *xdpw_staging_buffer_create(struct xdpw_screencast_instance *cast) {
+	assert(cast->converting || cast->scaling || cast->composite);
+
+	struct xdpw_shm_format *fmt =
+		xdpw_find_shm_format(&cast->current_constraints, cast->staging_format);
+	if (fmt == NULL) {
+		logprint(ERROR, "xdpw: unable to find staging format: %d", cast->staging_format);
+		return NULL;
+	}
+
+	struct xdpw_buffer *buffer = calloc(1, sizeof(struct xdpw_buffer));
+	buffer->width = cast->current_constraints.width;
+	buffer->height = cast->current_constraints.height;
+	buffer->buffer_type = WL_SHM;
+	buffer->format = fmt->fourcc;
+	wl_array_init(&buffer->damage);
+	wl_array_init(&buffer->convert_damage);
+
+	shm_buffer_set_plane(buffer, fmt->stride);
+	// Composed frames never go through the compositor
+	if (!shm_buffer_init(cast, buffer, !cast->composite)) {
+		xdpw_buffer_destroy(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+struct xdpw_buffer *xdpw_scaled_buffer_create(struct xdpw_screencast_instance *cast) {
+	assert(cast->converting && cast->scaling);
+
+	struct xdpw_buffer *buffer = calloc(1, sizeof(struct xdpw_buffer));
+	buffer->width = cast->scale.dst_width;
+	buffer->height = cast->scale.dst_height;
+	buffer->buffer_type = WL_SHM;
+	buffer->format = cast->staging_format;
+	wl_array_init(&buffer->damage);
+	wl_array_init(&buffer->convert_damage);
+
+	shm_buffer_set_plane(buffer, 4 * buffer->width);
+	if (!shm_buffer_init(cast, buffer, false)) {
+		xdpw_buffer_destroy(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+// Returns the buffer the compositor copies the current frame into
+struct xdpw_buffer *xdpw_frame_capture_buffer(struct xdpw_screencast_instance *cast) {
+	struct xdpw_buffer *buffer = cast->current_frame.xdpw_buffer;
+	if (buffer && buffer->converted) {
+		return cast->staging_buffer;
+	}
+	return buffer;
+}
+
 void xdpw_buffer_destroy(struct xdpw_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
 	}
+	if (buffer->data) {
+		munmap(buffer->data, shm_buffer_map_size(buffer));
+	}
 	for (int plane = 0; plane < buffer->plane_count; plane++) {
 		close(buffer->fd[plane]);
 	}
 	wl_array_release(&buffer->damage);
+	wl_array_release(&buffer->convert_damage);
 	free(buffer);
 }
 
+uint64_t xdpw_buffer_allocated_size(struct xdpw_buffer *buffer) {
+	uint64_t size = 0;
+	for (int plane = 0; plane < buffer->plane_count; plane++) {
+		if (buffer->size[plane] > 0) {
+			size += buffer->size[plane];
+		} else {
+			// dmabuf planes don't report a size
+			size += (uint64_t)buffer->stride[plane] * buffer->height;
+		}
+	}
+	return size;
+}
+
+void xdpw_buffer_account(struct xdpw_screencast_instance *cast,
+		struct xdpw_buffer *buffer, bool allocated) {
+	uint64_t size = xdpw_buffer_allocated_size(buffer);
+	uint64_t *type_bytes = buffer->buffer_type == DMABUF ?
+		&cast->metrics.dmabuf_bytes : &cast->metrics.shm_bytes;
+	if (allocated) {
+		cast->metrics.allocated_bytes += size;
+		*type_bytes += size;
+		cast->ctx->allocated_bytes += size;
+	} else {
+		cast->metrics.allocated_bytes -= size;
+		*type_bytes -= size;
+		cast->ctx->allocated_bytes -= size;
+	}
+}
+
+size_t xdpw_buffer_release_memory(struct xdpw_buffer *buffer) {
+	// dmabufs are shared with the consumer and the compositor, there is
+	// no way to release their memory without renegotiating the stream
+	if (buffer->buffer_type != WL_SHM) {
+		return 0;
+	}
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+	// Punching a hole keeps the fd and every mapping valid, the pages
+	// are allocated again once the buffer is written to
+	size_t size = shm_buffer_map_size(buffer);
+	if (fallocate(buffer->fd[0], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			0, size) < 0) {
+		logprint(WARN, "xdpw: unable to release buffer memory: %s", strerror(errno));
+		return 0;
+	}
+
+	// The content is gone, so the whole buffer needs to be copied again
+	buffer->damage.size = 0;
+	struct xdpw_frame_damage *damage = wl_array_add(&buffer->damage, sizeof(*damage));
+	if (damage) {
+		*damage = (struct xdpw_frame_damage){ .x = 0, .y = 0,
+			.width = buffer->width, .height = buffer->height };
+	}
+	buffer->convert_full = true;
+	return size;
+#else
+	return 0;
+#endif
+}
+
+void xdpw_buffer_flip_y(struct xdpw_buffer *buffer) {
+	assert(buffer->buffer_type == WL_SHM && buffer->data);
+
+	uint32_t stride = buffer->stride[0];
+	uint8_t *tmp = malloc(stride);
+	if (tmp == NULL) {
+		logprint(ERROR, "xdpw: unable to allocate row for flipping");
+		return;
+	}
+
+	// memcpy is vectorized by libc, so a plain row swap is as fast as
+	// hand-written SIMD here
+	uint8_t *top = buffer->data;
+	uint8_t *bottom = top + (size_t)(buffer->height - 1) * stride;
+	while (top < bottom) {
+		memcpy(tmp, top, stride);
+		memcpy(top, bottom, stride);
+		memcpy(bottom, tmp, stride);
+		top += stride;
+		bottom -= stride;
+	}
+	free(tmp);
+}
+
+// Returns the transform of a buffer which is y-inverted before
+// transform is applied, see wlr_output_transform_compose
+uint32_t xdpw_transform_flip_y(uint32_t transform) {
+	uint32_t y_invert = WL_OUTPUT_TRANSFORM_FLIPPED_180;
+	uint32_t flipped = (y_invert ^ transform) & WL_OUTPUT_TRANSFORM_FLIPPED;
+	uint32_t rotation_mask = WL_OUTPUT_TRANSFORM_90 | WL_OUTPUT_TRANSFORM_180;
+	uint32_t rotated;
+	if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+		rotated = (transform - y_invert) & rotation_mask;
+	} else {
+		rotated = (y_invert + transform) & rotation_mask;
+	}
+	return flipped | rotated;
+}
+
 enum wl_shm_format xdpw_format_wl_shm_from_drm_fourcc(uint32_t format) {
 	switch (format) {
 	case DRM_FORMAT_ARGB8888:
@@ -283,6 +513,8 @@ enum spa_video_format xdpw_format_pw_from_drm_fourcc(uint32_t format) {
 		return SPA_VIDEO_FORMAT_xRGB;
 	case DRM_FORMAT_NV12:
 		return SPA_VIDEO_FORMAT_NV12;
+	case DRM_FORMAT_YUV420:
+		return SPA_VIDEO_FORMAT_I420;
 	case DRM_FORMAT_XRGB2101010:
 		return SPA_VIDEO_FORMAT_xRGB_210LE;
 	case DRM_FORMAT_XBGR2101010:
@@ -355,6 +587,8 @@ uint32_t xdpw_format_drm_fourcc_from_pw_format(enum spa_video_format format) {
 		return DRM_FORMAT_BGRX8888;
 	case SPA_VIDEO_FORMAT_NV12:
 		return DRM_FORMAT_NV12;
+	case SPA_VIDEO_FORMAT_I420:
+		return DRM_FORMAT_YUV420;
 	case SPA_VIDEO_FORMAT_xRGB_210LE:
 		return DRM_FORMAT_XRGB2101010;
 	case SPA_VIDEO_FORMAT_xBGR_210LE:
@@ -435,7 +669,7 @@ const char *chooser_type_str(enum xdpw_chooser_types chooser_type) {
 struct xdpw_frame_damage merge_damage(struct xdpw_frame_damage *damage1, struct xdpw_frame_damage *damage2) {
 	struct xdpw_frame_damage damage;
 	uint32_t x0, y0;
-	damage.x = damage1->x < damage2->y ? damage1->x : damage2->x;
+	damage.x = damage1->x < damage2->x ? damage1->x : damage2->x;
 	damage.y = damage1->y < damage2->y ? damage1->y : damage2->y;
 
 	x0 = damage1->x + damage1->width < damage2->x + damage2->width ? damage2->x + damage2->width : damage1->x + damage1->width;
@@ -19,17 +19,40 @@
 #include <wayland-client-protocol.h>
 #include <xf86drm.h>
 
+#include "capture_scheduler.h"
+#include "composite.h"
 #include "screencast.h"
 #include "wlr_screencopy.h"
 #include "ext_image_copy.h"
+#include "pipewire_screencast.h"
 #include "xdpw.h"
 #include "logger.h"
 #include "fps_limit.h"
+#include "timespec_util.h"
+#include "trace.h"
+
+#define CAPTURE_RETRY_DELAY_NS 50000000ULL
+#define CAPTURE_RETRY_DELAY_MAX_NS 5000000000ULL
+
+// Regions of outputs can only be captured through wlr-screencopy
+static bool wlr_use_ext(struct xdpw_screencast_instance *cast) {
+	if (cast->target->region.width > 0 && cast->ctx->screencopy_manager) {
+		return false;
+	}
+	return cast->ctx->ext_image_copy_capture_manager
+		&& cast->ctx->ext_output_image_capture_source_manager;
+}
 
 static void wlr_frame_capture_start(struct xdpw_screencast_instance *cast) {
+	if (cast->detached_output_name) {
+		return;
+	}
 	fps_limit_measure_start(&cast->fps_limit, cast->framerate);
-	if (cast->ctx->ext_image_copy_capture_manager
-			&& cast->ctx->ext_output_image_capture_source_manager) {
+	clock_gettime(CLOCK_MONOTONIC, &cast->metrics.capture_start);
+	xdpw_trace_async_begin("capture", (uintptr_t)cast);
+	if (cast->target->type == VIRTUAL) {
+		xdpw_composite_frame_capture(cast);
+	} else if (wlr_use_ext(cast)) {
 		xdpw_ext_ic_frame_capture(cast);
 	} else if (cast->ctx->screencopy_manager) {
 		xdpw_wlr_sc_frame_capture(cast);
@@ -37,21 +60,69 @@ static void wlr_frame_capture_start(struct xdpw_screencast_instance *cast) {
 }
 
 static void wlr_frame_capture_timer(void *data) {
-	wlr_frame_capture_start((struct xdpw_screencast_instance *)data);
+	struct xdpw_screencast_instance *cast = data;
+	cast->capture_timer = NULL;
+	wlr_frame_capture_start(cast);
+}
+
+static void wlr_frame_capture_schedule(struct xdpw_screencast_instance *cast, uint64_t delay_ns) {
+	xdpw_destroy_timer(cast->capture_timer);
+	cast->capture_timer = xdpw_add_timer(cast->ctx->state, delay_ns, wlr_frame_capture_timer, cast);
 }
 
 void xdpw_wlr_frame_capture(struct xdpw_screencast_instance *cast) {
+	if (cast->detached_output_name) {
+		logprint(DEBUG, "wlroots: output %s is detached, not capturing", cast->detached_output_name);
+		return;
+	}
+	xdpw_trace_begin("xdpw_wlr_frame_capture");
 	uint64_t delay_ns = fps_limit_measure_end(&cast->fps_limit, cast->framerate);
+	xdpw_trace_counter("fps_limit_delay_us", delay_ns / 1000);
+	delay_ns = xdpw_capture_scheduler_delay(cast, delay_ns);
 	if (delay_ns > 0) {
-		xdpw_add_timer(cast->ctx->state, delay_ns, wlr_frame_capture_timer, cast);
+		wlr_frame_capture_schedule(cast, delay_ns);
 	} else {
 		wlr_frame_capture_start(cast);
 	}
+	xdpw_trace_end("xdpw_wlr_frame_capture");
+}
+
+void xdpw_wlr_frame_failed(struct xdpw_screencast_instance *cast) {
+	cast->capture_failures++;
+	cast->metrics.capture_failures++;
+	xdpw_trace_counter("capture_failures", cast->capture_failures);
+
+	int retries = cast->ctx->state->config->screencast_conf.capture_retries;
+	if (cast->capture_failures > (uint32_t)MAX(retries, 0)) {
+		logprint(ERROR, "wlroots: frame capture failed %u times in a row, stopping screencast",
+			cast->capture_failures);
+		if (cast->composite_output) {
+			// The other outputs of the composite keep going
+			xdpw_composite_output_failed(cast);
+		} else {
+			xdpw_screencast_instance_destroy(cast);
+		}
+		return;
+	}
+
+	// Recreate the capture session and retry with the buffer we still
+	// hold, so that the pipewire stream isn't affected
+	xdpw_wlr_session_close(cast);
+
+	uint64_t delay_ns = CAPTURE_RETRY_DELAY_NS << MIN(cast->capture_failures - 1, 16);
+	if (delay_ns > CAPTURE_RETRY_DELAY_MAX_NS) {
+		delay_ns = CAPTURE_RETRY_DELAY_MAX_NS;
+	}
+	logprint(WARN, "wlroots: frame capture failed, retrying in %"PRIu64" ms (%u/%d)",
+		delay_ns / 1000000, cast->capture_failures, retries);
+	wlr_frame_capture_schedule(cast, delay_ns);
 }
 
 void xdpw_wlr_session_close(struct xdpw_screencast_instance *cast) {
-	if (cast->ctx->ext_image_copy_capture_manager
-			&& cast->ctx->ext_output_image_capture_source_manager) {
+	xdpw_capture_scheduler_leave(cast);
+	if (cast->target->type == VIRTUAL) {
+		xdpw_composite_session_close(cast);
+	} else if (wlr_use_ext(cast)) {
 		xdpw_ext_ic_session_close(cast);
 	} else if (cast->ctx->screencopy_manager) {
 		xdpw_wlr_sc_session_close(cast);
@@ -59,8 +130,9 @@ void xdpw_wlr_session_close(struct xdpw_screencast_instance *cast) {
 }
 
 int xdpw_wlr_session_init(struct xdpw_screencast_instance *cast) {
-	if (cast->ctx->ext_image_copy_capture_manager
-			&& cast->ctx->ext_output_image_capture_source_manager) {
+	if (cast->target->type == VIRTUAL) {
+		return xdpw_composite_session_init(cast);
+	} else if (wlr_use_ext(cast)) {
 		return xdpw_ext_ic_session_init(cast);
 	} else if (cast->ctx->screencopy_manager) {
 		return xdpw_wlr_sc_session_init(cast);
@@ -83,8 +155,41 @@ static void wlr_output_handle_mode(void *data, struct wl_output *wl_output,
 	}
 }
 
+static void wlr_output_rebind(struct xdpw_wlr_output *output) {
+	struct xdpw_screencast_instance *cast;
+	wl_list_for_each(cast, &output->ctx->screencast_instances, link) {
+		if (!cast->detached_output_name || strcmp(cast->detached_output_name, output->name) != 0) {
+			continue;
+		}
+
+		logprint(INFO, "wlroots: output %s is back, resuming screencast", output->name);
+		free(cast->detached_output_name);
+		cast->detached_output_name = NULL;
+		xdpw_destroy_timer(cast->detach_timer);
+		cast->detach_timer = NULL;
+		// Failures from before the output went away don't count against
+		// the new one, and a pending retry is superseded below
+		cast->capture_failures = 0;
+		xdpw_destroy_timer(cast->capture_timer);
+		cast->capture_timer = NULL;
+
+		cast->target->output = output;
+		if (cast->stream) {
+			pw_stream_set_active(cast->stream, true);
+		}
+		if (cast->current_frame.pw_buffer) {
+			xdpw_wlr_frame_capture(cast);
+		}
+		xdpw_screencast_instance_streams_changed(cast);
+	}
+}
+
 static void wlr_output_handle_done(void *data, struct wl_output *wl_output) {
-	/* Nothing to do */
+	struct xdpw_wlr_output *output = data;
+	if (output->name) {
+		wlr_output_rebind(output);
+		xdpw_composite_outputs_changed(output->ctx);
+	}
 }
 
 static void wlr_output_handle_scale(void *data, struct wl_output *wl_output,
@@ -129,7 +234,11 @@ static void xdg_output_handle_logical_size(void *data, struct zxdg_output_v1 *xd
 }
 
 static void xdg_output_handle_done(void *data, struct zxdg_output_v1 *xdg_output_v1) {
-	/* Nothing to do */
+	// Only sent before version 3, later versions use wl_output.done
+	struct xdpw_wlr_output *output = data;
+	if (output->name) {
+		xdpw_composite_outputs_changed(output->ctx);
+	}
 }
 
 static void xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output_v1,
@@ -171,20 +280,164 @@ static struct xdpw_wlr_output *xdpw_wlr_output_find(struct xdpw_screencast_conte
 	return NULL;
 }
 
+static size_t common_prefix_length(const char *a, const char *b) {
+	size_t n = 0;
+	while (a[n] && a[n] == b[n]) {
+		n++;
+	}
+	return n;
+}
+
+static struct xdpw_toplevel *toplevel_find_by_app(struct xdpw_screencast_context *ctx,
+		const char *app_id, const char *title) {
+	struct xdpw_toplevel_app *app = xdpw_hash_table_lookup(&ctx->toplevel_apps, app_id);
+	if (!app) {
+		return NULL;
+	}
+	if (wl_list_length(&app->toplevels) == 1) {
+		struct xdpw_toplevel *toplevel = wl_container_of(app->toplevels.next, toplevel, app_link);
+		return toplevel;
+	}
+	if (!title) {
+		return NULL;
+	}
+
+	// Titles usually change in their tail (document name, unread count),
+	// prefer the window sharing the longest prefix with the stored one
+	struct xdpw_toplevel *best = NULL, *toplevel;
+	size_t best_length = 0;
+	bool ambiguous = false;
+	wl_list_for_each(toplevel, &app->toplevels, app_link) {
+		if (!toplevel->title) {
+			continue;
+		}
+		if (strcmp(toplevel->title, title) == 0) {
+			return toplevel;
+		}
+		size_t length = common_prefix_length(toplevel->title, title);
+		if (length > best_length) {
+			best = toplevel;
+			best_length = length;
+			ambiguous = false;
+		} else if (length == best_length) {
+			ambiguous = true;
+		}
+	}
+	return ambiguous ? NULL : best;
+}
+
 bool xdpw_wlr_target_from_data(struct xdpw_screencast_context *ctx, struct xdpw_screencast_target *target,
 		struct xdpw_screencast_restore_data *data) {
-	struct xdpw_wlr_output *out = NULL;
-	out = xdpw_wlr_output_find_by_name(&ctx->output_list, data->output_name);
+	if (data->all_outputs) {
+		if (!ctx->xdg_output_manager) {
+			return false;
+		}
+		target->type = VIRTUAL;
+		return true;
+	}
+
+	if (data->output_name) {
+		struct xdpw_wlr_output *out = NULL;
+		out = xdpw_wlr_output_find_by_name(&ctx->output_list, data->output_name);
+
+		if (!out) {
+			return false;
+		}
+		target->type = MONITOR;
+		target->output = out;
+		if (data->has_region && !xdpw_wlr_target_set_region(ctx, target, data->region)) {
+			return false;
+		}
+		return true;
+	}
 
-	if (!out) {
+	if (!(ctx->state->screencast_source_types & WINDOW)) {
 		return false;
 	}
-	target->type = MONITOR;
-	target->output = out;
+
+	struct xdpw_toplevel *toplevel = NULL;
+	if (data->window_identifier) {
+		toplevel = xdpw_hash_table_lookup(&ctx->toplevels_by_identifier, data->window_identifier);
+	}
+	// Identifiers don't survive a compositor restart
+	if (!toplevel && data->app_id && data->app_id[0] != '\0') {
+		toplevel = toplevel_find_by_app(ctx, data->app_id, data->title);
+	}
+	if (!toplevel) {
+		return false;
+	}
+	logprint(DEBUG, "wlroots: restoring window %s app_id: %s title: %s",
+		toplevel->identifier, toplevel->app_id, toplevel->title);
+	target->type = WINDOW;
+	target->toplevel = toplevel;
+	return true;
+}
+
+bool xdpw_wlr_target_set_region(struct xdpw_screencast_context *ctx,
+		struct xdpw_screencast_target *target, struct xdpw_pixel_rect region) {
+	if (!ctx->screencopy_manager) {
+		logprint(ERROR, "wlroots: capturing a region needs wlr-screencopy");
+		return false;
+	}
+	// The output might have shrunk since the region was chosen
+	struct xdpw_wlr_output *output = target->output;
+	if (output->width > 0 && output->height > 0) {
+		region.x = MIN(region.x, (uint32_t)output->width);
+		region.y = MIN(region.y, (uint32_t)output->height);
+		region.width = MIN(region.width, (uint32_t)output->width - region.x);
+		region.height = MIN(region.height, (uint32_t)output->height - region.y);
+	}
+	if (region.width == 0 || region.height == 0) {
+		logprint(ERROR, "wlroots: region is outside of output %s", output->name);
+		return false;
+	}
+	target->region = region;
 	return true;
 }
 
+static void wlr_output_detach_timeout(void *data) {
+	struct xdpw_screencast_instance *cast = data;
+	cast->detach_timer = NULL;
+
+	logprint(INFO, "wlroots: output %s didn't come back, stopping screencast",
+		cast->detached_output_name);
+	xdpw_screencast_instance_destroy(cast);
+}
+
+static void wlr_output_detach(struct xdpw_screencast_instance *cast) {
+	int timeout = cast->ctx->state->config->screencast_conf.output_reconnect_timeout;
+	if (timeout <= 0 || !cast->initialized || !cast->target->output->name) {
+		xdpw_screencast_instance_destroy(cast);
+		return;
+	}
+
+	char *name = strdup(cast->target->output->name);
+	if (!name) {
+		logprint(ERROR, "wlroots: allocation failed, stopping screencast");
+		xdpw_screencast_instance_destroy(cast);
+		return;
+	}
+
+	logprint(INFO, "wlroots: detaching screencast from output %s for %d seconds",
+		name, timeout);
+	cast->detached_output_name = name;
+	cast->target->output = NULL;
+
+	// screencopy might be in process for this instance
+	xdpw_wlr_session_close(cast);
+	if (cast->current_frame.pw_buffer) {
+		xdpw_pwr_enqueue_buffer(cast);
+	}
+	if (cast->stream) {
+		pw_stream_set_active(cast->stream, false);
+	}
+
+	cast->detach_timer = xdpw_add_timer(cast->ctx->state,
+		(uint64_t)timeout * TIMESPEC_NSEC_PER_SEC, wlr_output_detach_timeout, cast);
+}
+
 static void wlr_remove_output(struct xdpw_wlr_output *out) {
+	xdpw_capture_scheduler_output_removed(out);
 	free(out->name);
 	free(out->description);
 	if (out->xdg_output) {
@@ -360,12 +613,65 @@ static const struct zwp_linux_dmabuf_feedback_v1_listener linux_dmabuf_listener_
 	.tranche_done = linux_dmabuf_feedback_tranche_done,
 };
 
+static void foreign_toplevel_set_app(struct xdpw_screencast_context *ctx,
+		struct xdpw_toplevel *toplevel, const char *app_id) {
+	struct xdpw_toplevel_app *app = toplevel->app;
+	if (app) {
+		wl_list_remove(&toplevel->app_link);
+		toplevel->app = NULL;
+		if (wl_list_empty(&app->toplevels)) {
+			xdpw_hash_table_remove(&ctx->toplevel_apps, app->app_id);
+			free(app->app_id);
+			free(app);
+		}
+	}
+	if (!app_id) {
+		return;
+	}
+
+	app = xdpw_hash_table_lookup(&ctx->toplevel_apps, app_id);
+	if (!app) {
+		app = calloc(1, sizeof(*app));
+		if (!app) {
+			return;
+		}
+		app->app_id = strdup(app_id);
+		wl_list_init(&app->toplevels);
+		if (!app->app_id || !xdpw_hash_table_insert(&ctx->toplevel_apps, app->app_id, app)) {
+			free(app->app_id);
+			free(app);
+			return;
+		}
+	}
+	wl_list_insert(&app->toplevels, &toplevel->app_link);
+	toplevel->app = app;
+}
+
+static void foreign_toplevel_set_identifier(struct xdpw_screencast_context *ctx,
+		struct xdpw_toplevel *toplevel, const char *identifier) {
+	if (toplevel->identifier) {
+		if (xdpw_hash_table_lookup(&ctx->toplevels_by_identifier, toplevel->identifier) == toplevel) {
+			xdpw_hash_table_remove(&ctx->toplevels_by_identifier, toplevel->identifier);
+		}
+		free(toplevel->identifier);
+		toplevel->identifier = NULL;
+	}
+	if (!identifier) {
+		return;
+	}
+	toplevel->identifier = strdup(identifier);
+	if (toplevel->identifier) {
+		xdpw_hash_table_insert(&ctx->toplevels_by_identifier, toplevel->identifier, toplevel);
+	}
+}
+
 static void foreign_toplevel_destroy(struct xdpw_toplevel *toplevel) {
+	foreign_toplevel_set_app(toplevel->ctx, toplevel, NULL);
+	foreign_toplevel_set_identifier(toplevel->ctx, toplevel, NULL);
 	wl_list_remove(&toplevel->link);
 	ext_foreign_toplevel_handle_v1_destroy(toplevel->handle);
 	free(toplevel->title);
 	free(toplevel->app_id);
-	free(toplevel->identifier);
 	free(toplevel);
 }
 
@@ -391,13 +697,13 @@ static void foreign_toplevel_handle_app_id(void *data,
 	struct xdpw_toplevel *toplevel = data;
 	free(toplevel->app_id);
 	toplevel->app_id = strdup(app_id);
+	foreign_toplevel_set_app(toplevel->ctx, toplevel, app_id);
 }
 
 static void foreign_toplevel_handle_identifier(void *data,
 		struct ext_foreign_toplevel_handle_v1 *handle, const char *identifier) {
 	struct xdpw_toplevel *toplevel = data;
-	free(toplevel->identifier);
-	toplevel->identifier = strdup(identifier);
+	foreign_toplevel_set_identifier(toplevel->ctx, toplevel, identifier);
 }
 
 static const struct ext_foreign_toplevel_handle_v1_listener foreign_toplevel_handle_listener = {
@@ -418,7 +724,9 @@ static void foreign_toplevel_list_handle_toplevel(void *data,
 		return;
 	}
 
+	toplevel->ctx = ctx;
 	toplevel->handle = handle;
+	wl_list_init(&toplevel->app_link);
 	wl_list_insert(&ctx->toplevels, &toplevel->link);
 	ext_foreign_toplevel_handle_v1_add_listener(handle, &foreign_toplevel_handle_listener, toplevel);
 }
@@ -449,7 +757,9 @@ static void wlr_registry_handle_add(void *data, struct wl_registry *reg,
 	if (!strcmp(interface, wl_output_interface.name)) {
 		struct xdpw_wlr_output *output = calloc(1, sizeof(*output));
 
+		output->ctx = ctx;
 		output->id = id;
+		wl_list_init(&output->capture_streams);
 		logprint(DEBUG, "wlroots: |-- registered to interface %s (Version %u)", interface, WL_OUTPUT_VERSION);
 		output->output = wl_registry_bind(reg, id, &wl_output_interface, WL_OUTPUT_VERSION);
 
@@ -539,10 +849,10 @@ static void wlr_registry_handle_remove(void *data, struct wl_registry *reg,
 		struct xdpw_screencast_instance *cast, *tmp;
 		wl_list_for_each_safe(cast, tmp, &ctx->screencast_instances, link) {
 			if (cast->target->output == output) {
-				// screencopy might be in process for this instance
-				xdpw_screencast_instance_destroy(cast);
+				wlr_output_detach(cast);
 			}
 		}
+		xdpw_composite_output_removed(ctx, output);
 		wlr_remove_output(output);
 	}
 }
@@ -558,6 +868,8 @@ int xdpw_wlr_screencopy_init(struct xdpw_state *state) {
 	wl_list_init(&ctx->output_list);
 	wl_list_init(&ctx->screencast_instances);
 	wl_list_init(&ctx->toplevels);
+	xdpw_hash_table_init(&ctx->toplevels_by_identifier);
+	xdpw_hash_table_init(&ctx->toplevel_apps);
 	wl_array_init(&ctx->format_modifier_pairs);
 
 	// retrieve registry
@@ -571,6 +883,32 @@ int xdpw_wlr_screencopy_init(struct xdpw_state *state) {
 	if (ctx->ext_image_copy_capture_manager && ctx->ext_output_image_capture_source_manager) {
 		logprint(DEBUG, "wayland: using ext_image_copy_capture");
 	} else if (ctx->screencopy_manager && ctx->linux_dmabuf) {
+		logprint(DEBUG, "wayland: using wlr_screencopy");
+	} else {
+		logprint(ERROR, "Compositor supports neither ext_image_copy_capture or wlr_screencopy!");
+		return -1;
+	}
+
+	if (ctx->ext_image_copy_capture_manager && ctx->ext_foreign_toplevel_image_capture_source_manager) {
+		state->screencast_source_types |= WINDOW;
+	}
+
+	// make sure our wlroots supports shm protocol
+	if (!ctx->shm) {
+		logprint(ERROR, "Compositor doesn't support %s!", "wl_shm");
+		return -1;
+	}
+
+	return 0;
+}
+
+// Everything that needs further roundtrips or opens devices is delayed
+// until the first session, so the D-Bus name can be claimed right away
+void xdpw_wlr_screencopy_setup(struct xdpw_state *state) {
+	struct xdpw_screencast_context *ctx = &state->screencast;
+
+	bool use_ext = ctx->ext_image_copy_capture_manager && ctx->ext_output_image_capture_source_manager;
+	if (!use_ext && ctx->linux_dmabuf) {
 		if (zwp_linux_dmabuf_v1_get_version(ctx->linux_dmabuf) >= ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION) {
 			ctx->linux_dmabuf_feedback = zwp_linux_dmabuf_v1_get_default_feedback(ctx->linux_dmabuf);
 			zwp_linux_dmabuf_feedback_v1_add_listener(ctx->linux_dmabuf_feedback, &linux_dmabuf_listener_feedback, ctx);
@@ -589,19 +927,6 @@ int xdpw_wlr_screencopy_init(struct xdpw_state *state) {
 				logprint(ERROR, "System doesn't support gbm!");
 			}
 		}
-	} else {
-		logprint(ERROR, "Compositor supports neither ext_image_copy_capture or wlr_screencopy!");
-		return -1;
-	}
-
-	if (ctx->ext_image_copy_capture_manager && ctx->ext_foreign_toplevel_image_capture_source_manager) {
-		state->screencast_source_types |= WINDOW;
-	}
-
-	// make sure our wlroots supports shm protocol
-	if (!ctx->shm) {
-		logprint(ERROR, "Compositor doesn't support %s!", "wl_shm");
-		return -1;
 	}
 
 	if (ctx->xdg_output_manager) {
@@ -616,31 +941,31 @@ int xdpw_wlr_screencopy_init(struct xdpw_state *state) {
 		wl_display_roundtrip(state->wl_display);
 		logprint(DEBUG, "wayland: xdg_output listeners run");
 	}
-
-	return 0;
 }
 
 void xdpw_wlr_screencopy_finish(struct xdpw_screencast_context *ctx) {
+	struct xdpw_screencast_instance *cast, *tmp_c;
+	wl_list_for_each_safe(cast, tmp_c, &ctx->screencast_instances, link) {
+		xdpw_screencast_instance_destroy(cast);
+	}
+
 	wl_array_release(&ctx->format_modifier_pairs);
+	if (ctx->feedback_data.format_table_data) {
+		munmap(ctx->feedback_data.format_table_data, ctx->feedback_data.format_table_size);
+		ctx->feedback_data.format_table_data = NULL;
+	}
 
 	struct xdpw_wlr_output *output, *tmp_o;
 	wl_list_for_each_safe(output, tmp_o, &ctx->output_list, link) {
-		wl_list_remove(&output->link);
-		if (output->xdg_output) {
-			zxdg_output_v1_destroy(output->xdg_output);
-		}
-		wl_output_destroy(output->output);
+		wlr_remove_output(output);
 	}
 
 	struct xdpw_toplevel *toplevel, *toplevel_tmp;
 	wl_list_for_each_safe(toplevel, toplevel_tmp, &ctx->toplevels, link) {
 		foreign_toplevel_destroy(toplevel);
 	}
-
-	struct xdpw_screencast_instance *cast, *tmp_c;
-	wl_list_for_each_safe(cast, tmp_c, &ctx->screencast_instances, link) {
-		xdpw_screencast_instance_destroy(cast);
-	}
+	xdpw_hash_table_finish(&ctx->toplevels_by_identifier);
+	xdpw_hash_table_finish(&ctx->toplevel_apps);
 
 	if (ctx->screencopy_manager) {
 		zwlr_screencopy_manager_v1_destroy(ctx->screencopy_manager);
@@ -22,6 +22,7 @@
 #include "pipewire_screencast.h"
 #include "xdpw.h"
 #include "logger.h"
+#include "trace.h"
 
 static void wlr_frame_finish(struct xdpw_screencast_instance *cast) {
 	if (!cast->wlr_session.wlr_frame) {
@@ -142,7 +143,8 @@ static void wlr_frame_buffer_done(void *data,
 		return;
 	}
 
-	if (!check_constraints(&cast->current_constraints, cast->current_frame.xdpw_buffer)) {
+	struct xdpw_buffer *buffer = xdpw_frame_capture_buffer(cast);
+	if (!buffer || !check_constraints(&cast->current_constraints, buffer)) {
 		logprint(DEBUG, "wlroots: buffer constraints changed");
 		pwr_update_stream_param(cast);
 		xdpw_pwr_enqueue_buffer(cast);
@@ -155,7 +157,7 @@ static void wlr_frame_buffer_done(void *data,
 
 	cast->current_frame.damage.size = 0;
 
-	zwlr_screencopy_frame_v1_copy_with_damage(frame, cast->current_frame.xdpw_buffer->buffer);
+	zwlr_screencopy_frame_v1_copy_with_damage(frame, buffer->buffer);
 	logprint(TRACE, "wlroots: frame copied");
 }
 
@@ -181,6 +183,14 @@ static void wlr_frame_damage(void *data, struct zwlr_screencopy_frame_v1 *frame,
 
 	logprint(TRACE, "wlroots: damage %"PRIu32": %"PRIu32",%"PRIu32"x%"PRIu32",%"PRIu32,
 			cast->current_frame.damage.size, x, y, width, height);
+	// Keep damage inside of the frame, e.g. of a region
+	uint32_t frame_width = cast->current_constraints.width;
+	uint32_t frame_height = cast->current_constraints.height;
+	if (x >= frame_width || y >= frame_height) {
+		return;
+	}
+	width = MIN(width, frame_width - x);
+	height = MIN(height, frame_height - y);
 	struct xdpw_frame_damage *damage = wl_array_add(&cast->current_frame.damage, sizeof(*damage));
 	*damage = (struct xdpw_frame_damage){ .x = x, .y = y, .width = width, .height = height };
 }
@@ -193,14 +203,18 @@ static void wlr_frame_ready(void *data, struct zwlr_screencopy_frame_v1 *frame,
 	}
 
 	logprint(TRACE, "wlroots: ready event handler");
+	xdpw_trace_async_end("capture", (uintptr_t)cast);
+	xdpw_trace_begin("wlr_frame_ready");
 
 	cast->current_frame.tv_sec = ((((uint64_t)tv_sec_hi) << 32) | tv_sec_lo);
 	cast->current_frame.tv_nsec = tv_nsec;
 	cast->current_frame.completed = true;
+	cast->capture_failures = 0;
 	logprint(TRACE, "wlroots: timestamp %"PRIu64":%"PRIu32, cast->current_frame.tv_sec, cast->current_frame.tv_nsec);
 
 	xdpw_pwr_enqueue_buffer(cast);
 	wlr_frame_finish(cast);
+	xdpw_trace_end("wlr_frame_ready");
 }
 
 static void wlr_frame_failed(void *data,
@@ -211,9 +225,11 @@ static void wlr_frame_failed(void *data,
 	}
 
 	logprint(TRACE, "wlroots: failed event handler");
+	xdpw_trace_async_end("capture", (uintptr_t)cast);
+	xdpw_trace_instant("wlr_frame_failed");
 
-	xdpw_pwr_enqueue_buffer(cast);
 	wlr_frame_finish(cast);
+	xdpw_wlr_frame_failed(cast);
 }
 
 static const struct zwlr_screencopy_frame_v1_listener wlr_frame_listener = {
@@ -229,8 +245,17 @@ static const struct zwlr_screencopy_frame_v1_listener wlr_frame_listener = {
 static void wlr_register_cb(struct xdpw_screencast_instance *cast) {
 	assert(cast->target->type == MONITOR);
 
-	struct zwlr_screencopy_frame_v1 *frame = zwlr_screencopy_manager_v1_capture_output(
-		cast->ctx->screencopy_manager, cast->target->with_cursor, cast->target->output->output);
+	struct zwlr_screencopy_frame_v1 *frame;
+	struct xdpw_pixel_rect *region = &cast->target->region;
+	if (region->width > 0) {
+		// Only the pixels of the region are copied
+		frame = zwlr_screencopy_manager_v1_capture_output_region(cast->ctx->screencopy_manager,
+			cast->target->with_cursor, cast->target->output->output,
+			region->x, region->y, region->width, region->height);
+	} else {
+		frame = zwlr_screencopy_manager_v1_capture_output(cast->ctx->screencopy_manager,
+			cast->target->with_cursor, cast->target->output->output);
+	}
 	zwlr_screencopy_frame_v1_add_listener(frame, &wlr_frame_listener, cast);
 	logprint(TRACE, "wlroots: callbacks registered");
 }
@@ -0,0 +1,199 @@
+// Checks the max-min fair shares of the copy bandwidth of an output and the
+// spreading of captures over its refresh interval
+#include "../src/screencast/capture_scheduler.c"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define MIB (1024.0 * 1024.0)
+
+struct stream {
+	uint32_t width, height;
+	uint32_t framerate;
+	// expected
+	double rate, share;
+};
+
+static struct xdpw_config config;
+static struct xdpw_state state = { .config = &config };
+static struct xdpw_screencast_context ctx = { .state = &state };
+static struct xdpw_wlr_output output = { .ctx = &ctx, .name = "DP-1", .framerate = 60 };
+static struct xdpw_screencast_target target = { .type = MONITOR, .output = &output };
+
+static void output_reset(int limit) {
+	config.screencast_conf.max_capture_bandwidth = limit;
+	wl_list_init(&output.capture_streams);
+	output.capture_next_ns = 0;
+}
+
+static void cast_init(struct xdpw_screencast_instance *cast, const struct stream *stream) {
+	*cast = (struct xdpw_screencast_instance){
+		.target = &target,
+		.framerate = stream->framerate,
+		.current_constraints = { .width = stream->width, .height = stream->height },
+	};
+}
+
+static bool near(double a, double b) {
+	return fabs(a - b) <= 1e-6 * fmax(fabs(a), fabs(b)) + 1e-9;
+}
+
+static double stream_bandwidth(const struct stream *stream, double rate) {
+	return 4.0 * stream->width * stream->height * rate;
+}
+
+static int test_shares(const char *name, int limit, const struct stream *streams, size_t count) {
+	output_reset(limit);
+	struct xdpw_screencast_instance *casts = calloc(count, sizeof(*casts));
+	if (!casts) {
+		abort();
+	}
+	for (size_t i = 0; i < count; i++) {
+		cast_init(&casts[i], &streams[i]);
+	}
+	// Every call updates the shares of all streams of the output
+	for (size_t i = 0; i < count; i++) {
+		xdpw_capture_scheduler_delay(&casts[i], 0);
+	}
+
+	int failures = 0;
+	double used = 0;
+	for (size_t i = 0; i < count; i++) {
+		const struct xdpw_screencast_metrics *metrics = &casts[i].metrics;
+		used += stream_bandwidth(&streams[i], metrics->capture_rate);
+		if (!near(metrics->capture_rate, streams[i].rate) ||
+				!near(metrics->capture_share, streams[i].share)) {
+			fprintf(stderr, "%s: stream %zu gets %.3f fps and a share of %.4f, "
+				"expected %.3f fps and %.4f\n", name, i, metrics->capture_rate,
+				metrics->capture_share, streams[i].rate, streams[i].share);
+			failures++;
+		}
+	}
+	if (limit > 0 && used > limit * MIB * (1 + 1e-9)) {
+		fprintf(stderr, "%s: %.1f MiB/s used of %d MiB/s\n", name, used / MIB, limit);
+		failures++;
+	}
+
+	xdpw_capture_scheduler_output_removed(&output);
+	if (!wl_list_empty(&output.capture_streams)) {
+		fprintf(stderr, "%s: streams are left after removing the output\n", name);
+		failures++;
+	}
+	free(casts);
+	return failures;
+}
+
+static int test_fair_shares(void) {
+	int failures = 0;
+	// 4 bytes per pixel
+	const double frame_1080p = 4.0 * 1920 * 1080;
+	const double small = stream_bandwidth(&(struct stream){ 640, 480 }, 10);
+
+	// Without a limit every stream gets what it asks for, the output
+	// limits the rate, the share is relative to the total
+	const struct stream unlimited[] = {
+		{ 1920, 1080, 0, 60, 0.5 },
+		{ 1920, 1080, 120, 60, 0.5 },
+	};
+	failures += test_shares("unlimited", 0, unlimited, 2);
+
+	// Below the limit
+	const struct stream below[] = {
+		{ 1920, 1080, 30, 30, frame_1080p * 30 / (1000 * MIB) },
+		{ 640, 480, 10, 10, small / (1000 * MIB) },
+	};
+	failures += test_shares("below the limit", 1000, below, 2);
+
+	// The small stream needs less than an equal share and keeps its
+	// rate, the large one gets the rest
+	const double rest = 300 * MIB - small;
+	const struct stream mixed[] = {
+		{ 1920, 1080, 60, rest / frame_1080p, rest / (300 * MIB) },
+		{ 640, 480, 10, 10, small / (300 * MIB) },
+	};
+	failures += test_shares("mixed", 300, mixed, 2);
+
+	// Equal streams share equally
+	const struct stream equal[] = {
+		{ 1920, 1080, 60, 100 * MIB / frame_1080p, 1.0 / 3 },
+		{ 1920, 1080, 60, 100 * MIB / frame_1080p, 1.0 / 3 },
+		{ 1920, 1080, 60, 100 * MIB / frame_1080p, 1.0 / 3 },
+	};
+	failures += test_shares("equal", 300, equal, 3);
+
+	// Streams settle one after another
+	const double rest_2 = 200 * MIB - 2 * small - stream_bandwidth(&(struct stream){ 1280, 720 }, 15);
+	const struct stream staged[] = {
+		{ 640, 480, 10, 10, small / (200 * MIB) },
+		{ 1280, 720, 15, 15, stream_bandwidth(&(struct stream){ 1280, 720 }, 15) / (200 * MIB) },
+		{ 3840, 2160, 60, rest_2 / 2 / (4.0 * 3840 * 2160), rest_2 / 2 / (200 * MIB) },
+		{ 640, 480, 10, 10, small / (200 * MIB) },
+		{ 3840, 2160, 60, rest_2 / 2 / (4.0 * 3840 * 2160), rest_2 / 2 / (200 * MIB) },
+	};
+	failures += test_shares("staged", 200, staged, 5);
+	return failures;
+}
+
+static int test_spreading(void) {
+	output_reset(0);
+	struct xdpw_screencast_instance casts[2];
+	const struct stream stream = { 1920, 1080, 60 };
+	cast_init(&casts[0], &stream);
+	cast_init(&casts[1], &stream);
+
+	int failures = 0;
+	// The first stream joins alone and isn't delayed, the second one
+	// pushes the next capture of the output by half a refresh interval
+	const uint64_t interval = TIMESPEC_NSEC_PER_SEC / 60;
+	uint64_t first = xdpw_capture_scheduler_delay(&casts[0], 0);
+	uint64_t second = xdpw_capture_scheduler_delay(&casts[1], 0);
+	uint64_t third = xdpw_capture_scheduler_delay(&casts[0], 0);
+	if (first != 0 || second != 0 ||
+			third > interval / 2 || third < interval / 4) {
+		fprintf(stderr, "captures of two streams are delayed by %"PRIu64", %"PRIu64" "
+			"and %"PRIu64" ns, expected 0, 0 and about %"PRIu64" ns\n",
+			first, second, third, interval / 2);
+		failures++;
+	}
+
+	// With 150 MiB/s each the next capture waits for the granted rate
+	config.screencast_conf.max_capture_bandwidth = 300;
+	uint64_t before = scheduler_now_ns();
+	uint64_t delay = xdpw_capture_scheduler_delay(&casts[1], 0);
+	uint64_t after = scheduler_now_ns();
+	double rate = casts[1].metrics.capture_rate;
+	uint64_t start = casts[1].capture_next_ns - (uint64_t)(TIMESPEC_NSEC_PER_SEC / rate);
+	if (rate >= 60 || start < before + delay || start > after + delay) {
+		fprintf(stderr, "at %.2f fps the capture after %"PRIu64" ns isn't followed by "
+			"one a frame interval later\n", rate, delay);
+		failures++;
+	}
+
+	// A stream which left doesn't take a share anymore
+	xdpw_capture_scheduler_leave(&casts[1]);
+	config.screencast_conf.max_capture_bandwidth = 0;
+	xdpw_capture_scheduler_delay(&casts[0], 0);
+	if (wl_list_length(&output.capture_streams) != 1 ||
+			!near(casts[0].metrics.capture_rate, 60)) {
+		fprintf(stderr, "the remaining stream gets %.2f fps\n", casts[0].metrics.capture_rate);
+		failures++;
+	}
+	xdpw_capture_scheduler_output_removed(&output);
+
+	// Windows aren't scheduled
+	struct xdpw_screencast_target window = { .type = WINDOW };
+	casts[1].target = &window;
+	delay = xdpw_capture_scheduler_delay(&casts[1], 1234);
+	if (delay != 1234 || casts[1].capture_output != NULL ||
+			casts[1].metrics.capture_share != 1.0) {
+		fprintf(stderr, "a window is scheduled\n");
+		failures++;
+	}
+	return failures;
+}
+
+int main(void) {
+	int failures = test_fair_shares();
+	failures += test_spreading();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
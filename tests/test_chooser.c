@@ -0,0 +1,154 @@
+// Checks how the labels printed by choosers select a target and how
+// regions selected with slurp are parsed
+#include "../src/screencast/chooser.c"
+
+#include <stdlib.h>
+
+// wlr_screencast.c needs a compositor, the test only needs the outputs
+struct xdpw_wlr_output *xdpw_wlr_output_find_by_name(struct wl_list *output_list,
+		const char *name) {
+	struct xdpw_wlr_output *output;
+	wl_list_for_each(output, output_list, link) {
+		if (strcmp(output->name, name) == 0) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+bool xdpw_wlr_target_set_region(struct xdpw_screencast_context *ctx,
+		struct xdpw_screencast_target *target, struct xdpw_pixel_rect region) {
+	target->region = region;
+	return true;
+}
+
+static struct xdpw_wlr_output outputs[] = {
+	{ .name = "DP-1", .description = "Left", .x = 0, .y = 0, .width = 1920, .height = 1080 },
+	{ .name = "DP-10", .description = "Right", .x = 1920, .y = 0, .width = 2560, .height = 1440 },
+};
+
+static void context_init(struct xdpw_screencast_context *ctx, size_t output_count,
+		bool xdg_output) {
+	*ctx = (struct xdpw_screencast_context){
+		// Only compared against NULL
+		.xdg_output_manager = xdg_output ? (struct zxdg_output_manager_v1 *)ctx : NULL,
+	};
+	wl_list_init(&ctx->output_list);
+	wl_list_init(&ctx->toplevels);
+	// Outputs are inserted at the front
+	for (size_t i = output_count; i > 0; i--) {
+		wl_list_insert(&ctx->output_list, &outputs[i - 1].link);
+	}
+}
+
+struct select_case {
+	enum xdpw_chooser_types chooser;
+	uint32_t type_mask;
+	const char *label;
+	// 0 if the label selects nothing
+	enum source_types type;
+	// index into outputs for MONITOR
+	int output;
+	// in output coordinates, empty for the whole output
+	struct xdpw_pixel_rect region;
+};
+
+static int test_select(struct xdpw_screencast_context *ctx,
+		const struct select_case *cases, size_t count) {
+	int failures = 0;
+	for (size_t i = 0; i < count; i++) {
+		const struct select_case *c = &cases[i];
+		struct xdpw_chooser chooser = { c->chooser, "test" };
+		struct xdpw_screencast_target target = { 0 };
+		bool selected = chooser_select(&chooser, ctx, c->label, &target, c->type_mask);
+		if (!selected && c->type == 0) {
+			continue;
+		}
+		if (selected != (c->type != 0) || target.type != c->type ||
+				(c->type == MONITOR && (target.output != &outputs[c->output] ||
+				memcmp(&target.region, &c->region, sizeof(c->region)) != 0))) {
+			fprintf(stderr, "\"%s\" with the %s chooser selects %s (type %d)\n",
+				c->label, c->chooser == XDPW_CHOOSER_SIMPLE ? "simple" : "dmenu",
+				selected ? "the wrong target" : "nothing", target.type);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+static int test_all_outputs(void) {
+	static const struct select_case cases[] = {
+		{ XDPW_CHOOSER_DMENU, MONITOR, ALL_OUTPUTS_LABEL, VIRTUAL },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, ALL_OUTPUTS_LABEL, VIRTUAL },
+		{ XDPW_CHOOSER_DMENU, MONITOR | WINDOW, ALL_OUTPUTS_LABEL, VIRTUAL },
+		// Only applications accepting monitors get the composed stream
+		{ XDPW_CHOOSER_DMENU, WINDOW, ALL_OUTPUTS_LABEL, 0 },
+		{ XDPW_CHOOSER_DMENU, MONITOR, "All outputs ", 0 },
+		{ XDPW_CHOOSER_DMENU, MONITOR, "Monitor: DP-1 Left", MONITOR, 0 },
+		{ XDPW_CHOOSER_DMENU, MONITOR, "Monitor: DP-10 Right", MONITOR, 1 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Monitor: DP-10", MONITOR, 1 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "DP-1", MONITOR, 0 },
+	};
+
+	struct xdpw_screencast_context ctx;
+	context_init(&ctx, 2, true);
+	int failures = test_select(&ctx, cases, sizeof(cases) / sizeof(cases[0]));
+	if (!all_outputs_available(&ctx)) {
+		fprintf(stderr, "\"%s\" isn't offered for two outputs\n", ALL_OUTPUTS_LABEL);
+		failures++;
+	}
+
+	// Composing needs the layout from xdg-output
+	static const struct select_case no_layout[] = {
+		{ XDPW_CHOOSER_DMENU, MONITOR, ALL_OUTPUTS_LABEL, 0 },
+	};
+	context_init(&ctx, 2, false);
+	failures += test_select(&ctx, no_layout, 1);
+	if (all_outputs_available(&ctx)) {
+		fprintf(stderr, "\"%s\" is offered without xdg-output\n", ALL_OUTPUTS_LABEL);
+		failures++;
+	}
+
+	// A single output is shared as it is
+	context_init(&ctx, 1, true);
+	if (all_outputs_available(&ctx)) {
+		fprintf(stderr, "\"%s\" is offered for a single output\n", ALL_OUTPUTS_LABEL);
+		failures++;
+	}
+	return failures;
+}
+
+static int test_region(void) {
+	static const struct select_case cases[] = {
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1 10,20 300x200", MONITOR, 0, { 10, 20, 300, 200 } },
+		// Layout coordinates are relative to the output
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-10 2000,100 640x480", MONITOR, 1, { 80, 100, 640, 480 } },
+		// Dragged across the edge of the output
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-10 1900,-10 100x50", MONITOR, 1, { 0, 0, 80, 40 } },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR | WINDOW, "Region: DP-1 0,0 1x1", MONITOR, 0, { 0, 0, 1, 1 } },
+		// Outside of the output
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-10 1000,0 100x100", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1 10,20 0x200", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1 10,20 -300x200", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1 10,20 300x200 extra", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1 10,20", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-1", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: 10,20 300x200", 0 },
+		// Output names have to match as a whole
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP 10,20 300x200", 0 },
+		{ XDPW_CHOOSER_SIMPLE, MONITOR, "Region: DP-2 10,20 300x200", 0 },
+		// Only simple choosers select regions, and only of monitors
+		{ XDPW_CHOOSER_DMENU, MONITOR, "Region: DP-1 10,20 300x200", 0 },
+		{ XDPW_CHOOSER_SIMPLE, WINDOW, "Region: DP-1 10,20 300x200", 0 },
+	};
+
+	struct xdpw_screencast_context ctx;
+	context_init(&ctx, 2, true);
+	return test_select(&ctx, cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+int main(void) {
+	int failures = test_all_outputs();
+	failures += test_region();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
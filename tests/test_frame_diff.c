@@ -0,0 +1,193 @@
+// Compares the vector stripe hashes of frame_diff.c with the scalar one and
+// checks the damage reported for changed frames
+#include "../src/screencast/frame_diff.c"
+
+#include <stdio.h>
+
+struct hash_kernel {
+	const char *name;
+	bool supported;
+	hash_func func;
+};
+
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t random_u32(void) {
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static uint8_t *random_bytes(size_t size) {
+	uint8_t *data = malloc(size);
+	if (!data && size > 0) {
+		abort();
+	}
+	for (size_t i = 0; i < size; i++) {
+		data[i] = random_u32() >> 24;
+	}
+	return data;
+}
+
+static int test_hash(const struct hash_kernel *kernel) {
+	int failures = 0;
+	for (uint32_t stripes = 0; stripes <= DIFF_MAX_STRIPES; stripes++) {
+		uint8_t *data = random_bytes((size_t)stripes * DIFF_STRIPE);
+		for (int i = 0; i < 4; i++) {
+			uint64_t expected[4], actual[4];
+			for (int l = 0; l < 4; l++) {
+				expected[l] = actual[l] = ((uint64_t)random_u32() << 32) | random_u32();
+			}
+			hash_stripes_scalar(expected, data, stripes);
+			kernel->func(actual, data, stripes);
+			if (memcmp(expected, actual, sizeof(expected)) != 0) {
+				fprintf(stderr, "%s: hash of %u stripes differs\n", kernel->name, stripes);
+				failures++;
+				break;
+			}
+		}
+		free(data);
+	}
+	return failures;
+}
+
+static bool rect_contains(const struct xdpw_pixel_rect *rects, uint32_t count,
+		uint32_t x, uint32_t y) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (x >= rects[i].x && x < rects[i].x + rects[i].width &&
+				y >= rects[i].y && y < rects[i].y + rects[i].height) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Changes single pixels of a frame and checks that the damage covers them
+// and nothing beyond their tiles
+static int test_damage(uint32_t width, uint32_t height, uint32_t bpp, bool hint) {
+	uint32_t stride = width * bpp + 12;
+	uint8_t *frame = random_bytes((size_t)stride * height);
+	struct xdpw_frame_diff diff = { 0 };
+	struct xdpw_pixel_rect rects[4];
+	int failures = 0;
+
+	if (!xdpw_frame_diff_update(&diff, frame, width, height, stride, bpp, NULL, 0) ||
+			xdpw_frame_diff_damage(&diff, rects, 4) != 1 ||
+			rects[0].width != width || rects[0].height != height) {
+		fprintf(stderr, "%ux%u: the first frame isn't damaged as a whole\n", width, height);
+		failures++;
+	}
+
+	xdpw_frame_diff_update(&diff, frame, width, height, stride, bpp, NULL, 0);
+	if (xdpw_frame_diff_damage(&diff, rects, 4) != 0) {
+		fprintf(stderr, "%ux%u: an unchanged frame is damaged\n", width, height);
+		failures++;
+	}
+
+	for (int i = 0; i < 16; i++) {
+		uint32_t x = random_u32() % width, y = random_u32() % height;
+		frame[(size_t)y * stride + (size_t)x * bpp + random_u32() % bpp] ^= 1;
+
+		// The compositor reports damage which contains the pixel
+		struct xdpw_pixel_rect reported = { x > 5 ? x - 5 : 0, y, 7, 1 };
+		xdpw_frame_diff_update(&diff, frame, width, height, stride, bpp,
+			hint ? &reported : NULL, hint ? 1 : 0);
+		uint32_t count = xdpw_frame_diff_damage(&diff, rects, 4);
+		uint32_t tile_x = x / TILE_SIZE * TILE_SIZE, tile_y = y / TILE_SIZE * TILE_SIZE;
+		if (count == 0 || !rect_contains(rects, count, x, y)) {
+			fprintf(stderr, "%ux%u: pixel %u,%u isn't damaged\n", width, height, x, y);
+			failures++;
+		} else if (count != 1 || rects[0].x != tile_x || rects[0].y != tile_y ||
+				rects[0].width != MIN(TILE_SIZE, width - tile_x) ||
+				rects[0].height != MIN(TILE_SIZE, height - tile_y)) {
+			fprintf(stderr, "%ux%u: pixel %u,%u damages more than its tile\n",
+				width, height, x, y);
+			failures++;
+		}
+	}
+
+	// Moving a row within a tile changes its hash
+	if (height >= 2) {
+		memcpy(frame + stride, frame, (size_t)width * bpp);
+		xdpw_frame_diff_update(&diff, frame, width, height, stride, bpp, NULL, 0);
+		if (xdpw_frame_diff_damage(&diff, rects, 4) == 0) {
+			fprintf(stderr, "%ux%u: a copied row isn't damaged\n", width, height);
+			failures++;
+		}
+	}
+
+	xdpw_frame_diff_reset(&diff);
+	xdpw_frame_diff_update(&diff, frame, width, height, stride, bpp, NULL, 0);
+	if (xdpw_frame_diff_damage(&diff, rects, 4) != 1) {
+		fprintf(stderr, "%ux%u: a frame after a reset isn't damaged\n", width, height);
+		failures++;
+	}
+
+	xdpw_frame_diff_finish(&diff);
+	free(frame);
+	return failures;
+}
+
+// More changed runs than rectangles end up in the last one
+static int test_damage_limit(void) {
+	const uint32_t width = 8 * TILE_SIZE, height = 4 * TILE_SIZE, stride = 4 * width;
+	uint8_t *frame = random_bytes((size_t)stride * height);
+	struct xdpw_frame_diff diff = { 0 };
+	xdpw_frame_diff_update(&diff, frame, width, height, stride, 4, NULL, 0);
+
+	// Every other tile of the first two tile rows. The first column is
+	// merged over both rows, the rest ends up in the last rectangle.
+	for (uint32_t ty = 0; ty < 2; ty++) {
+		for (uint32_t tx = 0; tx < 8; tx += 2) {
+			frame[(size_t)ty * TILE_SIZE * stride + 4 * tx * TILE_SIZE] ^= 1;
+		}
+	}
+	xdpw_frame_diff_update(&diff, frame, width, height, stride, 4, NULL, 0);
+
+	int failures = 0;
+	struct xdpw_pixel_rect rects[2];
+	uint32_t count = xdpw_frame_diff_damage(&diff, rects, 2);
+	if (count != 2 || rects[0].x != 0 || rects[0].width != TILE_SIZE ||
+			rects[0].height != 2 * TILE_SIZE ||
+			rects[1].x != 2 * TILE_SIZE || rects[1].width != 5 * TILE_SIZE ||
+			rects[1].height != 2 * TILE_SIZE) {
+		fprintf(stderr, "damage of 8 tiles in 2 rectangles is wrong\n");
+		failures++;
+	}
+
+	xdpw_frame_diff_finish(&diff);
+	free(frame);
+	return failures;
+}
+
+int main(void) {
+	struct hash_kernel kernels[] = {
+#if defined(XDPW_DIFF_X86)
+		{ "hash_stripes_sse2", __builtin_cpu_supports("sse2"), hash_stripes_sse2 },
+		{ "hash_stripes_avx2", __builtin_cpu_supports("avx2"), hash_stripes_avx2 },
+#elif defined(XDPW_DIFF_NEON)
+		{ "hash_stripes_neon", true, hash_stripes_neon },
+#endif
+		{ NULL },
+	};
+
+	int failures = 0;
+	for (const struct hash_kernel *kernel = kernels; kernel->name; kernel++) {
+		if (!kernel->supported) {
+			printf("%s: skipped\n", kernel->name);
+			continue;
+		}
+		failures += test_hash(kernel);
+	}
+
+	failures += test_damage(256, 192, 4, false);
+	failures += test_damage(300, 130, 4, true);
+	failures += test_damage(67, 1, 3, false);
+	failures += test_damage(1, 65, 8, true);
+	failures += test_damage_limit();
+
+	xdpw_worker_pool_finish();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#include "hash_table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KEY_COUNT 1000
+
+int main(void) {
+	struct xdpw_hash_table table;
+	xdpw_hash_table_init(&table);
+	int failures = 0;
+
+	if (xdpw_hash_table_lookup(&table, "missing") != NULL ||
+			xdpw_hash_table_remove(&table, "missing") != NULL) {
+		fprintf(stderr, "an empty table has entries\n");
+		failures++;
+	}
+
+	// Keys like the session handles the table indexes, they only differ
+	// at the end
+	static char keys[KEY_COUNT][64];
+	for (uintptr_t i = 0; i < KEY_COUNT; i++) {
+		snprintf(keys[i], sizeof(keys[i]),
+			"/org/freedesktop/portal/desktop/session/1_42/xdpw_%u", (unsigned)i);
+		if (!xdpw_hash_table_insert(&table, keys[i], (void *)(i + 1))) {
+			fprintf(stderr, "inserting %s failed\n", keys[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (table.count != KEY_COUNT || table.bucket_count < KEY_COUNT) {
+		fprintf(stderr, "%zu entries in %zu buckets after %d insertions\n",
+			table.count, table.bucket_count, KEY_COUNT);
+		failures++;
+	}
+	for (uintptr_t i = 0; i < KEY_COUNT; i++) {
+		if (xdpw_hash_table_lookup(&table, keys[i]) != (void *)(i + 1)) {
+			fprintf(stderr, "%s isn't found\n", keys[i]);
+			failures++;
+		}
+	}
+
+	// Lookups compare the keys, not their addresses
+	char copy[64];
+	snprintf(copy, sizeof(copy), "%s", keys[7]);
+	if (xdpw_hash_table_lookup(&table, copy) != (void *)8) {
+		fprintf(stderr, "a copy of %s isn't found\n", keys[7]);
+		failures++;
+	}
+
+	for (uintptr_t i = 0; i < KEY_COUNT; i += 2) {
+		if (xdpw_hash_table_remove(&table, keys[i]) != (void *)(i + 1)) {
+			fprintf(stderr, "removing %s returned the wrong value\n", keys[i]);
+			failures++;
+		}
+	}
+	for (uintptr_t i = 0; i < KEY_COUNT; i++) {
+		void *expected = i % 2 == 0 ? NULL : (void *)(i + 1);
+		if (xdpw_hash_table_lookup(&table, keys[i]) != expected) {
+			fprintf(stderr, "%s is %s after removing every other key\n", keys[i],
+				expected ? "missing" : "still there");
+			failures++;
+		}
+	}
+	if (table.count != KEY_COUNT / 2) {
+		fprintf(stderr, "%zu entries after removing half of %d\n", table.count, KEY_COUNT);
+		failures++;
+	}
+
+	// A key inserted twice shadows the first value until it's removed
+	xdpw_hash_table_insert(&table, keys[1], (void *)-1);
+	if (xdpw_hash_table_lookup(&table, keys[1]) != (void *)-1 ||
+			xdpw_hash_table_remove(&table, keys[1]) != (void *)-1 ||
+			xdpw_hash_table_lookup(&table, keys[1]) != (void *)2) {
+		fprintf(stderr, "a key inserted twice isn't shadowed\n");
+		failures++;
+	}
+
+	xdpw_hash_table_finish(&table);
+	if (table.count != 0 || table.buckets != NULL ||
+			xdpw_hash_table_lookup(&table, keys[1]) != NULL) {
+		fprintf(stderr, "a finished table has entries\n");
+		failures++;
+	}
+
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
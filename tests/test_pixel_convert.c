@@ -0,0 +1,283 @@
+// Compares the vector kernels of pixel_convert.c with the scalar ones,
+// which are the reference for every format
+#include "../src/screencast/pixel_convert.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct row_kernel {
+	const char *name;
+	enum convert_isa isa;
+	uint32_t src_bpp;
+	bool deep;
+	xdpw_pixel_convert_row_func func;
+};
+
+struct yuv_kernel {
+	const char *name;
+	enum convert_isa isa;
+	xdpw_pixel_convert_yuv_func func;
+};
+
+static const struct row_kernel row_kernels[] = {
+#if defined(XDPW_CONVERT_X86)
+	{ "convert_row_32_ssse3", ISA_SSSE3, 4, false, convert_row_32_ssse3 },
+	{ "convert_row_24_ssse3", ISA_SSSE3, 3, false, convert_row_24_ssse3 },
+	{ "convert_row_10_sse2", ISA_SSE2, 4, true, convert_row_10_sse2 },
+	{ "convert_row_32_avx2", ISA_AVX2, 4, false, convert_row_32_avx2 },
+	{ "convert_row_24_avx2", ISA_AVX2, 3, false, convert_row_24_avx2 },
+	{ "convert_row_10_avx2", ISA_AVX2, 4, true, convert_row_10_avx2 },
+#elif defined(XDPW_CONVERT_NEON)
+	{ "convert_row_32_neon", ISA_NEON, 4, false, convert_row_32_neon },
+	{ "convert_row_24_neon", ISA_NEON, 3, false, convert_row_24_neon },
+	{ "convert_row_10_neon", ISA_NEON, 4, true, convert_row_10_neon },
+#endif
+	{ NULL },
+};
+
+static const struct yuv_kernel yuv_kernels[] = {
+#if defined(XDPW_CONVERT_X86)
+	{ "convert_yuv_sse2", ISA_SSE2, convert_yuv_sse2 },
+	{ "convert_yuv_avx2", ISA_AVX2, convert_yuv_avx2 },
+#elif defined(XDPW_CONVERT_NEON)
+	{ "convert_yuv_neon", ISA_NEON, convert_yuv_neon },
+#endif
+	{ NULL },
+};
+
+// Widths around the vector sizes, which leave every possible remainder
+static const uint32_t widths[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 257 };
+
+static uint32_t rng_state = 0x12345678;
+
+static uint8_t random_byte(void) {
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state >> 24;
+}
+
+// Rows are allocated with their exact size, so that reads past the end
+// show up with -Db_sanitize=address
+static uint8_t *random_row(size_t size) {
+	uint8_t *row = malloc(size);
+	if (!row) {
+		abort();
+	}
+	for (size_t i = 0; i < size; i++) {
+		row[i] = random_byte();
+	}
+	return row;
+}
+
+static bool kernel_supported(enum convert_isa isa) {
+	// The kernels of an isa need the extensions of the ones before it
+	return isa <= get_isa();
+}
+
+static int test_row_kernel(const struct row_kernel *kernel) {
+	int failures = 0;
+	for (size_t s = 0; s < sizeof(layouts) / sizeof(layouts[0]); s++) {
+		const struct format_layout *src = &layouts[s];
+		if (src->bpp != kernel->src_bpp || src->deep != kernel->deep) {
+			continue;
+		}
+		for (size_t d = 0; d < sizeof(targets) / sizeof(targets[0]); d++) {
+			struct xdpw_pixel_convert conv;
+			if (!xdpw_pixel_convert_init(&conv, targets[d], src->format,
+					XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED)) {
+				continue;
+			}
+			for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+				uint32_t width = widths[w];
+				uint8_t *in = random_row((size_t)width * src->bpp);
+				uint8_t *expected = malloc((size_t)width * 4);
+				uint8_t *actual = malloc((size_t)width * 4);
+				if (!expected || !actual) {
+					abort();
+				}
+				kernel->deep ? convert_row_10_scalar(&conv, expected, in, width) :
+					convert_row_shuffle_scalar(&conv, expected, in, width);
+				kernel->func(&conv, actual, in, width);
+				if (memcmp(expected, actual, (size_t)width * 4) != 0) {
+					fprintf(stderr, "%s: %.4s to %.4s differs at width %u\n", kernel->name,
+						(const char *)&src->format, (const char *)&targets[d], width);
+					failures++;
+				}
+				free(in);
+				free(expected);
+				free(actual);
+			}
+		}
+	}
+	return failures;
+}
+
+struct yuv_output {
+	uint8_t *y0, *y1, *u, *v;
+};
+
+static void yuv_output_init(struct yuv_output *out, uint32_t width, bool pair, bool planar) {
+	uint32_t chroma = (width + 1) / 2;
+	out->y0 = malloc(width);
+	out->y1 = pair ? malloc(width) : NULL;
+	out->u = malloc(planar ? chroma : 2 * chroma);
+	out->v = planar ? malloc(chroma) : NULL;
+	if (!out->y0 || (pair && !out->y1) || !out->u || (planar && !out->v)) {
+		abort();
+	}
+}
+
+static void yuv_output_finish(struct yuv_output *out) {
+	free(out->y0);
+	free(out->y1);
+	free(out->u);
+	free(out->v);
+}
+
+static bool yuv_output_equal(const struct yuv_output *a, const struct yuv_output *b,
+		uint32_t width) {
+	uint32_t chroma = (width + 1) / 2;
+	return memcmp(a->y0, b->y0, width) == 0 &&
+		(!a->y1 || memcmp(a->y1, b->y1, width) == 0) &&
+		memcmp(a->u, b->u, a->v ? chroma : 2 * chroma) == 0 &&
+		(!a->v || memcmp(a->v, b->v, chroma) == 0);
+}
+
+static int test_yuv_conversion(const struct yuv_kernel *kernel,
+		const struct xdpw_pixel_convert *conv) {
+	int failures = 0;
+	bool planar = conv->dst_planes == 3;
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		// The last row of a frame with an odd height has no pair
+		for (int pair = 0; pair < 2; pair++) {
+			uint32_t width = widths[w];
+			uint8_t *src0 = random_row((size_t)width * 4);
+			uint8_t *src1 = pair ? random_row((size_t)width * 4) : src0;
+			struct yuv_output expected, actual;
+			yuv_output_init(&expected, width, pair, planar);
+			yuv_output_init(&actual, width, pair, planar);
+
+			convert_yuv_scalar(conv, expected.y0, expected.y1,
+				expected.u, expected.v, src0, src1, width);
+			kernel->func(conv, actual.y0, actual.y1,
+				actual.u, actual.v, src0, src1, width);
+			if (!yuv_output_equal(&expected, &actual, width)) {
+				fprintf(stderr, "%s: %.4s to %.4s differs at width %u%s\n",
+					kernel->name, (const char *)&conv->src_format,
+					(const char *)&conv->dst_format, width,
+					pair ? "" : " without a row pair");
+				failures++;
+			}
+
+			yuv_output_finish(&expected);
+			yuv_output_finish(&actual);
+			if (pair) {
+				free(src1);
+			}
+			free(src0);
+		}
+	}
+	return failures;
+}
+
+static int test_yuv_kernel(const struct yuv_kernel *kernel) {
+	static const enum xdpw_yuv_matrix matrices[] = { XDPW_YUV_MATRIX_BT601, XDPW_YUV_MATRIX_BT709 };
+	static const enum xdpw_yuv_range ranges[] = { XDPW_YUV_RANGE_LIMITED, XDPW_YUV_RANGE_FULL };
+
+	int failures = 0;
+	for (size_t s = 0; s < sizeof(layouts) / sizeof(layouts[0]); s++) {
+		if (layouts[s].bpp != 4) {
+			continue;
+		}
+		for (size_t d = 0; d < sizeof(yuv_targets) / sizeof(yuv_targets[0]); d++) {
+			for (size_t i = 0; i < 4; i++) {
+				struct xdpw_pixel_convert conv;
+				if (!xdpw_pixel_convert_init(&conv, yuv_targets[d], layouts[s].format,
+						matrices[i / 2], ranges[i % 2])) {
+					fprintf(stderr, "%.4s to %.4s isn't supported\n",
+						(const char *)&layouts[s].format, (const char *)&yuv_targets[d]);
+					failures++;
+					continue;
+				}
+				failures += test_yuv_conversion(kernel, &conv);
+			}
+		}
+	}
+	return failures;
+}
+
+// Checks the scalar kernels themselves with pixels of known values
+static int test_scalar(void) {
+	int failures = 0;
+	struct xdpw_pixel_convert conv;
+
+	// 0xAARRGGBB to 0xXXBBGGRR
+	uint32_t argb = 0x80102030, xbgr;
+	xdpw_pixel_convert_init(&conv, DRM_FORMAT_XBGR8888, DRM_FORMAT_ARGB8888,
+		XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED);
+	convert_row_shuffle_scalar(&conv, (uint8_t *)&xbgr, (const uint8_t *)&argb, 1);
+	if (xbgr != 0xff302010) {
+		fprintf(stderr, "ARGB8888 0x%08x to XBGR8888 is 0x%08x\n", argb, xbgr);
+		failures++;
+	}
+
+	// 0xRRGGBB as little endian bytes BB GG RR to 0xXXRRGGBB
+	const uint8_t rgb[3] = { 0x30, 0x20, 0x10 };
+	uint32_t xrgb;
+	xdpw_pixel_convert_init(&conv, DRM_FORMAT_XRGB8888, DRM_FORMAT_RGB888,
+		XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED);
+	convert_row_shuffle_scalar(&conv, (uint8_t *)&xrgb, rgb, 1);
+	if (xrgb != 0xff102030) {
+		fprintf(stderr, "RGB888 to XRGB8888 is 0x%08x\n", xrgb);
+		failures++;
+	}
+
+	// 10 bit channels keep their 8 most significant bits
+	uint32_t xrgb10 = (0x3ffu << 20) | (0x200u << 10) | 0x003, xbgr8;
+	xdpw_pixel_convert_init(&conv, DRM_FORMAT_XBGR8888, DRM_FORMAT_XRGB2101010,
+		XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED);
+	convert_row_10_scalar(&conv, (uint8_t *)&xbgr8, (const uint8_t *)&xrgb10, 1);
+	if (xbgr8 != 0xff0080ff) {
+		fprintf(stderr, "XRGB2101010 0x%08x to XBGR8888 is 0x%08x\n", xrgb10, xbgr8);
+		failures++;
+	}
+
+	// White and black in limited range
+	const uint32_t white_black[2] = { 0xffffffff, 0xff000000 };
+	uint8_t y0[2], y1[2], u[1], v[1];
+	xdpw_pixel_convert_init(&conv, DRM_FORMAT_YUV420, DRM_FORMAT_XRGB8888,
+		XDPW_YUV_MATRIX_BT709, XDPW_YUV_RANGE_LIMITED);
+	convert_yuv_scalar(&conv, y0, y1, u, v, (const uint8_t *)white_black,
+		(const uint8_t *)white_black, 2);
+	if (y0[0] != 235 || y0[1] != 16 || y1[0] != 235 || y1[1] != 16 ||
+			u[0] != 128 || v[0] != 128) {
+		fprintf(stderr, "white and black are Y %u %u U %u V %u\n", y0[0], y0[1], u[0], v[0]);
+		failures++;
+	}
+	return failures;
+}
+
+int main(void) {
+	int failures = test_scalar();
+
+	printf("isa: %s\n", xdpw_pixel_convert_isa());
+	for (const struct row_kernel *kernel = row_kernels; kernel->name; kernel++) {
+		if (!kernel_supported(kernel->isa)) {
+			printf("%s: skipped\n", kernel->name);
+			continue;
+		}
+		failures += test_row_kernel(kernel);
+	}
+	for (const struct yuv_kernel *kernel = yuv_kernels; kernel->name; kernel++) {
+		if (!kernel_supported(kernel->isa)) {
+			printf("%s: skipped\n", kernel->name);
+			continue;
+		}
+		failures += test_yuv_kernel(kernel);
+	}
+
+	xdpw_worker_pool_finish();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+// Compares the vector accumulators of pixel_scale.c with the scalar one and
+// checks that scaling the damage of a frame gives the same result as
+// scaling all of it
+#include "../src/screencast/pixel_scale.c"
+
+#include <stdio.h>
+#include <string.h>
+
+struct accumulate_kernel {
+	const char *name;
+	bool supported;
+	accumulate_func func;
+};
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t random_u32(void) {
+	// xorshift32
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static uint8_t *random_bytes(size_t size) {
+	uint8_t *data = malloc(size);
+	if (!data) {
+		abort();
+	}
+	for (size_t i = 0; i < size; i++) {
+		data[i] = random_u32() >> 24;
+	}
+	return data;
+}
+
+static int test_accumulate(const struct accumulate_kernel *kernel) {
+	// Rows of 4 byte pixels around the vector sizes
+	static const size_t sizes[] = { 4, 8, 12, 16, 20, 28, 32, 36, 60, 64, 68, 1028 };
+	int failures = 0;
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t bytes = sizes[s];
+		uint16_t *expected = malloc(bytes * sizeof(*expected));
+		uint16_t *actual = malloc(bytes * sizeof(*actual));
+		if (!expected || !actual) {
+			abort();
+		}
+
+		// A box of SCALE_MAX_BOX rows with weight 1, and the two rows of
+		// the bilinear filter with weights adding up to 256
+		for (uint32_t r = 0; r < SCALE_MAX_BOX; r++) {
+			uint8_t *src = random_bytes(bytes);
+			accumulate_scalar(expected, src, 1, bytes, r == 0);
+			kernel->func(actual, src, 1, bytes, r == 0);
+			free(src);
+		}
+		if (memcmp(expected, actual, bytes * sizeof(*expected)) != 0) {
+			fprintf(stderr, "%s: box sums differ for %zu bytes\n", kernel->name, bytes);
+			failures++;
+		}
+
+		for (uint32_t weight = 1; weight < 256; weight += 37) {
+			uint8_t *src0 = random_bytes(bytes);
+			uint8_t *src1 = random_bytes(bytes);
+			accumulate_scalar(expected, src0, 256 - weight, bytes, true);
+			accumulate_scalar(expected, src1, weight, bytes, false);
+			kernel->func(actual, src0, 256 - weight, bytes, true);
+			kernel->func(actual, src1, weight, bytes, false);
+			if (memcmp(expected, actual, bytes * sizeof(*expected)) != 0) {
+				fprintf(stderr, "%s: bilinear sums differ for %zu bytes and weight %u\n",
+					kernel->name, bytes, weight);
+				failures++;
+			}
+			free(src0);
+			free(src1);
+		}
+
+		free(expected);
+		free(actual);
+	}
+	return failures;
+}
+
+static int test_solid(uint32_t src_width, uint32_t src_height,
+		uint32_t dst_width, uint32_t dst_height) {
+	struct xdpw_pixel_scale scale;
+	if (!xdpw_pixel_scale_init(&scale, src_width, src_height, dst_width, dst_height)) {
+		fprintf(stderr, "%ux%u to %ux%u isn't supported\n",
+			src_width, src_height, dst_width, dst_height);
+		return 1;
+	}
+
+	const uint32_t color = 0xff4080c0;
+	size_t src_pixels = (size_t)src_width * src_height;
+	size_t dst_pixels = (size_t)dst_width * dst_height;
+	uint32_t *src = malloc(src_pixels * 4);
+	uint32_t *dst = calloc(dst_pixels, 4);
+	if (!src || !dst) {
+		abort();
+	}
+	for (size_t i = 0; i < src_pixels; i++) {
+		src[i] = color;
+	}
+
+	struct xdpw_pixel_rect all = { 0, 0, dst_width, dst_height };
+	xdpw_pixel_scale_rect(&scale, (uint8_t *)dst, 4 * dst_width,
+		(const uint8_t *)src, 4 * src_width, &all, false);
+
+	int failures = 0;
+	for (size_t i = 0; i < dst_pixels; i++) {
+		if (dst[i] != color) {
+			fprintf(stderr, "%ux%u to %ux%u: pixel %zu of a solid frame is 0x%08x\n",
+				src_width, src_height, dst_width, dst_height, i, dst[i]);
+			failures++;
+			break;
+		}
+	}
+	free(src);
+	free(dst);
+	return failures;
+}
+
+// Scales a frame, changes a rectangle of it and scales only the pixels
+// returned by xdpw_pixel_scale_map_rect, which has to match scaling the
+// changed frame as a whole
+static int test_damage(uint32_t src_width, uint32_t src_height,
+		uint32_t dst_width, uint32_t dst_height, bool flip_y) {
+	struct xdpw_pixel_scale scale;
+	if (!xdpw_pixel_scale_init(&scale, src_width, src_height, dst_width, dst_height)) {
+		fprintf(stderr, "%ux%u to %ux%u isn't supported\n",
+			src_width, src_height, dst_width, dst_height);
+		return 1;
+	}
+
+	uint32_t src_stride = 4 * src_width, dst_stride = 4 * dst_width;
+	uint8_t *src = random_bytes((size_t)src_stride * src_height);
+	uint8_t *partial = calloc(dst_height, dst_stride);
+	uint8_t *full = calloc(dst_height, dst_stride);
+	if (!partial || !full) {
+		abort();
+	}
+
+	struct xdpw_pixel_rect all = { 0, 0, dst_width, dst_height };
+	xdpw_pixel_scale_rect(&scale, partial, dst_stride, src, src_stride, &all, flip_y);
+
+	int failures = 0;
+	for (int i = 0; i < 8; i++) {
+		struct xdpw_pixel_rect damage = {
+			.x = random_u32() % src_width,
+			.y = random_u32() % src_height,
+		};
+		damage.width = 1 + random_u32() % (src_width - damage.x);
+		damage.height = 1 + random_u32() % (src_height - damage.y);
+		for (uint32_t y = damage.y; y < damage.y + damage.height; y++) {
+			for (size_t x = 4 * (size_t)damage.x; x < 4 * (size_t)(damage.x + damage.width); x++) {
+				src[(size_t)y * src_stride + x] = random_u32() >> 24;
+			}
+		}
+
+		struct xdpw_pixel_rect dst_damage;
+		// Rectangles are in the orientation of the source, also when the
+		// rows are stored upside down
+		xdpw_pixel_scale_map_rect(&scale, &damage, &dst_damage);
+		xdpw_pixel_scale_rect(&scale, partial, dst_stride, src, src_stride,
+			&dst_damage, flip_y);
+		xdpw_pixel_scale_rect(&scale, full, dst_stride, src, src_stride, &all, flip_y);
+		if (memcmp(partial, full, (size_t)dst_stride * dst_height) != 0) {
+			fprintf(stderr, "%ux%u to %ux%u%s: damage %u,%u %ux%u mapped to %u,%u %ux%u "
+				"misses changed pixels\n", src_width, src_height, dst_width, dst_height,
+				flip_y ? " flipped" : "", damage.x, damage.y, damage.width, damage.height,
+				dst_damage.x, dst_damage.y, dst_damage.width, dst_damage.height);
+			failures++;
+			memcpy(partial, full, (size_t)dst_stride * dst_height);
+		}
+	}
+
+	free(src);
+	free(partial);
+	free(full);
+	return failures;
+}
+
+int main(void) {
+	struct accumulate_kernel kernels[] = {
+#if defined(XDPW_SCALE_X86)
+		{ "accumulate_sse2", __builtin_cpu_supports("sse2"), accumulate_sse2 },
+		{ "accumulate_avx2", __builtin_cpu_supports("avx2"), accumulate_avx2 },
+#elif defined(XDPW_SCALE_NEON)
+		{ "accumulate_neon", true, accumulate_neon },
+#endif
+		{ NULL },
+	};
+
+	int failures = 0;
+	for (const struct accumulate_kernel *kernel = kernels; kernel->name; kernel++) {
+		if (!kernel->supported) {
+			printf("%s: skipped\n", kernel->name);
+			continue;
+		}
+		failures += test_accumulate(kernel);
+	}
+
+	// Box filters, bilinear filters and boxes larger than SCALE_MAX_BOX
+	static const uint32_t sizes[][4] = {
+		{ 64, 48, 32, 24 },
+		{ 100, 75, 33, 25 },
+		{ 97, 61, 80, 50 },
+		{ 640, 360, 37, 19 },
+		{ 33, 17, 33, 17 },
+	};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		const uint32_t *s = sizes[i];
+		failures += test_solid(s[0], s[1], s[2], s[3]);
+		failures += test_damage(s[0], s[1], s[2], s[3], false);
+		failures += test_damage(s[0], s[1], s[2], s[3], true);
+	}
+
+	xdpw_worker_pool_finish();
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}